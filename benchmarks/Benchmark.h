@@ -0,0 +1,63 @@
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <algorithm>
+#include <stdio.h>
+
+#include <rct/List.h>
+#include <rct/Log.h>
+#include <rct/Map.h>
+#include <rct/StopWatch.h>
+#include <rct/String.h>
+#include <rct/Value.h>
+
+/**
+ * Collects the results of a benchmark binary and prints them as one JSON
+ * object on stdout so runs can be compared by scripts.
+ */
+class Benchmark
+{
+public:
+    Benchmark(const String &name)
+        : mName(name)
+    {
+        // without a log output everything is logged to stdout, which would
+        // end up in the middle of the JSON
+        initLogging(name.constData(), LogStderr, LogLevel::Error);
+    }
+
+    ~Benchmark()
+    {
+        Map<String, Value> out;
+        out["benchmark"] = mName;
+        out["results"]   = mResults;
+        const String json = Value(out).toJSON(true);
+        printf("%s\n", json.constData());
+        cleanupLogging();
+    }
+
+    void add(const Map<String, Value> &result)
+    {
+        mResults.append(result);
+    }
+
+    static double percentile(List<double> samples, double p)
+    {
+        if (samples.isEmpty())
+            return 0;
+        std::sort(samples.begin(), samples.end());
+        const size_t idx = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+        return samples.at(idx);
+    }
+
+    static double perSecond(unsigned long long count, unsigned long long usec)
+    {
+        return usec ? (static_cast<double>(count) * 1000000.0 / usec) : 0.0;
+    }
+
+private:
+    const String mName;
+    List<Value> mResults;
+};
+
+#endif
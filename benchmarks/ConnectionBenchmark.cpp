@@ -0,0 +1,272 @@
+#include <future>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+#include <rct/Connection.h>
+#include <rct/EventLoop.h>
+#include <rct/Message.h>
+#include <rct/SocketServer.h>
+#include <rct/StopWatch.h>
+
+#include "Benchmark.h"
+
+// The server echoes EchoMessages, counts DataMessages and answers a
+// ResponseMessage with finish() so the client knows everything before it
+// has arrived.
+template <uint8_t Id>
+class PayloadMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = Id
+    };
+
+    PayloadMessage(const String &payload = String(), uint8_t flags = None)
+        : Message(MessageId, flags)
+        , mPayload(payload)
+    {
+    }
+
+    virtual void encode(Serializer &serializer) const override
+    {
+        serializer << mPayload;
+    }
+
+    virtual void decode(Deserializer &deserializer) override
+    {
+        deserializer >> mPayload;
+    }
+
+    String mPayload;
+};
+
+typedef PayloadMessage<110> EchoMessage;
+typedef PayloadMessage<111> DataMessage;
+
+enum Transport
+{
+    Unix,
+    UnixSharedMemory,
+    Tcp
+};
+
+static const char *transportName(Transport transport)
+{
+    switch (transport) {
+    case Unix:
+        return "unix";
+    case UnixSharedMemory:
+        return "unix_shm";
+    case Tcp:
+        break;
+    }
+    return "tcp";
+}
+
+class Server
+{
+public:
+    Server(Transport transport)
+        : mTransport(transport)
+        , mPort(0)
+    {
+        std::promise<bool> listening;
+        std::future<bool> ready = listening.get_future();
+        mThread                 = std::thread([this, &listening]() { run(listening); });
+        if (!ready.get()) {
+            fprintf(stderr, "Unable to listen for %s connections\n", transportName(transport));
+            exit(1);
+        }
+    }
+
+    ~Server()
+    {
+        mLoop->quit();
+        mThread.join();
+        if (mTransport != Tcp)
+            unlink(mSocketFile.constData());
+    }
+
+    std::shared_ptr<Connection> connect() const
+    {
+        std::shared_ptr<Connection> connection = Connection::create();
+        bool connected = false, waiting = false;
+        // unix sockets can connect right away, don't leave a quit behind
+        // for the next exec() in that case
+        const auto key = connection->connected().connect([&](const std::shared_ptr<Connection> &) {
+            connected = true;
+            if (waiting)
+                EventLoop::eventLoop()->quit();
+        });
+        if (mTransport == UnixSharedMemory)
+            connection->setSharedMemoryTransport(true);
+        const bool ok = (mTransport == Tcp ? connection->connectTcp("127.0.0.1", mPort) : connection->connectUnix(mSocketFile));
+        if (!ok) {
+            fprintf(stderr, "Unable to connect\n");
+            exit(1);
+        }
+        if (!connected) {
+            waiting = true;
+            EventLoop::eventLoop()->exec(5000);
+        }
+        connection->connected().disconnect(key);
+        return connection;
+    }
+
+private:
+    void run(std::promise<bool> &listening)
+    {
+        mLoop.reset(new EventLoop);
+        mLoop->init();
+        SocketServer server;
+        bool ok = false;
+        if (mTransport != Tcp) {
+            mSocketFile = String::format<64>("/tmp/rct-benchmark-%d", getpid());
+            unlink(mSocketFile.constData());
+            ok = server.listen(mSocketFile);
+        } else {
+            for (uint16_t port = 20000 + getpid() % 20000; !ok && port < 60000; port += 7) {
+                ok = server.listen(port);
+                if (ok)
+                    mPort = port;
+            }
+        }
+        listening.set_value(ok);
+        if (!ok)
+            return;
+
+        Set<std::shared_ptr<Connection>> connections;
+        server.newConnection().connect([&](SocketServer *) {
+            while (std::shared_ptr<SocketClient> client = server.nextConnection()) {
+                std::shared_ptr<Connection> connection = Connection::create(client);
+                if (mTransport == UnixSharedMemory)
+                    connection->setSharedMemoryTransport(true);
+                connection->newMessage().connect([](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &conn) {
+                    switch (message->messageId()) {
+                    case EchoMessage::MessageId:
+                        conn->send(*message);
+                        break;
+                    case ResponseMessage::MessageId:
+                        conn->finish();
+                        break;
+                    default:
+                        break;
+                    }
+                });
+                connection->disconnected().connect([&connections](const std::shared_ptr<Connection> &conn) {
+                    connections.remove(conn);
+                });
+                connections.insert(connection);
+            }
+        });
+        mLoop->exec();
+    }
+
+    const Transport mTransport;
+    Path mSocketFile;
+    uint16_t mPort;
+    std::shared_ptr<EventLoop> mLoop;
+    std::thread mThread;
+};
+
+static void latency(Benchmark &benchmark, const Server &server, Transport transport, int count)
+{
+    std::shared_ptr<Connection> connection = server.connect();
+    List<double> samples;
+    samples.reserve(count);
+    StopWatch watch(StopWatch::Microsecond);
+    const EchoMessage ping("ping");
+    connection->newMessage().connect([&](const std::shared_ptr<Message> &, const std::shared_ptr<Connection> &conn) {
+        samples.append(watch.elapsed());
+        if (samples.size() == static_cast<size_t>(count)) {
+            EventLoop::eventLoop()->quit();
+        } else {
+            watch.restart();
+            conn->send(ping);
+        }
+    });
+    connection->send(ping);
+    EventLoop::eventLoop()->exec();
+
+    Map<String, Value> result;
+    result["name"]      = "round_trip";
+    result["transport"] = transportName(transport);
+    result["messages"]  = count;
+    result["p50_usec"]  = Benchmark::percentile(samples, 0.5);
+    result["p99_usec"]  = Benchmark::percentile(samples, 0.99);
+    benchmark.add(result);
+}
+
+// sends count messages on each connection and waits for all of them to
+// have been received
+static void throughput(Benchmark &benchmark, const Server &server, Transport transport, const char *name,
+                       int connectionCount, int count, const DataMessage &message, bool streamCompression = false)
+{
+    List<std::shared_ptr<Connection>> connections;
+    for (int i = 0; i < connectionCount; ++i) {
+        std::shared_ptr<Connection> connection = server.connect();
+        if (streamCompression)
+            connection->setStreamCompression(true);
+        connections.append(connection);
+    }
+
+    int finished = 0;
+    StopWatch watch(StopWatch::Microsecond);
+    for (const std::shared_ptr<Connection> &connection : connections) {
+        connection->finished().connect([&](const std::shared_ptr<Connection> &, int) {
+            if (++finished == connectionCount)
+                EventLoop::eventLoop()->quit();
+        });
+        for (int i = 0; i < count; ++i)
+            connection->send(message);
+        connection->send(ResponseMessage("sync"));
+    }
+    EventLoop::eventLoop()->exec();
+    const unsigned long long elapsed = watch.elapsed();
+
+    const unsigned long long messages = static_cast<unsigned long long>(count) * connectionCount;
+    Map<String, Value> result;
+    result["name"]                = name;
+    result["transport"]           = transportName(transport);
+    result["connections"]         = connectionCount;
+    result["messages"]            = static_cast<long long>(messages);
+    result["payload_bytes"]       = static_cast<int>(message.mPayload.size());
+    result["usec"]                = static_cast<long long>(elapsed);
+    result["messages_per_second"] = Benchmark::perSecond(messages, elapsed);
+    result["mb_per_second"]       = Benchmark::perSecond(messages * message.mPayload.size(), elapsed) / (1024 * 1024);
+    benchmark.add(result);
+}
+
+int main(int argc, char **argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 100000;
+    Message::registerMessage<EchoMessage>();
+    Message::registerMessage<DataMessage>();
+
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    // compresses well but not trivially
+    String text;
+    for (int i = 0; text.size() < 64 * 1024; ++i)
+        text += String::format<64>("line %d of some log output with a path /src/file%d.cpp\n", i, i % 97);
+    text.resize(64 * 1024);
+
+    Benchmark benchmark("connection");
+    for (Transport transport : { Unix, UnixSharedMemory, Tcp }) {
+        Server server(transport);
+        latency(benchmark, server, transport, std::max(1, count / 10));
+        throughput(benchmark, server, transport, "small", 1, count, DataMessage(String(64, 'x')));
+        throughput(benchmark, server, transport, "large", 1, std::max(1, count / 100), DataMessage(text));
+        throughput(benchmark, server, transport, "many_connections", 32, std::max(1, count / 32), DataMessage(String(64, 'x')));
+#ifdef RCT_HAVE_ZLIB
+        // the message caches its compressed value so large_compressed only
+        // deflates once, the stream deflates every message
+        throughput(benchmark, server, transport, "large_compressed", 1, std::max(1, count / 100), DataMessage(text, Message::Compressed));
+        throughput(benchmark, server, transport, "large_stream_compressed", 1, std::max(1, count / 100), DataMessage(text, Message::Compressed), true);
+#endif
+    }
+    return 0;
+}
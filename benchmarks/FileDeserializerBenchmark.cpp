@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <rct/MemoryMappedFile.h>
+#include <rct/Serializer.h>
+#include <rct/StopWatch.h>
+
+#include "Benchmark.h"
+
+struct Record
+{
+    uint64_t id;
+    String path;
+    List<int> values;
+};
+
+// a List<Record>, written without having it in memory
+static bool writeFile(const Path &path, size_t megabytes)
+{
+    FILE *f = fopen(path.constData(), "w");
+    if (!f)
+        return false;
+    Record record;
+    record.id = 0;
+    for (int i = 0; i < 16; ++i)
+        record.values.append(i * 31);
+    // the paths are all the same length
+    record.path = String::format<64>("/some/path/%016d.cpp", 1);
+    const size_t recordSize = Serializer::encodedSize(record.id, record.path, record.values);
+    const uint32_t count = (megabytes * 1024 * 1024) / recordSize;
+    {
+        Serializer serializer(f);
+        serializer << count;
+        for (uint32_t i = 0; i < count; ++i) {
+            record.id   = i;
+            record.path = String::format<64>("/some/path/%016u.cpp", i);
+            serializer << record.id << record.path << record.values;
+        }
+    }
+    return !fclose(f);
+}
+
+static void read(Benchmark &benchmark, const char *name, Deserializer &deserializer)
+{
+    StopWatch watch(StopWatch::Microsecond);
+    uint32_t count;
+    deserializer >> count;
+    Record record;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        deserializer >> record.id >> record.path >> record.values;
+        sum += record.id + record.path.size() + record.values.size();
+    }
+    const unsigned long long elapsed = watch.elapsed();
+
+    Map<String, Value> result;
+    result["name"]          = name;
+    result["bytes"]         = static_cast<long long>(deserializer.pos());
+    result["usec"]          = static_cast<long long>(elapsed);
+    result["mb_per_second"] = Benchmark::perSecond(deserializer.pos(), elapsed) / (1024 * 1024);
+    result["checksum"]      = static_cast<long long>(sum);
+    benchmark.add(result);
+}
+
+int main(int argc, char **argv)
+{
+    const int megabytes = argc > 1 ? atoi(argv[1]) : 1024;
+    const Path path     = argc > 2 ? Path(argv[2]) : Path(String::format<64>("/tmp/rct_deserializer_benchmark_%d", getpid()));
+
+    if (!writeFile(path, megabytes)) {
+        fprintf(stderr, "Can't write %s\n", path.constData());
+        return 1;
+    }
+
+    {
+        Benchmark benchmark("file_deserializer");
+        // the page cache is warm after writing, each source reads the same
+        for (int readAhead : { 0, static_cast<int>(Deserializer::ReadAheadBlockSize) }) {
+            FILE *f = fopen(path.constData(), "r");
+            {
+                Deserializer deserializer(f, "", readAhead);
+                read(benchmark, readAhead ? "file_read_ahead" : "file_fread_per_value", deserializer);
+            }
+            fclose(f);
+        }
+
+        MemoryMappedFile mapped(path);
+        Deserializer deserializer(mapped);
+        read(benchmark, "memory_mapped", deserializer);
+    }
+    Path::rm(path);
+    return 0;
+}
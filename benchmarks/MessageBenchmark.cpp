@@ -0,0 +1,103 @@
+#include <atomic>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include <rct/Message.h>
+#include <rct/Serializer.h>
+#include <rct/StopWatch.h>
+
+#include "Benchmark.h"
+
+template <uint8_t Id>
+class BenchmarkMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = Id
+    };
+
+    BenchmarkMessage()
+        : Message(MessageId)
+        , mId(0)
+    {
+    }
+
+    virtual void encode(Serializer &serializer) const override
+    {
+        serializer << mId << mName << mValues;
+    }
+
+    virtual void decode(Deserializer &deserializer) override
+    {
+        deserializer >> mId >> mName >> mValues;
+    }
+
+    uint64_t mId;
+    String mName;
+    List<int> mValues;
+};
+
+// the part of a frame that follows the size, which is what Message::create takes
+static String frame(const Message &message, int version)
+{
+    String ret;
+    Serializer serializer(ret);
+    serializer << version << message.messageId() << message.flags();
+    message.encode(serializer);
+    return ret;
+}
+
+template <typename T>
+static void decode(Benchmark &benchmark, const char *name, int count)
+{
+    T message;
+    message.mId   = 12345;
+    message.mName = "/some/path/to/a/file.cpp";
+    for (int i = 0; i < 8; ++i)
+        message.mValues.append(i);
+    const String data = frame(message, 1);
+
+    const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        std::atomic<int> failures(0);
+        std::vector<std::thread> threads;
+        StopWatch watch(StopWatch::Microsecond);
+        for (unsigned int t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&]()
+                                 {
+                                     for (int i = 0; i < count; ++i) {
+                                         if (!Message::create(1, data.constData(), data.size()))
+                                             ++failures;
+                                     }
+                                 });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        const unsigned long long elapsed = watch.elapsed();
+
+        Map<String, Value> result;
+        result["name"]                = name;
+        result["threads"]             = static_cast<int>(threadCount);
+        result["messages"]            = static_cast<long long>(count) * threadCount;
+        result["failures"]            = failures.load();
+        result["usec"]                = static_cast<long long>(elapsed);
+        result["messages_per_second"] = Benchmark::perSecond(static_cast<unsigned long long>(count) * threadCount, elapsed);
+        benchmark.add(result);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    typedef BenchmarkMessage<100> PlainMessage;
+    typedef BenchmarkMessage<101> PooledMessage;
+    Message::registerMessage<PlainMessage>();
+    Message::registerPooledMessage<PooledMessage>();
+
+    Benchmark benchmark("message");
+    decode<PlainMessage>(benchmark, "decode", count);
+    decode<PooledMessage>(benchmark, "decode_pooled", count);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+
+#include <rct/Serializer.h>
+#include <rct/StopWatch.h>
+
+#include "Benchmark.h"
+
+template <typename SerializerType>
+static void encode(Benchmark &benchmark, const char *name, const Map<String, List<int>> &map, int iterations)
+{
+    size_t bytes = 0;
+    StopWatch watch(StopWatch::Microsecond);
+    for (int i = 0; i < iterations; ++i) {
+        String out;
+        {
+            SerializerType serializer(out);
+            serializer << map;
+        }
+        bytes += out.size();
+    }
+    const unsigned long long elapsed = watch.elapsed();
+
+    Map<String, Value> result;
+    result["name"]          = name;
+    result["bytes"]         = static_cast<long long>(bytes);
+    result["usec"]          = static_cast<long long>(elapsed);
+    result["mb_per_second"] = Benchmark::perSecond(bytes, elapsed) / (1024 * 1024);
+    benchmark.add(result);
+}
+
+// what operator>> did for every List before it read numeric ones in one go
+static void decodeElementwise(Deserializer &deserializer, List<uint64_t> &list)
+{
+    uint32_t size;
+    deserializer >> size;
+    list.resize(size);
+    for (uint32_t i = 0; i < size; ++i)
+        deserializer >> list[i];
+}
+
+static void decodeNumbers(Benchmark &benchmark, int count, int iterations)
+{
+    List<uint64_t> numbers(count);
+    for (int i = 0; i < count; ++i)
+        numbers[i] = i * 7919ull;
+    String encoded;
+    {
+        StringSerializer serializer(encoded);
+        serializer << numbers;
+    }
+
+    for (int bulk = 0; bulk < 2; ++bulk) {
+        size_t bytes = 0;
+        StopWatch watch(StopWatch::Microsecond);
+        for (int i = 0; i < iterations; ++i) {
+            List<uint64_t> decoded;
+            Deserializer deserializer(encoded.constData(), encoded.size());
+            if (bulk) {
+                deserializer >> decoded;
+            } else {
+                decodeElementwise(deserializer, decoded);
+            }
+            bytes += encoded.size();
+        }
+        const unsigned long long elapsed = watch.elapsed();
+
+        Map<String, Value> result;
+        result["name"]          = bulk ? "decode_list_bulk" : "decode_list_elementwise";
+        result["bytes"]         = static_cast<long long>(bytes);
+        result["usec"]          = static_cast<long long>(elapsed);
+        result["mb_per_second"] = Benchmark::perSecond(bytes, elapsed) / (1024 * 1024);
+        benchmark.add(result);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int entries    = argc > 1 ? atoi(argv[1]) : 100000;
+    const int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+    Map<String, List<int>> map;
+    for (int i = 0; i < entries; ++i) {
+        List<int> &values = map[String::format<32>("/some/path/%d.cpp", i)];
+        for (int j = 0; j < i % 32; ++j)
+            values.append(i + j);
+    }
+
+    Benchmark benchmark("serializer");
+    encode<Serializer>(benchmark, "encode", map, iterations);
+    encode<StringSerializer>(benchmark, "encode_string_serializer", map, iterations);
+    decodeNumbers(benchmark, entries * 10, iterations);
+    return 0;
+}
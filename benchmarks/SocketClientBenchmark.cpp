@@ -0,0 +1,154 @@
+#include <atomic>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <rct/EventLoop.h>
+#include <rct/SocketClient.h>
+#include <rct/StopWatch.h>
+
+#include "Benchmark.h"
+
+enum Transport
+{
+    Unix,
+    Tcp
+};
+
+static const char *transportName(Transport transport)
+{
+    return transport == Unix ? "unix" : "tcp";
+}
+
+// a connected pair of sockets, unix or tcp over loopback
+static bool socketPair(Transport transport, int fds[2])
+{
+    if (transport == Unix)
+        return !::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size       = sizeof(addr);
+    if (listener == -1 || ::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || ::listen(listener, 1)
+        || ::getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &size)) {
+        return false;
+    }
+    fds[0] = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] == -1 || ::connect(fds[0], reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+        return false;
+    fds[1] = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+    return fds[1] != -1;
+}
+
+static void addResult(Benchmark &benchmark, const char *name, Transport transport, unsigned long long bytes, unsigned long long usec)
+{
+    Map<String, Value> result;
+    result["name"]          = name;
+    result["transport"]     = transportName(transport);
+    result["bytes"]         = static_cast<long long>(bytes);
+    result["usec"]          = static_cast<long long>(usec);
+    result["mb_per_second"] = Benchmark::perSecond(bytes, usec) / (1024 * 1024);
+    benchmark.add(result);
+}
+
+// SocketClient writes, a plain thread drains the other end
+static void writeBandwidth(Benchmark &benchmark, Transport transport, unsigned long long total, unsigned int chunkSize)
+{
+    int fds[2];
+    if (!socketPair(transport, fds)) {
+        fprintf(stderr, "Unable to create %s socket pair\n", transportName(transport));
+        exit(1);
+    }
+
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], transport == Unix ? SocketClient::Unix : SocketClient::Tcp));
+    // keep the write buffer bounded so we measure the socket, not memcpy
+    client->setWriteWatermarks(chunkSize * 4, chunkSize * 16);
+
+    const String chunk(chunkSize, 'x');
+    unsigned long long written = 0;
+    auto produce = [&]() {
+        while (!client->isWriteBlocked() && written < total) {
+            client->write(chunk);
+            written += chunkSize;
+        }
+    };
+    client->writeUnblocked().connect([&](const std::shared_ptr<SocketClient> &) {
+        EventLoop::eventLoop()->callLater([&]() { produce(); });
+    });
+
+    StopWatch watch(StopWatch::Microsecond);
+    std::thread reader([&]() {
+        std::vector<char> buf(256 * 1024);
+        unsigned long long received = 0;
+        while (received < total) {
+            const ssize_t r = ::read(fds[1], buf.data(), buf.size());
+            if (r <= 0)
+                break;
+            received += r;
+        }
+        EventLoop::mainEventLoop()->quit();
+    });
+    produce();
+    EventLoop::eventLoop()->exec();
+    reader.join();
+    addResult(benchmark, "write", transport, total, watch.elapsed());
+    ::close(fds[1]);
+}
+
+// a plain thread writes, SocketClient reads
+static void readBandwidth(Benchmark &benchmark, Transport transport, unsigned long long total, unsigned int chunkSize)
+{
+    int fds[2];
+    if (!socketPair(transport, fds)) {
+        fprintf(stderr, "Unable to create %s socket pair\n", transportName(transport));
+        exit(1);
+    }
+
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], transport == Unix ? SocketClient::Unix : SocketClient::Tcp));
+    unsigned long long received = 0;
+    client->readyRead().connect([&](const std::shared_ptr<SocketClient> &, Buffer &&buffer) {
+        received += buffer.size();
+        buffer.clear();
+        if (received >= total)
+            EventLoop::eventLoop()->quit();
+    });
+
+    StopWatch watch(StopWatch::Microsecond);
+    std::thread writer([&]() {
+        const String chunk(chunkSize, 'x');
+        unsigned long long written = 0;
+        while (written < total) {
+            const ssize_t w = ::write(fds[1], chunk.constData(), chunk.size());
+            if (w <= 0)
+                break;
+            written += w;
+        }
+    });
+    EventLoop::eventLoop()->exec();
+    writer.join();
+    addResult(benchmark, "read", transport, total, watch.elapsed());
+    ::close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long long megabytes = argc > 1 ? atoi(argv[1]) : 1024;
+    const unsigned long long total     = megabytes * 1024 * 1024;
+
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    Benchmark benchmark("socketclient");
+    for (Transport transport : { Unix, Tcp }) {
+        writeBandwidth(benchmark, transport, total, 64 * 1024);
+        readBandwidth(benchmark, transport, total, 64 * 1024);
+    }
+    return 0;
+}
@@ -45,6 +45,12 @@ check_cxx_symbol_exists(select "sys/select.h" HAVE_SELECT)
 check_cxx_symbol_exists(FD_CLOEXEC "fcntl.h" HAVE_CLOEXEC)
 check_cxx_symbol_exists(SO_NOSIGPIPE "sys/types.h;sys/socket.h" HAVE_NOSIGPIPE)
 check_cxx_symbol_exists(MSG_NOSIGNAL "sys/types.h;sys/socket.h" HAVE_NOSIGNAL)
+check_cxx_symbol_exists(recvmmsg "sys/socket.h" HAVE_RECVMMSG)
+check_cxx_symbol_exists(sendmmsg "sys/socket.h" HAVE_SENDMMSG)
+check_cxx_symbol_exists(sendfile "sys/sendfile.h" HAVE_SENDFILE)
+check_cxx_symbol_exists(splice "fcntl.h" HAVE_SPLICE)
+check_cxx_symbol_exists(SO_EE_ORIGIN_ZEROCOPY "sys/socket.h;linux/errqueue.h" HAVE_ZEROCOPY)
+check_cxx_symbol_exists(accept4 "sys/socket.h" HAVE_ACCEPT4)
 check_cxx_symbol_exists(GetLogicalProcessorInformation "windows.h" HAVE_PROCESSORINFORMATION)
 check_cxx_symbol_exists(SCHED_IDLE "pthread.h" HAVE_SCHEDIDLE)
 check_cxx_symbol_exists(SHM_DEST "sys/types.h;sys/ipc.h;sys/shm.h" HAVE_SHMDEST)
@@ -86,6 +92,15 @@ check_cxx_source_compiles("
       return st.st_mtim.tv_sec;
   }" HAVE_STATMTIM)
 
+check_cxx_source_compiles("
+  #include <nmmintrin.h>
+  __attribute__((target(\"sse4.2\"))) static unsigned crc(unsigned c, unsigned long long v) {
+      return _mm_crc32_u64(c, v);
+  }
+  int main(int, char**) {
+      return __builtin_cpu_supports(\"sse4.2\") ? crc(0, 0) : 0;
+  }" HAVE_CRC32C_SSE42)
+
 if (NOT DEFINED RCT_INCLUDE_DIR)
   set(RCT_INCLUDE_DIR "${CMAKE_CURRENT_BINARY_DIR}/include")
 endif ()
@@ -131,10 +146,13 @@ set(RCT_SOURCES
   ${RCT_SOURCES}
   ${CMAKE_CURRENT_LIST_DIR}/cJSON/cJSON.c
   ${CMAKE_CURRENT_LIST_DIR}/rct/Buffer.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/rct/CompressionStream.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/Config.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/Connection.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/CpuUsage.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/rct/DataFileWriter.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/Date.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/rct/DnsResolver.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/EventLoop.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/FileSystemWatcher.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/Log.cpp
@@ -149,6 +167,7 @@ set(RCT_SOURCES
   ${CMAKE_CURRENT_LIST_DIR}/rct/Semaphore.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/SharedMemory.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/SocketClient.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/rct/SocketOptions.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/SocketServer.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/String.cpp
   ${CMAKE_CURRENT_LIST_DIR}/rct/Thread.cpp
@@ -338,15 +357,23 @@ if (RCT_WITH_TESTS)
 
 endif ()
 
+if (RCT_WITH_BENCHMARKS)
+    add_subdirectory(${CMAKE_CURRENT_LIST_DIR}/benchmarks)
+endif ()
+
 if (NOT RCT_NO_INSTALL)
   install(FILES
     ${CMAKE_CURRENT_BINARY_DIR}/include/rct/rct-config.h
     rct/AES256CBC.h
     rct/Apply.h
     rct/Buffer.h
+    rct/CompressionStream.h
     rct/Config.h
     rct/Connection.h
+    rct/DataFileWriter.h
+    rct/DnsResolver.h
     rct/EventLoop.h
+    rct/FileMessage.h
     rct/FileSystemWatcher.h
     rct/List.h
     rct/Log.h
@@ -368,12 +395,15 @@ if (NOT RCT_NO_INSTALL)
     rct/Serializer.h
     rct/Set.h
     rct/SharedMemory.h
+    rct/SharedMemoryRing.h
     rct/SignalSlot.h
     rct/Size.h
     rct/SocketClient.h
+    rct/SocketOptions.h
     rct/SocketServer.h
     rct/StopWatch.h
     rct/String.h
+    rct/StringView.h
     rct/StringTokenizer.h
     rct/Thread.h
     rct/ThreadLocal.h
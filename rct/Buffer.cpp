@@ -1,9 +1,119 @@
 #include "Buffer.h"
 
+#include <atomic>
 #include <stdio.h>
+#include <vector>
 
 #include "rct/String.h"
 
+namespace {
+enum
+{
+    BlockClasses = 9 // MinBlockSize << 8 == MaxBlockSize
+};
+
+std::atomic<size_t> sMaxPoolBytes(BufferPool::DefaultMaxPoolBytes);
+// blocks released after the thread's pool was destroyed are freed
+thread_local bool sPoolDestroyed = false;
+
+struct FreeLists
+{
+    ~FreeLists()
+    {
+        sPoolDestroyed = true;
+        clear();
+    }
+
+    void clear()
+    {
+        for (std::vector<unsigned char *> &list : blocks) {
+            for (unsigned char *block : list)
+                free(block);
+            list.clear();
+        }
+        bytes = 0;
+    }
+
+    std::vector<unsigned char *> blocks[BlockClasses];
+    size_t bytes = 0;
+};
+
+FreeLists &freeLists()
+{
+    static thread_local FreeLists lists;
+    return lists;
+}
+}
+
+static int blockClass(size_t size)
+{
+    int ret          = 0;
+    size_t blockSize = BufferPool::MinBlockSize;
+    while (blockSize < size) {
+        blockSize <<= 1;
+        ++ret;
+    }
+    return ret;
+}
+
+unsigned char *BufferPool::allocate(size_t size, size_t *blockSize)
+{
+    if (size > MaxBlockSize) {
+        *blockSize = size;
+    } else {
+        const int idx = blockClass(size);
+        *blockSize    = static_cast<size_t>(MinBlockSize) << idx;
+        if (!sPoolDestroyed) {
+            FreeLists &lists                     = freeLists();
+            std::vector<unsigned char *> &blocks = lists.blocks[idx];
+            if (!blocks.empty()) {
+                unsigned char *ret = blocks.back();
+                blocks.pop_back();
+                lists.bytes -= *blockSize;
+                return ret;
+            }
+        }
+    }
+    unsigned char *ret = static_cast<unsigned char *>(malloc(*blockSize));
+    if (!ret)
+        abort();
+    return ret;
+}
+
+void BufferPool::release(unsigned char *block, size_t blockSize)
+{
+    if (!sPoolDestroyed && blockSize >= MinBlockSize && blockSize <= MaxBlockSize && !(blockSize & (blockSize - 1))) {
+        FreeLists &lists = freeLists();
+        if (lists.bytes + blockSize <= sMaxPoolBytes.load(std::memory_order_relaxed)) {
+            lists.blocks[blockClass(blockSize)].push_back(block);
+            lists.bytes += blockSize;
+            return;
+        }
+    }
+    free(block);
+}
+
+void BufferPool::setMaxPoolBytes(size_t bytes)
+{
+    sMaxPoolBytes = bytes;
+}
+
+size_t BufferPool::maxPoolBytes()
+{
+    return sMaxPoolBytes;
+}
+
+size_t BufferPool::pooledBytes()
+{
+    return sPoolDestroyed ? 0 : freeLists().bytes;
+}
+
+void BufferPool::clear()
+{
+    if (!sPoolDestroyed)
+        freeLists().clear();
+}
+
 bool Buffer::load(const String &filename)
 {
     clear();
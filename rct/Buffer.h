@@ -8,6 +8,35 @@
 #include <string.h>
 #include <utility>
 
+/**
+ * Per thread free lists of power of two blocks between MinBlockSize and
+ * MaxBlockSize. Every EventLoop runs on its own thread so each loop gets
+ * a pool of its own without any locking. Blocks may be released on a
+ * different thread than the one that allocated them, they're plain
+ * malloc() memory.
+ */
+class BufferPool
+{
+public:
+    enum
+    {
+        MinBlockSize        = 4096,
+        MaxBlockSize        = 1024 * 1024,
+        DefaultMaxPoolBytes = 4 * 1024 * 1024
+    };
+
+    // returns a block of at least @a size bytes and its size in @a blockSize
+    static unsigned char *allocate(size_t size, size_t *blockSize);
+    static void release(unsigned char *block, size_t blockSize);
+
+    // the most free memory each thread keeps around
+    static void setMaxPoolBytes(size_t bytes);
+    static size_t maxPoolBytes();
+    static size_t pooledBytes();
+    // frees the calling thread's blocks
+    static void clear();
+};
+
 class Buffer
 {
 public:
@@ -15,6 +44,7 @@ public:
         : bufferData(nullptr)
         , bufferSize(0)
         , bufferReserved(0)
+        , bufferPooled(false)
     {
     }
 
@@ -23,6 +53,7 @@ public:
         bufferData           = other.bufferData;
         bufferSize           = other.bufferSize;
         bufferReserved       = other.bufferReserved;
+        bufferPooled         = other.bufferPooled;
         other.bufferData     = nullptr;
         other.bufferSize     = 0;
         other.bufferReserved = 0;
@@ -30,21 +61,50 @@ public:
 
     ~Buffer()
     {
-        if (bufferData)
-            free(bufferData);
+        release();
     }
 
     Buffer &operator=(Buffer &&other)
     {
+        if (this == &other)
+            return *this;
+        release();
         bufferData           = other.bufferData;
         bufferSize           = other.bufferSize;
         bufferReserved       = other.bufferReserved;
+        bufferPooled         = other.bufferPooled;
         other.bufferData     = nullptr;
         other.bufferSize     = 0;
         other.bufferReserved = 0;
         return *this;
     }
 
+    /**
+     * Memory for a pooled buffer comes from and goes back to the
+     * BufferPool of the thread that allocates or releases it. Capacities
+     * are rounded up to the pool's block sizes so expect reserve() to
+     * give more than asked for. A buffer moved from keeps the setting.
+     */
+    void setPooled(bool on)
+    {
+        if (on == bufferPooled)
+            return;
+        if (bufferData) {
+            Buffer other;
+            other.bufferPooled = on;
+            other.reserve(bufferSize ? bufferSize : bufferReserved);
+            memcpy(other.bufferData, bufferData, bufferSize);
+            other.bufferSize = bufferSize;
+            *this            = std::move(other);
+        }
+        bufferPooled = on;
+    }
+
+    bool isPooled() const
+    {
+        return bufferPooled;
+    }
+
     bool isEmpty() const
     {
         return !bufferSize;
@@ -62,11 +122,8 @@ public:
             ClearThreshold = 1024 * 512
         };
 
-        if (bufferSize >= ClearThreshold) {
-            free(bufferData);
-            bufferData     = nullptr;
-            bufferReserved = 0;
-        }
+        if (bufferSize >= ClearThreshold)
+            release();
         bufferSize = 0;
     }
 
@@ -74,6 +131,10 @@ public:
     {
         if (sz <= bufferReserved)
             return;
+        if (bufferPooled) {
+            reallocatePooled(sz);
+            return;
+        }
         bufferData = static_cast<unsigned char *>(realloc(bufferData, sz));
         if (!bufferData)
             abort();
@@ -90,6 +151,13 @@ public:
             bufferSize = sz;
             return;
         }
+        if (bufferPooled) {
+            // never shrinks, the block goes back whole
+            if (sz > bufferReserved)
+                reallocatePooled(sz);
+            bufferSize = sz;
+            return;
+        }
         bufferData = static_cast<unsigned char *>(realloc(bufferData, sz));
         if (!bufferData)
             abort();
@@ -124,8 +192,34 @@ public:
     bool load(const String &filename);
 
 private:
+    void release()
+    {
+        if (bufferData) {
+            if (bufferPooled) {
+                BufferPool::release(bufferData, bufferReserved);
+            } else {
+                free(bufferData);
+            }
+            bufferData     = nullptr;
+            bufferReserved = 0;
+        }
+    }
+
+    void reallocatePooled(size_t sz)
+    {
+        size_t blockSize;
+        unsigned char *block = BufferPool::allocate(sz, &blockSize);
+        if (bufferSize)
+            memcpy(block, bufferData, bufferSize);
+        if (bufferData)
+            BufferPool::release(bufferData, bufferReserved);
+        bufferData     = block;
+        bufferReserved = blockSize;
+    }
+
     unsigned char *bufferData;
     size_t bufferSize, bufferReserved;
+    bool bufferPooled;
 
 private:
     Buffer(const Buffer &other)            = delete;
@@ -153,6 +247,12 @@ public:
         return ret - mBufferOffset;
     }
 
+    void clear()
+    {
+        mBuffers.clear();
+        mBufferOffset = 0;
+    }
+
     size_t read(void *outPtr, size_t size)
     {
         if (!size)
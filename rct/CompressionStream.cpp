@@ -0,0 +1,161 @@
+#include "CompressionStream.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef RCT_HAVE_ZLIB
+#include <zlib.h>
+
+enum
+{
+    BufferSize = 1024 * 32
+};
+
+// Every sync-flushed chunk ends with an empty stored block. Like
+// permessage-deflate we strip it on the compressing side and put it back
+// before inflating.
+static const char sSyncTrailer[] = { 0x00, 0x00, static_cast<char>(0xff), static_cast<char>(0xff) };
+#endif
+
+std::mutex CompressionStream::sMutex;
+Hash<uint32_t, String> CompressionStream::sDictionaries;
+
+CompressionStream::CompressionStream(Mode mode, int level)
+    : mMode(mode)
+    , mStream(nullptr)
+    , mDictionaryId(0)
+    , mStarted(false)
+{
+#ifndef RCT_HAVE_ZLIB
+    (void)level;
+    assert(0 && "Rct configured without zlib support");
+#else
+    mStream = new z_stream;
+    memset(mStream, 0, sizeof(z_stream));
+    const int ret = (mode == Compress ? ::deflateInit(mStream, level) : ::inflateInit(mStream));
+    if (ret != Z_OK) {
+        delete mStream;
+        mStream = nullptr;
+    }
+#endif
+}
+
+CompressionStream::~CompressionStream()
+{
+#ifdef RCT_HAVE_ZLIB
+    if (mStream) {
+        if (mMode == Compress) {
+            ::deflateEnd(mStream);
+        } else {
+            ::inflateEnd(mStream);
+        }
+        delete mStream;
+    }
+#endif
+}
+
+bool CompressionStream::setDictionary(const String &dictionary)
+{
+#ifndef RCT_HAVE_ZLIB
+    (void)dictionary;
+    return false;
+#else
+    if (!mStream || mMode != Compress || mStarted || dictionary.empty())
+        return false;
+    if (::deflateSetDictionary(mStream, reinterpret_cast<const Bytef *>(dictionary.constData()), dictionary.size()) != Z_OK)
+        return false;
+    mDictionaryId = mStream->adler;
+    return true;
+#endif
+}
+
+bool CompressionStream::process(const char *data, size_t size, String &out)
+{
+#ifndef RCT_HAVE_ZLIB
+    (void)data;
+    (void)size;
+    (void)out;
+    assert(0 && "Rct configured without zlib support");
+    return false;
+#else
+    if (!mStream)
+        return false;
+    mStarted = true;
+    char buffer[BufferSize];
+    if (mMode == Compress) {
+        mStream->next_in  = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(data));
+        mStream->avail_in = size;
+        const size_t start = out.size();
+        do {
+            mStream->next_out  = reinterpret_cast<Bytef *>(buffer);
+            mStream->avail_out = sizeof(buffer);
+            if (::deflate(mStream, Z_SYNC_FLUSH) != Z_OK)
+                return false;
+            out.append(buffer, sizeof(buffer) - mStream->avail_out);
+        } while (!mStream->avail_out);
+        if (out.size() - start >= sizeof(sSyncTrailer) && !memcmp(out.constData() + out.size() - sizeof(sSyncTrailer), sSyncTrailer, sizeof(sSyncTrailer)))
+            out.resize(out.size() - sizeof(sSyncTrailer));
+        return true;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (i == 0) {
+            mStream->next_in  = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(data));
+            mStream->avail_in = size;
+        } else {
+            mStream->next_in  = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(sSyncTrailer));
+            mStream->avail_in = sizeof(sSyncTrailer);
+        }
+        while (mStream->avail_in) {
+            mStream->next_out  = reinterpret_cast<Bytef *>(buffer);
+            mStream->avail_out = sizeof(buffer);
+            int ret            = ::inflate(mStream, Z_SYNC_FLUSH);
+            if (ret == Z_NEED_DICT) {
+                const String dict = dictionary(mStream->adler);
+                if (dict.empty())
+                    return false;
+                mDictionaryId = mStream->adler;
+                if (::inflateSetDictionary(mStream, reinterpret_cast<const Bytef *>(dict.constData()), dict.size()) != Z_OK)
+                    return false;
+                continue;
+            }
+            if (ret != Z_OK && ret != Z_BUF_ERROR)
+                return false;
+            const size_t produced = sizeof(buffer) - mStream->avail_out;
+            out.append(buffer, produced);
+            if (ret == Z_BUF_ERROR && !produced)
+                break;
+        }
+    }
+    // drain whatever is still buffered inside zlib
+    int ret;
+    do {
+        mStream->next_out  = reinterpret_cast<Bytef *>(buffer);
+        mStream->avail_out = sizeof(buffer);
+        ret                = ::inflate(mStream, Z_SYNC_FLUSH);
+        out.append(buffer, sizeof(buffer) - mStream->avail_out);
+    } while (ret == Z_OK && !mStream->avail_out);
+    return true;
+#endif
+}
+
+uint32_t CompressionStream::registerDictionary(const String &dictionary)
+{
+#ifndef RCT_HAVE_ZLIB
+    (void)dictionary;
+    return 0;
+#else
+    if (dictionary.empty())
+        return 0;
+    const uint32_t id = ::adler32(::adler32(0, nullptr, 0), reinterpret_cast<const Bytef *>(dictionary.constData()), dictionary.size());
+    std::lock_guard<std::mutex> lock(sMutex);
+    sDictionaries[id] = dictionary;
+    return id;
+#endif
+}
+
+String CompressionStream::dictionary(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    return sDictionaries.value(id);
+}
@@ -0,0 +1,91 @@
+#ifndef CompressionStream_h
+#define CompressionStream_h
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rct/Hash.h"
+#include "rct/String.h"
+
+struct z_stream_s;
+
+/**
+ * A zlib stream whose state persists across calls to process().
+ *
+ * Each call produces a self-contained chunk (the stream is sync-flushed) so
+ * the other end can decode every chunk as soon as it arrives, while later
+ * chunks still benefit from the history of earlier ones. Chunks must be
+ * processed in the order they were produced.
+ *
+ * A preset dictionary can be used by the compressing side. The uncompressing
+ * side looks it up by its zlib dictionary id among the dictionaries
+ * registered with registerDictionary() so both ends only need to register
+ * the same dictionaries at startup.
+ */
+class CompressionStream
+{
+public:
+    enum Mode
+    {
+        Compress,
+        Uncompress
+    };
+
+    enum
+    {
+        DefaultLevel = -1,
+        FastLevel    = 1
+    };
+
+    CompressionStream(Mode mode, int level = DefaultLevel);
+    ~CompressionStream();
+
+    Mode mode() const
+    {
+        return mMode;
+    }
+
+    bool isValid() const
+    {
+        return mStream;
+    }
+
+    /**
+     * Only valid in Compress mode and only before the first call to
+     * process().
+     */
+    bool setDictionary(const String &dictionary);
+
+    /**
+     * @return the zlib dictionary id (adler32) of the dictionary in use or 0
+     */
+    uint32_t dictionaryId() const
+    {
+        return mDictionaryId;
+    }
+
+    /**
+     * Compresses or uncompresses @a size bytes of @a data and appends the
+     * result to @a out.
+     */
+    bool process(const char *data, size_t size, String &out);
+
+    static uint32_t registerDictionary(const String &dictionary);
+    static String dictionary(uint32_t id);
+
+private:
+    const Mode mMode;
+    z_stream_s *mStream;
+    uint32_t mDictionaryId;
+    bool mStarted;
+
+    static std::mutex sMutex;
+    static Hash<uint32_t, String> sDictionaries;
+
+    CompressionStream(const CompressionStream &)            = delete;
+    CompressionStream &operator=(const CompressionStream &) = delete;
+};
+
+#endif
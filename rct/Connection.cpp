@@ -1,15 +1,26 @@
 #include "Connection.h"
 
 #include <assert.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <random>
 #include <stddef.h>
+#include <string.h>
 #include <utility>
 
+#include "CompressionStream.h"
 #include "EventLoop.h"
 #include "Message.h"
 #include "Serializer.h"
+#include "SharedMemory.h"
+#include "SharedMemoryRing.h"
 #include "StackBuffer.h"
 #include "Timer.h"
 #include "rct/FinishMessage.h"
+#include "rct/Hash.h"
 #include "rct/SocketClient.h"
 #include "rct/String.h"
 
@@ -20,6 +31,13 @@ Connection::Connection(int version)
     , mCheckTimer(0)
     , mFinishStatus(0)
     , mVersion(version)
+    , mLowWatermark(0)
+    , mHighWatermark(0)
+    , mSharedMemoryBacklogOffset(0)
+    , mSharedMemoryRingSize(0)
+    , mSharedMemoryState(SharedMemoryNone)
+    , mSharedMemoryWriteBlocked(false)
+    , mInitiator(false)
     , mSilent(false)
     , mIsConnected(false)
     , mWarned(false)
@@ -35,6 +53,7 @@ Connection::~Connection()
             eventLoop->unregisterTimer(mCheckTimer);
     }
     disconnect();
+    resetSharedMemory();
 }
 
 void Connection::disconnect()
@@ -44,6 +63,8 @@ void Connection::disconnect()
         mSocketClient->readyRead().disconnect();
         mSocketClient->bytesWritten().disconnect();
         mSocketClient->error().disconnect();
+        mSocketClient->writeBlocked().disconnect();
+        mSocketClient->writeUnblocked().disconnect();
         mSocketClient.reset();
     }
 }
@@ -54,10 +75,7 @@ void Connection::connect(const std::shared_ptr<SocketClient> &client)
     mSocketClient = client;
     mIsConnected  = true;
     assert(client->isConnected());
-    mSocketClient->disconnected().connect(std::bind(&Connection::onClientDisconnected, this, std::placeholders::_1));
-    mSocketClient->readyRead().connect(std::bind(&Connection::onDataAvailable, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->bytesWritten().connect(std::bind(&Connection::onDataWritten, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->error().connect(std::bind(&Connection::onSocketError, this, std::placeholders::_1, std::placeholders::_2));
+    connectSignals();
     mCheckTimer = EventLoop::eventLoop()->registerTimer([this](int)
                                                         {
                                                             checkData();
@@ -66,6 +84,19 @@ void Connection::connect(const std::shared_ptr<SocketClient> &client)
                                                         Timer::SingleShot);
 }
 
+void Connection::connectSignals()
+{
+    mSocketClient->disconnected().connect(std::bind(&Connection::onClientDisconnected, this, std::placeholders::_1));
+    mSocketClient->readyRead().connect(std::bind(&Connection::onDataAvailable, this, std::placeholders::_1, std::placeholders::_2));
+    mSocketClient->bytesWritten().connect(std::bind(&Connection::onDataWritten, this, std::placeholders::_1, std::placeholders::_2));
+    mSocketClient->error().connect(std::bind(&Connection::onSocketError, this, std::placeholders::_1, std::placeholders::_2));
+    mSocketClient->writeBlocked().connect(std::bind(&Connection::onWriteBlocked, this, std::placeholders::_1));
+    mSocketClient->writeUnblocked().connect(std::bind(&Connection::onWriteUnblocked, this, std::placeholders::_1));
+    mSocketClient->setWriteWatermarks(mLowWatermark, mHighWatermark);
+    if (!mSocketOptions.isEmpty())
+        mSocketClient->setSocketOptions(mSocketOptions);
+}
+
 void Connection::checkData()
 {
     if (!mSocketClient->buffer().empty())
@@ -91,10 +122,8 @@ bool Connection::connectUnix(const Path &socketFile, int timeout)
     }
     mSocketClient.reset(new SocketClient);
     mSocketClient->connected().connect(std::bind(&Connection::onClientConnected, this, std::placeholders::_1));
-    mSocketClient->disconnected().connect(std::bind(&Connection::onClientDisconnected, this, std::placeholders::_1));
-    mSocketClient->readyRead().connect(std::bind(&Connection::onDataAvailable, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->bytesWritten().connect(std::bind(&Connection::onDataWritten, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->error().connect(std::bind(&Connection::onSocketError, this, std::placeholders::_1, std::placeholders::_2));
+    connectSignals();
+    mInitiator = true;
     if (!mSocketClient->connect(socketFile)) {
         mSocketClient.reset();
         return false;
@@ -121,10 +150,8 @@ bool Connection::connectTcp(const String &host, uint16_t port, int timeout)
     }
     mSocketClient.reset(new SocketClient);
     mSocketClient->connected().connect(std::bind(&Connection::onClientConnected, this, std::placeholders::_1));
-    mSocketClient->disconnected().connect(std::bind(&Connection::onClientDisconnected, this, std::placeholders::_1));
-    mSocketClient->readyRead().connect(std::bind(&Connection::onDataAvailable, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->bytesWritten().connect(std::bind(&Connection::onDataWritten, this, std::placeholders::_1, std::placeholders::_2));
-    mSocketClient->error().connect(std::bind(&Connection::onSocketError, this, std::placeholders::_1, std::placeholders::_2));
+    connectSignals();
+    mInitiator = true;
     if (!mSocketClient->connect(host, port)) {
         mSocketClient.reset();
         return false;
@@ -132,6 +159,34 @@ bool Connection::connectTcp(const String &host, uint16_t port, int timeout)
     return true;
 }
 
+bool Connection::setStreamCompression(bool on, const String &dictionary)
+{
+    if (!on) {
+        mCompressor.reset();
+        return true;
+    }
+    std::unique_ptr<CompressionStream> compressor(new CompressionStream(CompressionStream::Compress, CompressionStream::FastLevel));
+    if (!compressor->isValid() || (!dictionary.empty() && !compressor->setDictionary(dictionary)))
+        return false;
+    mCompressor = std::move(compressor);
+    return true;
+}
+
+void Connection::setWriteWatermarks(size_t low, size_t high)
+{
+    mLowWatermark  = low;
+    mHighWatermark = high;
+    if (mSocketClient)
+        mSocketClient->setWriteWatermarks(low, high);
+}
+
+void Connection::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions.merge(options);
+    if (mSocketClient)
+        mSocketClient->setSocketOptions(options);
+}
+
 int Connection::pendingWrite() const
 {
     return mPendingWrite;
@@ -140,6 +195,12 @@ int Connection::pendingWrite() const
 void Connection::onDataAvailable(const std::shared_ptr<SocketClient> &client, Buffer &&buf)
 {
     auto that = shared_from_this();
+    if (mSharedMemoryState == SharedMemoryActive) {
+        // the socket only carries wakeups at this point
+        buf.clear();
+        readSharedMemory();
+        flushSharedMemory();
+    }
     while (true) {
         if (!buf.empty())
             mBuffers.push(std::forward<Buffer>(buf));
@@ -171,8 +232,17 @@ void Connection::onDataAvailable(const std::shared_ptr<SocketClient> &client, Bu
         const int read = mBuffers.read(buffer.buffer(), mPendingRead);
         assert(read == mPendingRead);
         mPendingRead = 0;
+        if (read >= Message::HeaderExtra && (buffer.buffer()[Message::HeaderExtra - 1] & Message::Control)) {
+            const ControlType type = static_cast<ControlType>(static_cast<unsigned char>(buffer.buffer()[Message::HeaderExtra - 2]));
+            if (!handleControl(type, buffer.buffer() + Message::HeaderExtra, read - Message::HeaderExtra))
+                client->close();
+            continue;
+        }
         Message::MessageError error;
-        std::shared_ptr<Message> message = Message::create(mVersion, buffer, read, &error);
+        if (!mUncompressor && read > Message::HeaderExtra && (buffer.buffer()[Message::HeaderExtra - 1] & Message::StreamCompressed))
+            mUncompressor.reset(new CompressionStream(CompressionStream::Uncompress));
+        std::shared_ptr<Message> message = Message::create(mAcceptOtherVersions ? mMinimumVersion : mVersion, mAcceptOtherVersions ? mMaximumVersion : mVersion,
+                                                           buffer, read, &error, mUncompressor.get());
         if (message) {
             if (message->messageId() == FinishMessage::MessageId) {
                 mFinishStatus = std::static_pointer_cast<FinishMessage>(message)->status();
@@ -200,32 +270,58 @@ void Connection::onDataWritten(const std::shared_ptr<SocketClient> &, int bytes)
     }
 }
 
-class SocketClientBuffer : public Serializer::Buffer
+// Collects the many small writes of an encode() into chunks so streaming a
+// message doesn't cost a socket write per field.
+// encodes straight into a chunk that goes out whenever it's full
+class ConnectionBufferPolicy
 {
 public:
-    SocketClientBuffer(const std::shared_ptr<SocketClient> &client)
-        : mClient(client)
-        , mWritten(0)
+    enum
+    {
+        ChunkSize = 1024 * 16
+    };
+
+    ConnectionBufferPolicy(Connection *connection)
+        : mConnection(connection)
+        , mFlushed(0)
     {
     }
 
-    virtual bool write(const void *data, int len) override
+    bool write(char *&cursor, char *&limit, const void *data, size_t len)
     {
-        if (mClient->write(data, len)) {
-            mWritten += len;
-            return true;
+        if (!flush(cursor, limit))
+            return false;
+        if (len >= ChunkSize) {
+            if (!mConnection->writeData(data, len))
+                return false;
+            mFlushed += len;
+        } else {
+            memcpy(mChunk, data, len);
+            cursor += len;
         }
-        return false;
+        return true;
     }
 
-    virtual int pos() const override
+    int pos(const char *cursor) const
     {
-        return mWritten;
+        return mFlushed + (cursor ? cursor - mChunk : 0);
+    }
+
+    bool flush(char *&cursor, char *&limit)
+    {
+        const size_t used = cursor ? cursor - mChunk : 0;
+        cursor            = mChunk;
+        limit             = mChunk + ChunkSize;
+        if (!used)
+            return true;
+        mFlushed += used;
+        return mConnection->writeData(mChunk, used);
     }
 
 private:
-    std::shared_ptr<SocketClient> mClient;
-    int mWritten;
+    Connection *mConnection;
+    int mFlushed;
+    char mChunk[ChunkSize];
 };
 
 bool Connection::send(const Message &message)
@@ -241,23 +337,423 @@ bool Connection::send(const Message &message)
 
     mAboutToSend(shared_from_this(), &message);
 
+    // cached and compressed values are encoded completely before they're
+    // sent, only the streaming paths need the size up front
 #ifdef RCT_SERIALIZER_VERIFY_PRIMITIVE_SIZE
     const size_t size = String::npos;
 #else
-    const size_t size = message.encodedSize();
+    const size_t size = message.mFlags & (Message::MessageCache | Message::Compressed) ? String::npos : message.encodedSize(mVersion);
 #endif
 
-    if (size == String::npos || message.mFlags & Message::MessageCache) {
+    // the checksum goes after the value and is compressed along with it
+    auto encodeChecksummed = [this, &message](String &value) {
+        StringSerializer serializer(value);
+        serializer.setVersion(mVersion);
+        serializer.setChecksumming(true);
+        message.encode(serializer);
+        const uint32_t crc = serializer.checksum();
+        serializer.setChecksumming(false);
+        serializer.write(&crc, sizeof(crc));
+    };
+
+    if (mCompressor && message.mFlags & Message::Compressed) {
+        String value, compressed;
+        if (mChecksums) {
+            encodeChecksummed(value);
+        } else {
+            StringSerializer serializer(value);
+            serializer.setVersion(mVersion);
+            message.encode(serializer);
+        }
+        if (!mCompressor->process(value.constData(), value.size(), compressed))
+            return false;
+        String header;
+        Serializer serializer(header);
+        const uint8_t flags = (message.mFlags & ~Message::MessageCache) | Message::StreamCompressed | (mChecksums ? Message::Checksummed : 0);
+        message.encodeHeader(serializer, compressed.size(), mVersion, flags);
+        mPendingWrite += header.size() + compressed.size();
+        return writeData(header) && writeData(compressed);
+    } else if (mChecksums && size == String::npos) {
+        // the cached value has no checksum, encode a fresh one
+        String value;
+        encodeChecksummed(value);
+        if (message.mFlags & Message::Compressed)
+            value = value.compress();
+        String header;
+        Serializer serializer(header);
+        message.encodeHeader(serializer, value.size(), mVersion, (message.mFlags & ~Message::MessageCache) | Message::Checksummed);
+        mPendingWrite += header.size() + value.size();
+        return writeData(header) && writeData(value);
+    } else if (size == String::npos) {
         String header, value;
         message.prepare(mVersion, header, value);
         mPendingWrite += header.size() + value.size();
-        assert(size == String::npos || size == (header.size() + value.size() - 4));
-        return (mSocketClient->write(header) && (value.empty() || mSocketClient->write(value)));
+        return writeData(header) && writeData(value);
+    } else if (mChecksums) {
+        uint32_t crc;
+        mPendingWrite += (size + sizeof(crc) + Message::HeaderExtra) + sizeof(int);
+        BasicSerializer<ConnectionBufferPolicy> serializer(this);
+        serializer.setVersion(mVersion);
+        message.encodeHeader(serializer, size + sizeof(crc), mVersion, message.mFlags | Message::Checksummed);
+        serializer.setChecksumming(true);
+        message.encode(serializer);
+        crc = serializer.checksum();
+        serializer.setChecksumming(false);
+        serializer.write(&crc, sizeof(crc));
+        return serializer.flush();
     } else {
         mPendingWrite += (size + Message::HeaderExtra) + sizeof(int);
-        Serializer serializer(std::unique_ptr<SocketClientBuffer>(new SocketClientBuffer(mSocketClient)));
+        BasicSerializer<ConnectionBufferPolicy> serializer(this);
+        serializer.setVersion(mVersion);
         message.encodeHeader(serializer, size, mVersion);
         message.encode(serializer);
-        return !serializer.hasError();
+        return serializer.flush();
+    }
+}
+
+bool Connection::send(const FileMessage &message)
+{
+    const Message &base = message;
+    if (!message.isValid())
+        return false;
+#ifndef _WIN32
+    if (mSharedMemoryState == SharedMemoryNone && !mChecksums && !(message.mFlags & (Message::Compressed | Message::MessageCache)) && isConnected()) {
+        // the header promises the length, make sure the file can deliver
+        // it before anything goes out
+        int fd;
+        eintrwrap(fd, ::open(message.path().constData(), O_RDONLY | O_CLOEXEC));
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (::fstat(fd, &st) || !S_ISREG(st.st_mode) || static_cast<uint64_t>(st.st_size) < message.offset() + message.length()) {
+            ::close(fd);
+            return false;
+        }
+        mAboutToSend(shared_from_this(), &message);
+        String header;
+        {
+            Serializer serializer(header);
+            base.encodeHeader(serializer, message.encodedSize(mVersion), mVersion);
+            message.encodePrefix(serializer);
+        }
+        mPendingWrite += header.size() + message.length();
+        const bool ok = mSocketClient->write(header) && mSocketClient->sendFile(fd, message.offset(), message.length());
+        ::close(fd);
+        if (!ok && isConnected()) {
+            // the header might be out without its contents, the stream
+            // can't be trusted anymore
+            close();
+        }
+        return ok;
+    }
+#endif
+    return send(base);
+}
+
+int Connection::broadcast(const Message &message, const List<std::shared_ptr<Connection>> &connections)
+{
+    // connections can speak different versions, the version is part of
+    // the frame
+    Hash<int, std::shared_ptr<const String>> frames;
+    int sent = 0;
+    for (const std::shared_ptr<Connection> &connection : connections) {
+        if (connection->mSharedMemoryState != SharedMemoryNone || connection->mChecksums || (connection->mCompressor && message.mFlags & Message::Compressed)) {
+            if (connection->send(message))
+                ++sent;
+            continue;
+        }
+        if (!connection->isConnected()) {
+            if (!connection->mWarned) {
+                connection->mWarned = true;
+                warning("Trying to send message to unconnected client (%d)", message.messageId());
+            }
+            continue;
+        }
+        std::shared_ptr<const String> &frame = frames[connection->mVersion];
+        if (!frame)
+            frame = message.frame(connection->mVersion);
+        connection->mAboutToSend(connection, &message);
+        connection->mPendingWrite += frame->size();
+        if (connection->mSocketClient->write(frame))
+            ++sent;
+    }
+    return sent;
+}
+
+bool Connection::writeData(const void *data, size_t size)
+{
+    switch (mSharedMemoryState) {
+    case SharedMemoryNone:
+        return mSocketClient->write(data, size);
+    case SharedMemoryPending:
+        mSharedMemoryBacklog.append(static_cast<const char *>(data), size);
+        updateSharedMemoryWriteBlocked();
+        return true;
+    case SharedMemoryActive:
+        break;
+    }
+
+    if (mSharedMemoryBacklogOffset == mSharedMemoryBacklog.size()) {
+        const size_t written = mWriteRing->write(data, size);
+        if (written == size) {
+            if (mWriteRing->takeReaderWaiting())
+                wakeSharedMemoryPeer();
+            onDataWritten(mSocketClient, written);
+            return isConnected();
+        }
+        mSharedMemoryBacklog.append(static_cast<const char *>(data) + written, size - written);
+        if (written)
+            onDataWritten(mSocketClient, written);
+    } else {
+        mSharedMemoryBacklog.append(static_cast<const char *>(data), size);
+    }
+    flushSharedMemory();
+    return isConnected();
+}
+
+bool Connection::sendControl(ControlType type, const String &value)
+{
+    String header;
+    {
+        Serializer serializer(header);
+        const uint32_t size = value.size() + Message::HeaderExtra;
+        serializer.write(&size, sizeof(size));
+        serializer << mVersion << static_cast<uint8_t>(type) << static_cast<uint8_t>(Message::Control);
+    }
+    // control frames always go through the socket, they're what switches
+    // the transport in the first place
+    mPendingWrite += header.size() + value.size();
+    return mSocketClient->write(header) && (value.empty() || mSocketClient->write(value));
+}
+
+void Connection::setSharedMemoryTransport(bool on, uint32_t ringSize)
+{
+    if (!on) {
+        mSharedMemoryRingSize = 0;
+        return;
+    }
+    uint32_t size = 4096;
+    while (size < ringSize && size < (1u << 30))
+        size <<= 1;
+    mSharedMemoryRingSize = size;
+    if (mInitiator && mIsConnected)
+        startSharedMemoryHandshake();
+}
+
+void Connection::startSharedMemoryHandshake()
+{
+#ifdef _WIN32
+    return;
+#else
+    if (mSharedMemoryState != SharedMemoryNone || !mSocketClient || !(mSocketClient->mode() & SocketClient::Unix))
+        return;
+
+    const int size = SharedMemoryRing::requiredSize(mSharedMemoryRingSize) * 2;
+    std::random_device random;
+    for (int i = 0; i < 16 && !mSharedMemory; ++i) {
+        // 0 is IPC_PRIVATE which the peer couldn't look up
+        const key_t key = static_cast<key_t>(random() & 0x7fffffff);
+        if (!key)
+            continue;
+        std::unique_ptr<SharedMemory> shm(new SharedMemory(key, size, SharedMemory::Create));
+        if (shm->isValid() && shm->attach(SharedMemory::ReadWrite))
+            mSharedMemory = std::move(shm);
+    }
+    if (!mSharedMemory) {
+        warning() << "Unable to create shared memory for connection" << Rct::strerror();
+        return;
+    }
+
+    String value;
+    {
+        Serializer serializer(value);
+        serializer << static_cast<int>(mSharedMemory->key()) << mSharedMemoryRingSize;
+    }
+    createSharedMemoryRings(true);
+    sendControl(SharedMemoryRequest, value);
+    mSharedMemoryState = SharedMemoryPending;
+#endif
+}
+
+void Connection::createSharedMemoryRings(bool initiator)
+{
+    char *address         = static_cast<char *>(mSharedMemory->address());
+    const size_t ringSize = SharedMemoryRing::requiredSize(mSharedMemoryRingSize);
+    // the first ring carries data from the initiator to the other end
+    std::unique_ptr<SharedMemoryRing> first(new SharedMemoryRing(address, mSharedMemoryRingSize, initiator));
+    std::unique_ptr<SharedMemoryRing> second(new SharedMemoryRing(address + ringSize, mSharedMemoryRingSize, initiator));
+    if (initiator) {
+        mWriteRing = std::move(first);
+        mReadRing  = std::move(second);
+    } else {
+        mReadRing  = std::move(first);
+        mWriteRing = std::move(second);
+    }
+}
+
+void Connection::resetSharedMemory()
+{
+    mReadRing.reset();
+    mWriteRing.reset();
+    mSharedMemory.reset();
+    mSharedMemoryState = SharedMemoryNone;
+}
+
+void Connection::sharedMemoryCorrupted()
+{
+    // the peer broke the ring protocol, nothing that's in the segment or
+    // still meant for it can be trusted
+    ::error() << "Shared memory ring corrupted, closing connection";
+    resetSharedMemory();
+    mBuffers.clear();
+    mPendingRead = 0;
+    mSharedMemoryBacklog.clear();
+    mSharedMemoryBacklogOffset = 0;
+    close();
+}
+
+bool Connection::handleControl(ControlType type, const char *data, int size)
+{
+    switch (type) {
+    case SharedMemoryRequest: {
+        if (mInitiator || mSharedMemoryState != SharedMemoryNone)
+            return false;
+        int key;
+        uint32_t ringSize;
+        Deserializer deserializer(data, size);
+        deserializer >> key >> ringSize;
+        if (!mSharedMemoryRingSize || !ringSize || ringSize > (1u << 30) || (ringSize & (ringSize - 1))) {
+            sendControl(SharedMemoryReject);
+            return true;
+        }
+        const int shmSize = SharedMemoryRing::requiredSize(ringSize) * 2;
+        mSharedMemory.reset(new SharedMemory(static_cast<key_t>(key), shmSize));
+        if (!mSharedMemory->isValid() || !mSharedMemory->attach(SharedMemory::ReadWrite)) {
+            mSharedMemory.reset();
+            sendControl(SharedMemoryReject);
+            return true;
+        }
+        mSharedMemoryRingSize = ringSize;
+        createSharedMemoryRings(false);
+        if (!mReadRing->isValid() || !mWriteRing->isValid()) {
+            resetSharedMemory();
+            sendControl(SharedMemoryReject);
+            return true;
+        }
+        // the acceptance is our last frame on the socket. The initiator
+        // holds back everything until it has seen it so whatever else is
+        // buffered from now on is a wakeup
+        sendControl(SharedMemoryAccept);
+        mSharedMemoryState = SharedMemoryActive;
+        mBuffers.clear();
+        readSharedMemory();
+        return true;
+    }
+    case SharedMemoryAccept:
+        if (mSharedMemoryState != SharedMemoryPending)
+            return false;
+        mSharedMemoryState = SharedMemoryActive;
+        mBuffers.clear();
+        readSharedMemory();
+        flushSharedMemory();
+        return true;
+    case SharedMemoryReject: {
+        if (mSharedMemoryState != SharedMemoryPending)
+            return false;
+        resetSharedMemory();
+        // send what was queued up during the handshake the usual way
+        String backlog = std::move(mSharedMemoryBacklog);
+        mSharedMemoryBacklog.clear();
+        mSharedMemoryBacklogOffset = 0;
+        updateSharedMemoryWriteBlocked();
+        return writeData(backlog);
+    }
+    }
+    return false;
+}
+
+void Connection::readSharedMemory()
+{
+    bool read = false;
+    while (true) {
+        const size_t available = mReadRing->available();
+        if (available > mReadRing->capacity()) {
+            sharedMemoryCorrupted();
+            return;
+        }
+        if (!available) {
+            if (mReadRing->setReaderWaiting())
+                break;
+            continue;
+        }
+        Buffer buffer;
+        buffer.resize(available);
+        // what's there can only grow unless the peer moves the head back
+        if (mReadRing->read(buffer.data(), available) != available) {
+            sharedMemoryCorrupted();
+            return;
+        }
+        mBuffers.push(std::move(buffer));
+        read = true;
+    }
+    if (read && mReadRing->takeWriterWaiting())
+        wakeSharedMemoryPeer();
+}
+
+void Connection::flushSharedMemory()
+{
+    if (mSharedMemoryState != SharedMemoryActive)
+        return;
+    size_t written = 0;
+    while (mSharedMemoryBacklogOffset < mSharedMemoryBacklog.size()) {
+        const size_t count = mWriteRing->write(mSharedMemoryBacklog.constData() + mSharedMemoryBacklogOffset,
+                                               mSharedMemoryBacklog.size() - mSharedMemoryBacklogOffset);
+        if (!count) {
+            if (mWriteRing->isCorrupted()) {
+                sharedMemoryCorrupted();
+                return;
+            }
+            // the reader wakes us up once it has made room
+            if (mWriteRing->setWriterWaiting())
+                break;
+            continue;
+        }
+        mSharedMemoryBacklogOffset += count;
+        written += count;
+    }
+    if (mSharedMemoryBacklogOffset == mSharedMemoryBacklog.size()) {
+        mSharedMemoryBacklog.clear();
+        mSharedMemoryBacklogOffset = 0;
+    }
+    if (written) {
+        if (mWriteRing->takeReaderWaiting())
+            wakeSharedMemoryPeer();
+        updateSharedMemoryWriteBlocked();
+        onDataWritten(mSocketClient, written);
+    } else {
+        updateSharedMemoryWriteBlocked();
+    }
+}
+
+void Connection::wakeSharedMemoryPeer()
+{
+    // wakeups count as pending writes so sendFinished is only emitted once
+    // they've made it out as well
+    const char wakeup = 0;
+    ++mPendingWrite;
+    mSocketClient->write(&wakeup, 1);
+}
+
+void Connection::updateSharedMemoryWriteBlocked()
+{
+    const size_t pending = mSharedMemoryBacklog.size() - mSharedMemoryBacklogOffset;
+    if (!mSharedMemoryWriteBlocked) {
+        if (mHighWatermark && pending >= mHighWatermark) {
+            mSharedMemoryWriteBlocked = true;
+            mWriteBlocked(shared_from_this());
+        }
+    } else if (!mHighWatermark || pending <= mLowWatermark) {
+        mSharedMemoryWriteBlocked = false;
+        mWriteUnblocked(shared_from_this());
     }
 }
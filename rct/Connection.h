@@ -14,16 +14,21 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#include "FileMessage.h"
 #include "FinishMessage.h"
 #include "rct/Buffer.h"
+#include "rct/List.h"
 #include "rct/Log.h"
 #include "rct/Message.h"
 #include "rct/Path.h"
 #include "rct/SignalSlot.h"
 
+class CompressionStream;
 class ConnectionPrivate;
 class Event;
 class Message;
+class SharedMemory;
+class SharedMemoryRing;
 class SocketClient;
 
 class Connection : public std::enable_shared_from_this<Connection>
@@ -53,6 +58,18 @@ public:
         return mVersion;
     }
 
+    /**
+     * Accepts messages from peers with a version from @a minimum to @a
+     * maximum, not just version(). Only useful if the messages can decode
+     * other versions, see RCT_TAGGED_FIELDS().
+     */
+    void setAcceptedVersions(int minimum, int maximum)
+    {
+        mMinimumVersion = minimum;
+        mMaximumVersion = maximum;
+        mAcceptOtherVersions = true;
+    }
+
     void setErrorHandler(std::function<void(const std::shared_ptr<SocketClient> &, Message::MessageError &&)> handler)
     {
         mErrorHandler = handler;
@@ -73,6 +90,61 @@ public:
         return mSilent;
     }
 
+    /**
+     * Messages flagged Message::Compressed are compressed with a stream that
+     * lives as long as this connection instead of one deflate per message.
+     * The peer picks this up automatically. If @a dictionary is not empty it
+     * is used as a preset dictionary; the peer must have registered the same
+     * dictionary with CompressionStream::registerDictionary(), the peer
+     * fails the message and closes the connection if it hasn't. The stream
+     * deflates every message it sends so it uses zlib's fastest level, the
+     * history makes up for most of the difference.
+     */
+    bool setStreamCompression(bool on, const String &dictionary = String());
+
+    bool streamCompression() const
+    {
+        return mCompressor != nullptr;
+    }
+
+    /**
+     * Appends the CRC32C of every message value to the frame and flags it
+     * Message::Checksummed. Receivers always check flagged frames, only
+     * the sending end needs to turn it on. The checksum is computed while
+     * the message is encoded.
+     */
+    void setChecksums(bool on)
+    {
+        mChecksums = on;
+    }
+
+    bool checksums() const
+    {
+        return mChecksums;
+    }
+
+    enum
+    {
+        DefaultSharedMemoryRingSize = 1024 * 1024
+    };
+
+    /**
+     * Once both ends of a unix socket connection have agreed to it, frames
+     * are moved through a pair of rings in a SharedMemory segment and the
+     * socket only carries single byte wakeups. Both ends must enable it,
+     * the connecting end starts the handshake when it is connected (or
+     * right away if it already is) and queues outgoing messages until the
+     * peer has answered. @a ringSize is rounded up to a power of two and
+     * only used by the connecting end. Both processes must run as the same
+     * user.
+     */
+    void setSharedMemoryTransport(bool on, uint32_t ringSize = DefaultSharedMemoryRingSize);
+
+    bool isSharedMemoryActive() const
+    {
+        return mSharedMemoryState == SharedMemoryActive;
+    }
+
 #ifndef _WIN32
     bool connectUnix(const Path &socketFile, int timeout = 0);
 #endif
@@ -80,6 +152,25 @@ public:
 
     int pendingWrite() const;
 
+    /**
+     * Forwarded to the SocketClient, see SocketClient::setWriteWatermarks().
+     * Can be called before the connection is established.
+     */
+    void setWriteWatermarks(size_t low, size_t high);
+
+    /**
+     * Forwarded to the SocketClient, see SocketClient::setSocketOptions().
+     * Can be called before the connection is established, e.g.
+     * SocketOptions().setNoDelay() for latency sensitive request/response
+     * traffic.
+     */
+    void setSocketOptions(const SocketOptions &options);
+
+    bool isWriteBlocked() const
+    {
+        return mSharedMemoryWriteBlocked || (mSocketClient && mSocketClient->isWriteBlocked());
+    }
+
     bool send(const Message &message);
 
     bool send(Message &&message)
@@ -87,6 +178,23 @@ public:
         return send(message);
     }
 
+    /**
+     * Writes the frame header and sends the file contents with
+     * SocketClient::sendFile() when the message goes out as is, see
+     * FileMessage.
+     */
+    bool send(const FileMessage &message);
+
+    /**
+     * Sends @a message to all of @a connections but encodes it only once
+     * per protocol version. Every socket queues a reference to the same
+     * immutable frame so nothing is copied per peer before the kernel
+     * write. Connections that need a frame of their own (stream
+     * compression, shared memory transport, checksums) get a regular send().
+     * @return the number of connections the message was sent to
+     */
+    static int broadcast(const Message &message, const List<std::shared_ptr<Connection>> &connections);
+
     template <int StaticBufSize>
     bool write(const char *format, ...) RCT_PRINTF_WARNING(2, 3);
 
@@ -148,6 +256,16 @@ public:
         return mError;
     }
 
+    Signal<std::function<void(std::shared_ptr<Connection>)>> &writeBlocked()
+    {
+        return mWriteBlocked;
+    }
+
+    Signal<std::function<void(std::shared_ptr<Connection>)>> &writeUnblocked()
+    {
+        return mWriteUnblocked;
+    }
+
     Signal<std::function<void(std::shared_ptr<Connection>, int)>> &finished()
     {
         return mFinished;
@@ -176,6 +294,8 @@ private:
     void onClientConnected(const std::shared_ptr<SocketClient> &)
     {
         mIsConnected = true;
+        if (mSharedMemoryRingSize)
+            startSharedMemoryHandshake();
         mConnected(shared_from_this());
     }
 
@@ -185,6 +305,17 @@ private:
         mDisconnected(shared_from_this());
     }
 
+    void onWriteBlocked(const std::shared_ptr<SocketClient> &)
+    {
+        mWriteBlocked(shared_from_this());
+    }
+
+    void onWriteUnblocked(const std::shared_ptr<SocketClient> &)
+    {
+        mWriteUnblocked(shared_from_this());
+    }
+
+    void connectSignals();
     void onDataAvailable(const std::shared_ptr<SocketClient> &, Buffer &&buffer);
     void onDataWritten(const std::shared_ptr<SocketClient> &, int);
 
@@ -197,9 +328,56 @@ private:
 
     void checkData();
 
+    enum ControlType
+    {
+        SharedMemoryRequest = 1,
+        SharedMemoryAccept,
+        SharedMemoryReject
+    };
+
+    enum SharedMemoryState
+    {
+        SharedMemoryNone,
+        SharedMemoryPending,
+        SharedMemoryActive
+    };
+
+    // all frame bytes go through here so they end up in the socket or in
+    // the shared memory ring depending on the transport in use
+    bool writeData(const void *data, size_t size);
+    bool writeData(const String &data)
+    {
+        return data.empty() || writeData(data.constData(), data.size());
+    }
+    bool sendControl(ControlType type, const String &value = String());
+    bool handleControl(ControlType type, const char *data, int size);
+    void startSharedMemoryHandshake();
+    void createSharedMemoryRings(bool initiator);
+    void resetSharedMemory();
+    void sharedMemoryCorrupted();
+    void readSharedMemory();
+    void flushSharedMemory();
+    void wakeSharedMemoryPeer();
+    void updateSharedMemoryWriteBlocked();
+
+    friend class ConnectionBufferPolicy;
+
     std::shared_ptr<SocketClient> mSocketClient;
+    std::unique_ptr<CompressionStream> mCompressor, mUncompressor;
+    std::unique_ptr<SharedMemory> mSharedMemory;
+    std::unique_ptr<SharedMemoryRing> mReadRing, mWriteRing;
     Buffers mBuffers;
     int mPendingRead, mPendingWrite, mTimeoutTimer, mCheckTimer, mFinishStatus, mVersion;
+    int mMinimumVersion { 0 }, mMaximumVersion { 0 };
+    bool mAcceptOtherVersions { false };
+    bool mChecksums { false };
+    size_t mLowWatermark, mHighWatermark;
+    SocketOptions mSocketOptions;
+    String mSharedMemoryBacklog;
+    size_t mSharedMemoryBacklogOffset;
+    uint32_t mSharedMemoryRingSize;
+    SharedMemoryState mSharedMemoryState;
+    bool mSharedMemoryWriteBlocked, mInitiator;
 
     bool mSilent, mIsConnected, mWarned;
 
@@ -207,6 +385,7 @@ private:
 
     Signal<std::function<void(std::shared_ptr<Message>, std::shared_ptr<Connection>)>> mNewMessage;
     Signal<std::function<void(std::shared_ptr<Connection>)>> mConnected, mDisconnected, mError, mSendFinished;
+    Signal<std::function<void(std::shared_ptr<Connection>)>> mWriteBlocked, mWriteUnblocked;
     Signal<std::function<void(std::shared_ptr<Connection>, int)>> mFinished;
     Signal<std::function<void(std::shared_ptr<Connection>, const Message *)>> mAboutToSend;
 };
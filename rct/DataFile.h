@@ -1,28 +1,71 @@
 #ifndef DataFile_h
 #define DataFile_h
 
+#include <limits.h>
 #include <stdio.h>
 
+#include "DataFileWriter.h"
+#include "Map.h"
+#include "MemoryMappedFile.h"
 #include "Path.h"
 #include "Serializer.h"
 
+/**
+ * The header, version and size, is always written natively. With
+ * Serializer::Compact the rest of the file is compact and the header
+ * version has CompactVersionFlag set so a file only opens with the
+ * encoding it was written with. Switching an existing format to compact
+ * should bump the version anyway.
+ *
+ * With setChecksums() the writer splits the file into sections with
+ * endSection() and each one is followed by the CRC32C of its bytes. The
+ * header gets ChecksumVersionFlag and a reader picks that up on its own,
+ * it calls endSection() where the writer did and gets false if the
+ * section it just read was damaged. The checksums are computed as the
+ * values are serialized and deserialized.
+ *
+ * Files are memory mapped for reading so nothing is read before it's
+ * decoded. A writer that starts with beginSection() makes a file of named
+ * sections instead, SectionsVersionFlag is set and a table of contents at
+ * the end, checksummed itself, has the offset, size and checksum of each
+ * one. Readers pick the sections they want with beginSection(), in any
+ * order, and never touch the pages of the others. Checksums of named
+ * sections are in the table of contents and endSection() checks all of
+ * the section, whether it was decoded or not.
+ */
 class DataFile
 {
 public:
-    DataFile(const Path &path, int version)
+    enum
+    {
+        CompactVersionFlag  = 0x40000000,
+        ChecksumVersionFlag = 0x20000000,
+        SectionsVersionFlag = 0x10000000
+    };
+
+    DataFile(const Path &path, int version, Serializer::Encoding encoding = Serializer::Native)
         : mFile(nullptr)
         , mSizeOffset(-1)
         , mSerializer(nullptr)
         , mDeserializer(nullptr)
         , mPath(path)
         , mVersion(version)
+        , mMinimumVersion(version)
+        , mMaximumVersion(version)
+        , mFileVersion(-1)
+        , mSectionStart(-1)
+        , mChecksums(false)
+        , mSectioned(false)
+        , mAsync(false)
+        , mEncoding(encoding)
     {
+        assert(!(version & (CompactVersionFlag | ChecksumVersionFlag | SectionsVersionFlag)));
     }
 
     ~DataFile()
     {
         delete mDeserializer;
-        if (mFile)
+        if (mSerializer)
             flush();
     }
 
@@ -31,13 +74,214 @@ public:
         return mPath;
     }
 
+    Serializer::Encoding encoding() const
+    {
+        return mEncoding;
+    }
+
+    /**
+     * Opens files with a version from @a minimum to @a maximum for reading,
+     * not just version(). Only useful if what's in the file can decode
+     * other versions, see RCT_FIELD_SINCE() and RCT_TAGGED_FIELDS(). Files
+     * are always written with version().
+     */
+    void setAcceptedVersions(int minimum, int maximum)
+    {
+        mMinimumVersion = minimum;
+        mMaximumVersion = maximum;
+    }
+
+    int version() const
+    {
+        return mVersion;
+    }
+
+    // the version of the file that was opened for reading
+    int fileVersion() const
+    {
+        return mFileVersion;
+    }
+
+    // has to be called before open(Write), readers take it from the file
+    void setChecksums(bool on)
+    {
+        assert(!mSerializer && !mDeserializer);
+        mChecksums = on;
+    }
+
+    bool checksums() const
+    {
+        return mChecksums;
+    }
+
+    /**
+     * Starts the section @a name when writing, ending the previous one.
+     * The first one has to come before anything else is written. When
+     * reading the following values come from section @a name, false if
+     * the file doesn't have it.
+     */
+    bool beginSection(const String &name)
+    {
+        if (mSerializer) {
+            assert(mSectioned || mSerializer->pos() == mSizeOffset + static_cast<int>(sizeof(int)));
+            assert(!mSections.contains(name));
+            if (!mSectionName.empty())
+                endSection();
+            mSectioned   = true;
+            mSectionName = name;
+            mSerializer->setChecksumming(mChecksums);
+            mSectionStart = mSerializer->pos();
+            return true;
+        }
+
+        if (!mSectioned) {
+            mError = String::format<128>("%s has no sections", mPath.c_str());
+            return false;
+        }
+        const auto it = mSections.find(name);
+        if (it == mSections.end()) {
+            mError = String::format<128>("%s has no section %s", mPath.c_str(), name.c_str());
+            return false;
+        }
+        delete mDeserializer;
+        mDeserializer = new Deserializer(mMapped.filePtr<char>() + it->second.offset, it->second.size, mPath.c_str());
+        mDeserializer->setEncoding(mEncoding);
+        mDeserializer->setVersion(mFileVersion);
+        mDeserializer->setChecksumming(mChecksums);
+        mSectionName = name;
+        return true;
+    }
+
+    // the named sections of a file opened for reading, sorted by name
+    List<String> sections() const
+    {
+        return mSections.keys();
+    }
+
+    bool hasSection(const String &name) const
+    {
+        return mSections.contains(name);
+    }
+
+    /**
+     * Writes the checksum of everything written since the previous
+     * section, or checks it when reading. flush() ends the last section if
+     * anything was written to it. Does nothing without checksums. Named
+     * sections are ended by the next beginSection() too.
+     */
+    bool endSection()
+    {
+        if (mSerializer && mSectioned) {
+            assert(!mSectionName.empty());
+            if (!checkSize())
+                return false;
+            Section &section = mSections[mSectionName];
+            section.offset   = mSectionStart;
+            section.size     = mSerializer->pos() - mSectionStart;
+            section.checksum = mSerializer->checksum();
+            mSectionName.clear();
+            return !mSerializer->hasError();
+        }
+        if (!mChecksums)
+            return true;
+        if (mSerializer) {
+            if (!checkSize())
+                return false;
+            const uint32_t crc = mSerializer->checksum();
+            mSerializer->setChecksumming(false);
+            mSerializer->write(&crc, sizeof(crc));
+            mSerializer->setChecksumming(true);
+            mSectionStart = mSerializer->pos();
+            return !mSerializer->hasError();
+        }
+        assert(mDeserializer);
+        uint32_t crc = mDeserializer->checksum();
+        uint32_t expected = 0;
+        bool ok;
+        if (mSectioned) {
+            // what wasn't decoded has to be intact too
+            const Section &section = mSections[mSectionName];
+            if (mDeserializer->pos() < section.size)
+                crc = Rct::crc32c(mMapped.filePtr<char>() + section.offset + mDeserializer->pos(), section.size - mDeserializer->pos(), crc);
+            expected = section.checksum;
+            ok       = true;
+        } else {
+            mDeserializer->setChecksumming(false);
+            ok = mDeserializer->read(&expected, sizeof(expected)) == sizeof(expected);
+            mDeserializer->setChecksumming(true);
+        }
+        if (!ok || crc != expected) {
+            if (mSectioned) {
+                mError = String::format<128>("Checksum mismatch in section %s of %s", mSectionName.c_str(), mPath.c_str());
+            } else {
+                mError = String::format<128>("Checksum mismatch in %s before offset %zu", mPath.c_str(), mDeserializer->pos());
+            }
+            return false;
+        }
+        return true;
+    }
+
     bool flush()
     {
-        if (!mFile)
+        return flush(DataFileWriter::Callback());
+    }
+
+    /**
+     * In WriteAsync mode the contents are handed to DataFileWriter and
+     * @a callback is invoked once the file is on disk, or failed to get
+     * there. error() is only about the synchronous part then.
+     */
+    bool flush(DataFileWriter::Callback &&callback)
+    {
+        if (!mSerializer)
+            return false;
+        assert(mFile || mAsync);
+        assert(!callback || mAsync);
+        if (mSectioned) {
+            if (!mSectionName.empty())
+                endSection();
+            // the table of contents, its checksum and its offset end the
+            // file, the table is always checksummed since everything else
+            // is found through it
+            mSerializer->setEncoding(Serializer::Native);
+            const uint64_t tableOffset = mSerializer->pos();
+            mSerializer->setChecksumming(true);
+            operator<<(mSections);
+            const uint32_t tableChecksum = mSerializer->checksum();
+            mSerializer->setChecksumming(false);
+            operator<<(tableChecksum);
+            operator<<(tableOffset);
+        } else if (mChecksums && mSerializer->pos() != mSectionStart) {
+            endSection();
+        }
+        if (!checkSize()) {
+            if (mFile) {
+                fclose(mFile);
+                mFile = nullptr;
+                Path::rm(mTempFilePath);
+            }
+            delete mSerializer;
+            mSerializer = nullptr;
+            mBuffer.clear();
             return false;
+        }
+        if (mAsync) {
+            delete mSerializer;
+            mSerializer = nullptr;
+            const int header[] = { headerVersion(), static_cast<int>(mBuffer.size()) };
+            static_assert(sizeof(header) == sizeof(int) * 2, "");
+            memcpy(mBuffer.data(), header, sizeof(header));
+            DataFileWriter::write(mPath, std::move(mBuffer), std::move(callback));
+            mBuffer.clear();
+            return true;
+        }
         const int size = ftell(mFile);
         assert(mSizeOffset != -1);
-        fseek(mFile, mSizeOffset, SEEK_SET);
+        fseek(mFile, 0, SEEK_SET);
+        mSerializer->setChecksumming(false);
+        mSerializer->setEncoding(Serializer::Native);
+        operator<<(headerVersion());
+        assert(ftell(mFile) == mSizeOffset);
         operator<<(size);
 
         fclose(mFile);
@@ -55,7 +299,9 @@ public:
     enum Mode
     {
         Read,
-        Write
+        Write,
+        // serializes into memory, flush() has DataFileWriter write it
+        WriteAsync
     };
 
     String error() const
@@ -65,8 +311,19 @@ public:
 
     bool open(Mode mode)
     {
-        assert(!mFile);
-        if (mode == Write) {
+        assert(!mSerializer && !mDeserializer);
+        if (mode == WriteAsync) {
+            mAsync      = true;
+            mSerializer = new StringSerializer(mBuffer);
+            operator<<(headerVersion());
+            mSizeOffset = mSerializer->pos();
+            operator<<(static_cast<int>(0));
+            mSerializer->setEncoding(mEncoding);
+            mSerializer->setVersion(mVersion);
+            mSerializer->setChecksumming(mChecksums);
+            mSectionStart = mSerializer->pos();
+            return true;
+        } else if (mode == Write) {
             if (!Path::mkdir(mPath.parentDir()))
                 return false;
             mTempFilePath = mPath + "XXXXXX";
@@ -82,30 +339,47 @@ public:
                 return false;
             }
             mSerializer = new Serializer(mFile);
-            operator<<(mVersion);
+            operator<<(headerVersion());
             mSizeOffset = ftell(mFile);
             operator<<(static_cast<int>(0));
+            mSerializer->setEncoding(mEncoding);
+            mSerializer->setVersion(mVersion);
+            mSerializer->setChecksumming(mChecksums);
+            mSectionStart = mSerializer->pos();
             return true;
         } else {
-            mContents = mPath.readAll();
-            if (mContents.empty()) {
-                if (mPath.exists())
-                    mError = "Read error " + mPath;
+            if (!mPath.exists())
+                return false;
+            if (!mMapped.open(mPath) || !mMapped.size()) {
+                mError = "Read error " + mPath;
                 return false;
             }
-            mDeserializer = new Deserializer(mContents);
+            mDeserializer = new Deserializer(mMapped, mPath.c_str());
             int version;
             (*mDeserializer) >> version;
-            if (version != mVersion) {
-                mError = String::format<128>("Wrong database version. Expected %d, got %d for %s", mVersion, version, mPath.c_str());
+            const bool compact = version & CompactVersionFlag;
+            mChecksums         = version & ChecksumVersionFlag;
+            mSectioned         = version & SectionsVersionFlag;
+            mFileVersion       = version & ~(CompactVersionFlag | ChecksumVersionFlag | SectionsVersionFlag);
+            if (compact != (mEncoding == Serializer::Compact) || mFileVersion < mMinimumVersion || mFileVersion > mMaximumVersion) {
+                mError = String::format<128>("Wrong database version. Expected %d, got %d for %s", headerVersion(), version, mPath.c_str());
                 return false;
             }
             int fs;
             (*mDeserializer) >> fs;
-            if (static_cast<size_t>(fs) != mContents.size()) {
-                mError = String::format<128>("%s seems to be corrupted. Size should have been %zu but was %d", mPath.c_str(), mContents.size(), fs);
+            if (static_cast<size_t>(fs) != mMapped.size()) {
+                mError = String::format<128>("%s seems to be corrupted. Size should have been %zu but was %d", mPath.c_str(), mMapped.size(), fs);
                 return false;
             }
+            if (mSectioned) {
+                // values come from the sections, see beginSection()
+                delete mDeserializer;
+                mDeserializer = nullptr;
+                return readSections();
+            }
+            mDeserializer->setEncoding(mEncoding);
+            mDeserializer->setVersion(mFileVersion);
+            mDeserializer->setChecksumming(mChecksums);
             return true;
         }
     }
@@ -127,13 +401,103 @@ public:
     }
 
 private:
+    struct Section
+    {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t checksum = 0;
+
+        RCT_SERIALIZED_FIELDS(Section, RCT_FIELD(offset), RCT_FIELD(size), RCT_FIELD(checksum));
+    };
+
+    bool readSections()
+    {
+        const size_t size = mMapped.size();
+        const size_t headerSize = sizeof(int) * 2;
+        uint64_t tableOffset;
+        uint32_t tableChecksum;
+        const size_t trailerSize = sizeof(tableChecksum) + sizeof(tableOffset);
+        if (size < headerSize + trailerSize) {
+            mError = String::format<128>("%s is too short for a table of contents", mPath.c_str());
+            return false;
+        }
+        const char *data = mMapped.filePtr<char>();
+        memcpy(&tableOffset, data + size - sizeof(tableOffset), sizeof(tableOffset));
+        memcpy(&tableChecksum, data + size - trailerSize, sizeof(tableChecksum));
+        if (tableOffset < headerSize || tableOffset > size - trailerSize) {
+            mError = String::format<128>("%s has a bad table of contents offset %llu", mPath.c_str(), static_cast<unsigned long long>(tableOffset));
+            return false;
+        }
+        const size_t tableSize = size - trailerSize - tableOffset;
+        if (Rct::crc32c(data + tableOffset, tableSize) != tableChecksum) {
+            mError = String::format<128>("Checksum mismatch in the table of contents of %s", mPath.c_str());
+            return false;
+        }
+        Deserializer deserializer(data + tableOffset, tableSize, mPath.c_str());
+        deserializer >> mSections;
+        if (!deserializer.atEnd()) {
+            mError = String::format<128>("%s has a bad table of contents", mPath.c_str());
+            mSections.clear();
+            return false;
+        }
+        for (const auto &section : mSections) {
+            if (section.second.offset < headerSize || section.second.offset + section.second.size > tableOffset) {
+                mError = String::format<128>("Section %s of %s is out of bounds", section.first.c_str(), mPath.c_str());
+                mSections.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The size in the header is an int and so is Serializer::pos() that
+    // offsets are taken from, a file can't get bigger than that. The size
+    // checked here is the real one so it's right even once pos() isn't.
+    bool checkSize()
+    {
+        uint64_t size;
+        if (mAsync) {
+            size = mBuffer.size();
+            if (size > INT_MAX) {
+                // the buffer grows ahead of what's written until it's flushed
+                static_cast<StringSerializer *>(mSerializer)->flush();
+                size = mBuffer.size();
+            }
+        } else {
+            size = ftello(mFile);
+        }
+        if (size <= INT_MAX)
+            return true;
+        mError = String::format<128>("%s is too big, %llu bytes", mPath.c_str(), static_cast<unsigned long long>(size));
+        return false;
+    }
+
+    int headerVersion() const
+    {
+        int ret = mVersion;
+        if (mEncoding == Serializer::Compact)
+            ret |= CompactVersionFlag;
+        if (mChecksums)
+            ret |= ChecksumVersionFlag;
+        if (mSectioned)
+            ret |= SectionsVersionFlag;
+        return ret;
+    }
+
     FILE *mFile;
     int mSizeOffset;
     Serializer *mSerializer;
     Deserializer *mDeserializer;
     Path mPath, mTempFilePath;
-    String mContents;
+    MemoryMappedFile mMapped;
+    String mBuffer;
     String mError;
     const int mVersion;
+    int mMinimumVersion, mMaximumVersion, mFileVersion;
+    int mSectionStart;
+    bool mChecksums, mSectioned, mAsync;
+    const Serializer::Encoding mEncoding;
+    String mSectionName;
+    Map<String, Section> mSections;
 };
 #endif
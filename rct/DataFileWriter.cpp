@@ -0,0 +1,201 @@
+#include "DataFileWriter.h"
+
+#include <condition_variable>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+#include "EventLoop.h"
+#include "ThreadPool.h"
+#include "rct/List.h"
+#include "rct/Rct.h"
+#include "rct/Set.h"
+
+namespace {
+struct Pending
+{
+    Path path;
+    String contents;
+    std::weak_ptr<EventLoop> loop;
+    DataFileWriter::Callback callback;
+    Path tempPath;
+    int fd = -1;
+    String error;
+};
+
+std::mutex sMutex;
+std::condition_variable sCond;
+ThreadPool *sPool = nullptr;
+List<Pending> sQueue;
+// a batch is being written, until the queue is empty
+bool sWriting = false;
+}
+
+static void fail(Pending &pending, const char *what)
+{
+    pending.error = String::format<256>("%s failure for %s %d (%s)", what, pending.path.constData(), errno, Rct::strerror().c_str());
+    if (pending.fd != -1) {
+        ::close(pending.fd);
+        pending.fd = -1;
+    }
+    if (!pending.tempPath.empty())
+        Path::rm(pending.tempPath);
+}
+
+static bool writeTemp(Pending &pending)
+{
+    if (!Path::mkdir(pending.path.parentDir())) {
+        fail(pending, "mkdir");
+        return false;
+    }
+    pending.tempPath = pending.path + "XXXXXX";
+    pending.fd       = mkstemp(&pending.tempPath[0]);
+    if (pending.fd == -1) {
+        pending.tempPath.clear();
+        fail(pending, "mkstemp");
+        return false;
+    }
+    const char *data = pending.contents.constData();
+    size_t remaining = pending.contents.size();
+    while (remaining) {
+        ssize_t written;
+        eintrwrap(written, ::write(pending.fd, data, remaining));
+        if (written <= 0) {
+            // nothing written and no error, errno is stale
+            if (!written)
+                errno = EIO;
+            fail(pending, "write");
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+    // the page cache has it now
+    pending.contents = String();
+    return true;
+}
+
+// the syncs are done back to back so the file system can commit them
+// together, the directories are synced once after all the renames
+static void writeBatch(List<Pending> &batch)
+{
+    for (Pending &pending : batch)
+        writeTemp(pending);
+    for (Pending &pending : batch) {
+        if (pending.fd == -1)
+            continue;
+        int ret;
+        eintrwrap(ret, fsync(pending.fd));
+        if (ret) {
+            fail(pending, "fsync");
+            continue;
+        }
+        ::close(pending.fd);
+        pending.fd = -1;
+    }
+    Set<Path> dirs;
+    for (Pending &pending : batch) {
+        if (!pending.error.empty())
+            continue;
+        if (rename(pending.tempPath.c_str(), pending.path.c_str())) {
+            fail(pending, "rename");
+            continue;
+        }
+        dirs.insert(pending.path.parentDir());
+    }
+    for (const Path &dir : dirs) {
+        const int fd = ::open(dir.constData(), O_RDONLY);
+        if (fd != -1) {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+}
+
+static void run()
+{
+    while (true) {
+        List<Pending> batch;
+        {
+            std::lock_guard<std::mutex> lock(sMutex);
+            if (sQueue.empty()) {
+                sWriting = false;
+                sCond.notify_all();
+                return;
+            }
+            std::swap(batch, sQueue);
+        }
+        writeBatch(batch);
+        for (Pending &pending : batch) {
+            if (!pending.callback)
+                continue;
+            if (std::shared_ptr<EventLoop> loop = pending.loop.lock()) {
+                const Path path                         = pending.path;
+                const String error                      = pending.error;
+                const DataFileWriter::Callback callback = std::move(pending.callback);
+                loop->callLater([path, error, callback]() { callback(path, error); });
+            }
+        }
+    }
+}
+
+// registered with atexit() when the thread is started, the queue and
+// the mutex outlive it since they were constructed before
+static void shutdown()
+{
+    DataFileWriter::waitForPending();
+    ThreadPool *pool;
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        pool  = sPool;
+        sPool = nullptr;
+    }
+    delete pool;
+}
+
+static String writeNow(const Path &path, String &&contents)
+{
+    List<Pending> batch(1);
+    batch.first().path     = path;
+    batch.first().contents = std::move(contents);
+    writeBatch(batch);
+    return batch.first().error;
+}
+
+void DataFileWriter::write(const Path &path, String &&contents, Callback &&callback)
+{
+    std::shared_ptr<EventLoop> loop = EventLoop::eventLoop();
+    if (!loop) {
+        // nowhere to deliver it later
+        const String error = writeNow(path, std::move(contents));
+        if (callback)
+            callback(path, error);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(sMutex);
+    Pending pending;
+    pending.path     = path;
+    pending.contents = std::move(contents);
+    pending.loop     = loop;
+    pending.callback = std::move(callback);
+    sQueue.append(std::move(pending));
+    if (sWriting)
+        return;
+    sWriting = true;
+    if (!sPool) {
+        sPool = new ThreadPool(1);
+        atexit(shutdown);
+    }
+    sPool->start(run);
+}
+
+void DataFileWriter::waitForPending()
+{
+    std::unique_lock<std::mutex> lock(sMutex);
+    while (sWriting)
+        sCond.wait(lock);
+}
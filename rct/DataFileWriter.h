@@ -0,0 +1,37 @@
+#ifndef DataFileWriter_h
+#define DataFileWriter_h
+
+#include <functional>
+
+#include "rct/Path.h"
+#include "rct/String.h"
+
+/**
+ * Writes complete files on a thread of its own, see
+ * DataFile::open(WriteAsync). Every file goes to a temp file next to it
+ * and is renamed over @a path once it's on disk so readers see the old
+ * contents or the new ones, never a partial file.
+ *
+ * Files queued while the thread is busy are written as one batch: all of
+ * them are written first, then synced one after the other, renamed and
+ * each directory involved is synced once. Under load that's one round of
+ * syncs for many files rather than one per file.
+ *
+ * The callback is invoked on the EventLoop of the thread that called
+ * write(), or the file is written right away if that thread doesn't have
+ * one. What's still queued when the process calls exit() is written
+ * before it exits, their callbacks might not get to run.
+ */
+class DataFileWriter
+{
+public:
+    // @a error is empty if @a path was written
+    typedef std::function<void(const Path &path, const String &error)> Callback;
+
+    static void write(const Path &path, String &&contents, Callback &&callback = Callback());
+
+    // blocks until everything passed to write() so far is on disk
+    static void waitForPending();
+};
+
+#endif
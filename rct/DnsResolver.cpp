@@ -0,0 +1,232 @@
+#include "DnsResolver.h"
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EventLoop.h"
+#include "ThreadPool.h"
+#include "rct/Hash.h"
+
+namespace {
+struct Waiter
+{
+    std::weak_ptr<EventLoop> loop;
+    DnsResolver::Callback callback;
+};
+
+struct CacheEntry
+{
+    List<String> addresses;
+    uint64_t expires;
+};
+
+std::mutex sMutex;
+ThreadPool *sPool = nullptr;
+int sConcurrentLookups = DnsResolver::DefaultConcurrentLookups;
+int sCacheTimeout = DnsResolver::DefaultCacheTimeout;
+int sNegativeCacheTimeout = DnsResolver::DefaultNegativeCacheTimeout;
+Hash<String, CacheEntry> sCache;
+// lookups in flight and everyone waiting for them
+Hash<String, List<Waiter>> sPending;
+}
+
+static String cacheKey(const String &host, Rct::LookupMode mode)
+{
+    String key = host;
+    key += static_cast<char>('0' + mode);
+    return key;
+}
+
+// registered with atexit() when the pool is created, lookups that haven't
+// started are dropped and the running ones are waited for
+static void shutdown()
+{
+    ThreadPool *pool;
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        pool  = sPool;
+        sPool = nullptr;
+    }
+    delete pool;
+    std::lock_guard<std::mutex> lock(sMutex);
+    sPending.clear();
+}
+
+static void deliver(const String &host, const List<String> &addresses, List<Waiter> &&waiters)
+{
+    for (Waiter &waiter : waiters) {
+        if (std::shared_ptr<EventLoop> loop = waiter.loop.lock()) {
+            DnsResolver::Callback callback = std::move(waiter.callback);
+            loop->callLater([host, addresses, callback]() { callback(host, addresses); });
+        }
+    }
+}
+
+// sMutex must be held
+static void insertCacheEntry(const String &key, const List<String> &addresses)
+{
+    const int timeout = addresses.empty() ? sNegativeCacheTimeout : sCacheTimeout;
+    if (timeout <= 0)
+        return;
+    const uint64_t now = Rct::monoMs();
+    if (sCache.size() >= DnsResolver::MaxCacheEntries) {
+        for (auto it = sCache.begin(); it != sCache.end();) {
+            if (it->second.expires <= now) {
+                it = sCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (sCache.size() >= DnsResolver::MaxCacheEntries)
+            sCache.clear();
+    }
+    CacheEntry &entry = sCache[key];
+    entry.addresses   = addresses;
+    entry.expires     = now + timeout;
+}
+
+void DnsResolver::resolve(const String &host, Callback &&callback, Rct::LookupMode mode)
+{
+    std::shared_ptr<EventLoop> loop = EventLoop::eventLoop();
+    List<String> addresses;
+    if (!loop) {
+        // nowhere to deliver it later
+        if (!cached(host, &addresses, mode)) {
+            addresses = lookup(host, mode);
+            std::lock_guard<std::mutex> lock(sMutex);
+            insertCacheEntry(cacheKey(host, mode), addresses);
+        }
+        callback(host, addresses);
+        return;
+    }
+
+    if (cached(host, &addresses, mode)) {
+        loop->callLater([host, addresses, callback]() { callback(host, addresses); });
+        return;
+    }
+
+    const String key = cacheKey(host, mode);
+    std::lock_guard<std::mutex> lock(sMutex);
+    List<Waiter> &waiters = sPending[key];
+    waiters.append(Waiter { loop, std::move(callback) });
+    if (waiters.size() > 1)
+        return;
+
+    if (!sPool) {
+        sPool = new ThreadPool(sConcurrentLookups);
+        atexit(shutdown);
+    }
+    sPool->start([host, mode, key]() {
+        const List<String> result = lookup(host, mode);
+        List<Waiter> done;
+        {
+            std::lock_guard<std::mutex> locker(sMutex);
+            insertCacheEntry(key, result);
+            done = sPending.take(key);
+        }
+        deliver(host, result, std::move(done));
+    });
+}
+
+bool DnsResolver::cached(const String &host, List<String> *addresses, Rct::LookupMode mode)
+{
+    if (Rct::isIP(host, mode)) {
+        if (addresses)
+            *addresses = List<String>() << host;
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(sMutex);
+    auto it = sCache.find(cacheKey(host, mode));
+    if (it == sCache.end())
+        return false;
+    if (it->second.expires <= Rct::monoMs()) {
+        sCache.erase(it);
+        return false;
+    }
+    if (addresses)
+        *addresses = it->second.addresses;
+    return true;
+}
+
+void DnsResolver::setCacheTimeout(int ms, int negativeMs)
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    sCacheTimeout         = ms;
+    sNegativeCacheTimeout = negativeMs;
+    if (ms <= 0 && negativeMs <= 0)
+        sCache.clear();
+}
+
+int DnsResolver::cacheTimeout()
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    return sCacheTimeout;
+}
+
+int DnsResolver::negativeCacheTimeout()
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    return sNegativeCacheTimeout;
+}
+
+void DnsResolver::clearCache()
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    sCache.clear();
+}
+
+void DnsResolver::setConcurrentLookups(int count)
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    sConcurrentLookups = std::max(1, count);
+    if (sPool)
+        sPool->setConcurrentJobs(sConcurrentLookups);
+}
+
+List<String> DnsResolver::lookup(const String &host, Rct::LookupMode mode)
+{
+    List<String> ret;
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    switch (mode) {
+    case Rct::IPv4:
+        hints.ai_family = AF_INET;
+        break;
+    case Rct::IPv6:
+        hints.ai_family = AF_INET6;
+        break;
+    case Rct::Auto:
+        hints.ai_family = AF_UNSPEC;
+        break;
+    }
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (host.empty() || getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0)
+        return ret;
+
+    char buf[INET6_ADDRSTRLEN];
+    for (addrinfo *p = res; p; p = p->ai_next) {
+        const char *address = nullptr;
+        if (p->ai_family == AF_INET) {
+            address = inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(p->ai_addr)->sin_addr, buf, sizeof(buf));
+        } else if (p->ai_family == AF_INET6) {
+            address = inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(p->ai_addr)->sin6_addr, buf, sizeof(buf));
+        }
+        if (address && !ret.contains(String(address)))
+            ret.append(address);
+    }
+    freeaddrinfo(res);
+    return ret;
+}
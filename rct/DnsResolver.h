@@ -0,0 +1,58 @@
+#ifndef DNSRESOLVER_H
+#define DNSRESOLVER_H
+
+#include <functional>
+#include <stdint.h>
+
+#include "rct/List.h"
+#include "rct/Rct.h"
+#include "rct/String.h"
+
+/**
+ * Resolves host names with getaddrinfo() on a small pool of threads of its
+ * own so the EventLoop never blocks on DNS. The callback is invoked on the
+ * EventLoop of the thread that called resolve(), or right away if that
+ * thread doesn't have one. Concurrent lookups of the same name share one
+ * getaddrinfo() call and results are cached in process.
+ *
+ * getaddrinfo() doesn't report record TTLs so cached entries expire after
+ * cacheTimeout() ms (negativeCacheTimeout() for failed lookups).
+ *
+ * The threads are stopped when the process calls exit(), lookups that are
+ * still running are waited for, their callbacks might not get to run.
+ */
+class DnsResolver
+{
+public:
+    enum
+    {
+        DefaultCacheTimeout         = 60000,
+        DefaultNegativeCacheTimeout = 5000,
+        DefaultConcurrentLookups    = 2,
+        MaxCacheEntries             = 1024
+    };
+
+    // @a addresses are numeric, in the order getaddrinfo() returned them
+    // and empty if the lookup failed
+    typedef std::function<void(const String &host, const List<String> &addresses)> Callback;
+
+    static void resolve(const String &host, Callback &&callback, Rct::LookupMode mode = Rct::Auto);
+
+    /**
+     * Returns true if @a host is an ip address or has a cache entry that
+     * hasn't expired, @a addresses is filled in if it's not null.
+     */
+    static bool cached(const String &host, List<String> *addresses, Rct::LookupMode mode = Rct::Auto);
+
+    static void setCacheTimeout(int ms, int negativeMs = DefaultNegativeCacheTimeout);
+    static int cacheTimeout();
+    static int negativeCacheTimeout();
+    static void clearCache();
+
+    static void setConcurrentLookups(int count);
+
+    // blocking lookup on the calling thread, bypasses the cache
+    static List<String> lookup(const String &host, Rct::LookupMode mode = Rct::Auto);
+};
+
+#endif
@@ -730,6 +730,13 @@ unsigned int EventLoop::processSocket(int fd, int timeout)
     return processSocketEvents(events, eventCount);
 }
 
+unsigned int EventLoop::socketMode(int fd) const
+{
+    std::lock_guard<std::mutex> locker(mMutex);
+    const auto socket = mSockets.find(fd);
+    return socket != mSockets.end() ? socket->second.first : 0;
+}
+
 unsigned int EventLoop::fireSocket(int fd, unsigned int mode)
 {
     std::unique_lock<std::mutex> locker(mMutex);
@@ -767,14 +774,29 @@ unsigned int EventLoop::processSocketEvents(NativeEvent *events, int eventCount)
     for (int i = 0; i < eventCount; ++i) {
         unsigned int mode = 0;
 #if defined(HAVE_EPOLL)
-        const uint32_t ev = events[i].events;
-        const int fd      = events[i].data.fd;
+        uint32_t ev  = events[i].events;
+        const int fd = events[i].data.fd;
+        if ((ev & EPOLLERR) && !(ev & EPOLLHUP) && (socketMode(fd) & SocketErrorQueue)) {
+            // SO_ERROR is only set for actual errors
+            int err        = 0;
+            socklen_t size = sizeof(err);
+            if (!::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &size) && !err) {
+                ev &= ~EPOLLERR;
+                mode |= SocketErrorQueue;
+            }
+        }
         if (ev & (EPOLLERR | EPOLLHUP) && !(ev & EPOLLRDHUP)) {
             // bad, take the fd out
             epoll_ctl(mPollFd, EPOLL_CTL_DEL, fd, &events[i]);
+            // the callback still hears about it once
+            std::function<void(int, unsigned int)> callback;
             {
                 std::lock_guard<std::mutex> locker(mMutex);
-                mSockets.erase(fd);
+                const auto socket = mSockets.find(fd);
+                if (socket == mSockets.end())
+                    continue;
+                callback = std::move(socket->second.second);
+                mSockets.erase(socket);
             }
             if (ev & EPOLLERR) {
                 int err;
@@ -798,7 +820,8 @@ unsigned int EventLoop::processSocketEvents(NativeEvent *events, int eventCount)
                 }
             }
 
-            all |= fireSocket(fd, mode);
+            RCT_CALLBACK(callback(fd, mode));
+            all |= mode;
             continue;
         }
         if (ev & (EPOLLIN | EPOLLRDHUP)) {
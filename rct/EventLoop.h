@@ -170,7 +170,11 @@ public:
         SocketWrite          = 0x2,
         SocketOneShot        = 0x4,
         SocketError          = 0x8,
-        SocketLevelTriggered = 0x10
+        SocketLevelTriggered = 0x10,
+        // EPOLLERR without a pending socket error is passed on as this
+        // instead of taking the socket out, e.g. MSG_ZEROCOPY completions
+        // waiting in the error queue. Linux only.
+        SocketErrorQueue     = 0x20
     };
 
     bool registerSocket(int fd, unsigned int mode, std::function<void(int, unsigned int)> &&func);
@@ -249,6 +253,7 @@ private:
     bool sendTimers();
     void cleanup();
     unsigned int processSocketEvents(NativeEvent *events, int eventCount);
+    unsigned int socketMode(int fd) const;
     unsigned int fireSocket(int fd, unsigned int mode);
 
     static void error(const char *err);
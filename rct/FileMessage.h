@@ -0,0 +1,157 @@
+#ifndef FileMessage_h
+#define FileMessage_h
+
+#include <algorithm>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rct/Log.h>
+#include <rct/Message.h>
+#include <rct/Path.h>
+
+/**
+ * Carries the contents of a file region. The value is the path, the
+ * length and then the raw contents. Connection::send() writes the path
+ * and length and hands the rest to SocketClient::sendFile() so the
+ * contents never pass through user space on the sending side. Anything
+ * that needs the whole value (shared memory transport, compression,
+ * Message::frame()) reads the file in encode() instead.
+ *
+ * The receiving end gets the contents in contents(). FileMessage isn't
+ * registered by default, both ends have to call
+ * Message::registerMessage<FileMessage>() to use it.
+ */
+class FileMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = FileMessageId
+    };
+
+    // a @a length of -1 means everything from @a offset
+    FileMessage(const Path &path = Path(), uint64_t offset = 0, int64_t length = -1)
+        : Message(MessageId)
+        , mPath(path)
+        , mOffset(offset)
+        , mLength(-1)
+    {
+        if (path.empty())
+            return;
+        const int64_t size = path.fileSize();
+        if (size >= 0 && static_cast<uint64_t>(size) >= offset) {
+            const int64_t available = size - offset;
+            mLength                 = length < 0 ? available : std::min(length, available);
+            if (mLength > maximumLength()) {
+                ::warning() << "Too much of" << path << "for one message" << mLength;
+                mLength = -1;
+            }
+        }
+    }
+
+    const Path &path() const
+    {
+        return mPath;
+    }
+
+    uint64_t offset() const
+    {
+        return mOffset;
+    }
+
+    // -1 if the file couldn't be read or didn't arrive intact
+    int64_t length() const
+    {
+        return mLength;
+    }
+
+    bool isValid() const
+    {
+        return mLength >= 0 && mLength <= maximumLength();
+    }
+
+    // the whole frame has to fit in the int the receiving end reads it into
+    int64_t maximumLength() const
+    {
+        return INT_MAX - HeaderExtra - static_cast<int64_t>(prefixSize());
+    }
+
+    const String &contents() const
+    {
+        return mContents;
+    }
+
+    // what precedes the contents in the value
+    void encodePrefix(Serializer &serializer) const
+    {
+        serializer << mPath << static_cast<uint64_t>(std::max<int64_t>(mLength, 0));
+    }
+
+    size_t prefixSize() const
+    {
+        return Serializer::encodedSize(mPath, uint64_t());
+    }
+
+    virtual size_t encodedSize(int = Serializer::LatestVersion) const override
+    {
+        return prefixSize() + std::max<int64_t>(mLength, 0);
+    }
+
+    virtual void encode(Serializer &serializer) const override
+    {
+        encodePrefix(serializer);
+        if (mLength <= 0)
+            return;
+        char buf[16384];
+        int64_t remaining = mLength;
+        if (FILE *f = fopen(mPath.constData(), "r")) {
+            if (!fseeko(f, mOffset, SEEK_SET)) {
+                while (remaining > 0) {
+                    const size_t r = fread(buf, 1, std::min<int64_t>(remaining, sizeof(buf)), f);
+                    if (!r || !serializer.write(buf, r))
+                        break;
+                    remaining -= r;
+                }
+            }
+            fclose(f);
+        }
+        if (remaining) {
+            // the length is out already, keep the frame intact
+            ::warning() << "Couldn't read" << remaining << "bytes of" << mPath;
+            memset(buf, 0, sizeof(buf));
+            while (remaining > 0) {
+                const int64_t chunk = std::min<int64_t>(remaining, sizeof(buf));
+                serializer.write(buf, chunk);
+                remaining -= chunk;
+            }
+        }
+    }
+
+    virtual void decode(Deserializer &deserializer) override
+    {
+        uint64_t length;
+        deserializer >> mPath >> length;
+        mContents.clear();
+        if (length > deserializer.length() - deserializer.pos()) {
+            ::error() << "FileMessage for" << mPath << "claims" << length << "bytes, only"
+                      << (deserializer.length() - deserializer.pos()) << "left";
+            mLength = -1;
+            return;
+        }
+        mLength = length;
+        mContents.resize(length);
+        if (length && deserializer.read(mContents.data(), length) != static_cast<int>(length)) {
+            mContents.clear();
+            mLength = -1;
+        }
+    }
+
+private:
+    Path mPath;
+    uint64_t mOffset;
+    int64_t mLength;
+    String mContents;
+};
+
+#endif
@@ -22,20 +22,7 @@ public:
         return mStatus;
     }
 
-    virtual size_t encodedSize() const override
-    {
-        return sizeof(mStatus);
-    }
-
-    virtual void encode(Serializer &s) const override
-    {
-        s << mStatus;
-    }
-
-    virtual void decode(Deserializer &d) override
-    {
-        d >> mStatus;
-    }
+    RCT_MESSAGE_FIELDS(FinishMessage, RCT_FIELD(mStatus));
 
 private:
     int mStatus;
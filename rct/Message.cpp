@@ -1,14 +1,17 @@
 #include "Message.h"
 
 #include <algorithm>
+#include <assert.h>
 #include <cstdlib>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
+#include <string.h>
 #include <utility>
 
+#include "CompressionStream.h"
 #include "FinishMessage.h"
 #include "QuitMessage.h"
 #include "ResponseMessage.h"
@@ -18,8 +21,25 @@
 #include "rct/Message.h"
 #include "rct/String.h"
 
-std::mutex Message::sMutex;
-Map<uint8_t, Message::MessageCreatorBase *> Message::sFactory;
+std::atomic<Message::MessageCreatorBase *> Message::sFactory[256];
+
+const bool Message::sBuiltinMessagesRegistered = (Message::registerBuiltinMessages(), atexit(Message::clearFactory), true);
+
+void Message::registerBuiltinMessages()
+{
+    registerMessage<ResponseMessage>();
+    registerMessage<FinishMessage>();
+    registerMessage<QuitMessage>();
+}
+
+bool Message::registerCreator(uint8_t id, MessageCreatorBase *creator)
+{
+    MessageCreatorBase *expected = nullptr;
+    if (sFactory[id].compare_exchange_strong(expected, creator, std::memory_order_acq_rel))
+        return true;
+    delete creator;
+    return false;
+}
 
 void Message::prepare(int version, String &header, String &value) const
 {
@@ -29,7 +49,8 @@ void Message::prepare(int version, String &header, String &value) const
             mValue.clear();
         }
         {
-            Serializer s(mValue);
+            StringSerializer s(mValue);
+            s.setVersion(version);
             encode(s);
         }
         if (mFlags & Compressed) {
@@ -43,7 +64,43 @@ void Message::prepare(int version, String &header, String &value) const
     header = mHeader;
 }
 
-std::shared_ptr<Message> Message::create(int version, const char *data, int size, MessageError *errorPtr)
+std::shared_ptr<const String> Message::frame(int version) const
+{
+    enum
+    {
+        FrameHeaderSize = sizeof(uint32_t) + HeaderExtra
+    };
+    std::shared_ptr<String> ret = std::make_shared<String>();
+    if (mFlags & Compressed) {
+        String value;
+        {
+            StringSerializer s(value);
+            s.setVersion(version);
+            encode(s);
+        }
+        value = value.compress();
+        Serializer s(*ret);
+        encodeHeader(s, value.size(), version);
+        ret->append(value);
+    } else {
+        // encode straight after a placeholder and fill in the header once
+        // the size is known
+        ret->resize(FrameHeaderSize);
+        {
+            StringSerializer s(*ret);
+            s.setVersion(version);
+            encode(s);
+        }
+        String header;
+        Serializer s(header);
+        encodeHeader(s, ret->size() - FrameHeaderSize, version);
+        assert(header.size() == FrameHeaderSize);
+        memcpy(ret->data(), header.constData(), FrameHeaderSize);
+    }
+    return ret;
+}
+
+std::shared_ptr<Message> Message::create(int minimumVersion, int maximumVersion, const char *data, int size, MessageError *errorPtr, CompressionStream *stream)
 {
     auto sendError = [errorPtr](MessageErrorType type, const String &text)
     {
@@ -59,18 +116,18 @@ std::shared_ptr<Message> Message::create(int version, const char *data, int size
         return std::shared_ptr<Message>();
     }
     Deserializer ds(data, Serializer::sizeOf<int>() + Serializer::sizeOf<uint8_t>() + Serializer::sizeOf<uint8_t>());
-    int ver;
-    ds >> ver;
-    if (ver != version) {
+    int version;
+    ds >> version;
+    if (version < minimumVersion || version > maximumVersion) {
         String text;
-        size -= Serializer::sizeOf(ver);
+        size -= Serializer::sizeOf(version);
         if (size > 1) {
             uint8_t id;
             ds >> id;
-            text = String::format<1024>("Invalid message version. Got %d, expected %d id: %d", ver, version, id);
+            text = String::format<1024>("Invalid message version. Got %d, expected %d id: %d", version, maximumVersion, id);
             text += String::toHex(data, std::min(size, 1024));
         } else {
-            text = String::format<1024>("Invalid message version. Got %d, expected %d", ver, version);
+            text = String::format<1024>("Invalid message version. Got %d, expected %d", version, maximumVersion);
             text += String::toHex(data, std::min(size, 1024));
         }
         sendError(Message_VersionError, text);
@@ -87,35 +144,58 @@ std::shared_ptr<Message> Message::create(int version, const char *data, int size
     data += Serializer::sizeOf(flags);
     size -= Serializer::sizeOf(flags);
     String uncompressed;
-    if (flags & Compressed) {
+    if (flags & StreamCompressed) {
+        if (!stream || stream->mode() != CompressionStream::Uncompress || !stream->process(data, size, uncompressed)) {
+            sendError(Message_CreateError, String::format<128>("Can't uncompress stream compressed message id: %d, data: %d bytes", id, size));
+            return std::shared_ptr<Message>();
+        }
+        data = uncompressed.c_str();
+        size = uncompressed.size();
+    } else if (flags & Compressed) {
         uncompressed = String::uncompress(data, size);
         data         = uncompressed.c_str();
         size         = uncompressed.size();
     }
-    std::lock_guard<std::mutex> lock(sMutex);
-    if (!sFactory.contains(ResponseMessage::MessageId)) {
-        atexit(Message::cleanup);
-        sFactory[ResponseMessage::MessageId] = new MessageCreator<ResponseMessage>();
-        sFactory[FinishMessage::MessageId]   = new MessageCreator<FinishMessage>();
-        sFactory[QuitMessage::MessageId]     = new MessageCreator<QuitMessage>();
+    uint32_t expected = 0;
+    if (flags & Checksummed) {
+        if (size < static_cast<int>(sizeof(expected))) {
+            sendError(Message_LengthError, String::format<128>("Checksummed message too short id: %d, data: %d bytes", id, size));
+            return std::shared_ptr<Message>();
+        }
+        size -= sizeof(expected);
+        memcpy(&expected, data + size, sizeof(expected));
+        // decode() trusts lengths in the data, nothing damaged gets there
+        const uint32_t crc = Rct::crc32c(data, size);
+        if (crc != expected) {
+            sendError(Message_ChecksumError, String::format<128>("Checksum mismatch id: %d, data: %d bytes, got %08x, expected %08x", id, size, crc, expected));
+            return std::shared_ptr<Message>();
+        }
     }
-
-    MessageCreatorBase *base = sFactory.value(id);
+    MessageCreatorBase *base = sFactory[id].load(std::memory_order_acquire);
     if (!base) {
         sendError(Message_IdError, String::format<128>("Invalid message id %d, data: %d bytes", id, size));
         return std::shared_ptr<Message>();
     }
-    std::shared_ptr<Message> message(base->create(data, size));
+    Deserializer deserializer(data, size);
+    deserializer.setVersion(version);
+    std::shared_ptr<Message> message = base->create(deserializer);
     if (!message) {
         sendError(Message_CreateError, String::format<128>("Can't create message from data id: %d, data: %d bytes", id, size));
+    } else if (deserializer.hasError()) {
+        sendError(Message_CreateError, String::format<128>("Can't decode message id: %d, data: %d bytes", id, size));
+        message.reset();
     }
     return message;
 }
 
 void Message::cleanup()
 {
-    std::lock_guard<std::mutex> lock(sMutex);
-    for (Map<uint8_t, MessageCreatorBase *>::const_iterator it = sFactory.begin(); it != sFactory.end(); ++it)
-        delete it->second;
-    sFactory.clear();
+    clearFactory();
+    registerBuiltinMessages();
+}
+
+void Message::clearFactory()
+{
+    for (std::atomic<MessageCreatorBase *> &creator : sFactory)
+        delete creator.exchange(nullptr, std::memory_order_acq_rel);
 }
@@ -1,9 +1,13 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <rct/Serializer.h>
+#include <vector>
+
+class CompressionStream;
 
 class Message
 {
@@ -12,7 +16,8 @@ public:
     {
         ResponseId      = 1,
         FinishMessageId = 2,
-        QuitMessageId   = 3
+        QuitMessageId   = 3,
+        FileMessageId   = 4 // not registered by default, see FileMessage
     };
 
     Message(uint8_t id, uint8_t f = None)
@@ -37,7 +42,16 @@ public:
     {
         None         = 0x0,
         Compressed   = 0x1,
-        MessageCache = 0x2
+        MessageCache = 0x2,
+        // set in the header when the value was compressed with the
+        // connection's CompressionStream rather than on its own
+        StreamCompressed = 0x4,
+        // set in the header of frames that are consumed by Connection
+        // itself, the id is then one of Connection's control types
+        Control = 0x8,
+        // the (uncompressed) value is followed by the CRC32C of it, see
+        // Connection::setChecksums()
+        Checksummed = 0x10
     };
 
     uint8_t flags() const
@@ -53,9 +67,21 @@ public:
     virtual void encode(Serializer & /* serializer */) const = 0;
     virtual void decode(Deserializer & /* deserializer */)   = 0;
 
-    virtual size_t encodedSize() const
+    /**
+     * The size of what encode() writes. Connection::send() uses it to
+     * stream messages straight into the socket instead of encoding them
+     * into a temporary first. The default measures encode() with a
+     * Serializer::SizeBuffer; messages that know their size cheaper can
+     * use Serializer::encodedSize() on their members. Return String::npos
+     * to always encode into a temporary. @a version is the
+     * Serializer::version() encode() is called with, the connection's.
+     */
+    virtual size_t encodedSize(int version = Serializer::LatestVersion) const
     {
-        return String::npos;
+        Serializer serializer(std::unique_ptr<Serializer::Buffer>(new Serializer::SizeBuffer));
+        serializer.setVersion(version);
+        encode(serializer);
+        return serializer.pos();
     }
 
     enum MessageErrorType
@@ -64,7 +90,8 @@ public:
         Message_VersionError,
         Message_IdError,
         Message_LengthError,
-        Message_CreateError
+        Message_CreateError,
+        Message_ChecksumError
     };
 
     struct MessageError
@@ -73,19 +100,50 @@ public:
         String text;
     };
 
-    static std::shared_ptr<Message> create(int version, const char *data, int size, MessageError *error = nullptr);
+    static std::shared_ptr<Message> create(int version, const char *data, int size, MessageError *error = nullptr, CompressionStream *stream = nullptr)
+    {
+        return create(version, version, data, size, error, stream);
+    }
+
+    /**
+     * Accepts frames with a version from @a minimumVersion to @a
+     * maximumVersion. The message is decoded with Deserializer::version()
+     * set to the frame's, see RCT_FIELD_SINCE() and RCT_TAGGED_FIELDS().
+     * Checksummed frames are checked before they're decoded and fail with
+     * Message_ChecksumError if they don't match, frames that don't decode
+     * (see Deserializer::hasError()) with Message_CreateError.
+     */
+    static std::shared_ptr<Message> create(int minimumVersion, int maximumVersion, const char *data, int size, MessageError *error = nullptr,
+                                           CompressionStream *stream = nullptr);
 
     template <typename T>
     static void registerMessage()
     {
-        const uint8_t id = T::MessageId;
-        std::lock_guard<std::mutex> lock(sMutex);
-        MessageCreatorBase *&base = sFactory[id];
-        if (!base) {
-            base = new MessageCreator<T>();
-        }
+        if (!sFactory[T::MessageId].load(std::memory_order_acquire))
+            registerCreator(T::MessageId, new MessageCreator<T>());
+    }
+
+    /**
+     * Like registerMessage() but decoded messages of type T are allocated
+     * from a pool. The object and the shared_ptr control block share one
+     * allocation (std::allocate_shared) and when the last reference goes
+     * away the message is destroyed and its memory is kept for the next
+     * message of the same type, up to @a maxPooled blocks per thread.
+     */
+    template <typename T>
+    static void registerPooledMessage(size_t maxPooled = 64)
+    {
+        // the limit is only the first registration's to set
+        if (!sFactory[T::MessageId].load(std::memory_order_acquire) && registerCreator(T::MessageId, new PooledMessageCreator<T>()))
+            MessagePool<T>::sMaxPooled.store(maxPooled, std::memory_order_relaxed);
     }
 
+    /**
+     * Unregisters every message type except ResponseMessage, FinishMessage
+     * and QuitMessage, which stay available. create() looks creators up
+     * without a lock, so this must not be called while other threads might
+     * be decoding messages.
+     */
     static void cleanup();
 
 private:
@@ -96,34 +154,162 @@ private:
         {
         }
 
-        virtual Message *create(const char *data, int size) = 0;
+        virtual std::shared_ptr<Message> create(Deserializer &deserializer) = 0;
     };
 
     template <typename T>
     class MessageCreator : public MessageCreatorBase
     {
     public:
-        virtual Message *create(const char *data, int size) override
+        virtual std::shared_ptr<Message> create(Deserializer &deserializer) override
+        {
+            std::shared_ptr<T> t = std::make_shared<T>();
+            t->decode(deserializer);
+            return t;
+        }
+    };
+
+    // Per thread free lists of blocks big enough for one Tag message and its
+    // shared_ptr control block. Blocks released on another thread end up in
+    // that thread's list which is fine since they all come from operator new.
+    template <typename Tag>
+    class MessagePool
+    {
+    public:
+        static void *allocate(size_t size)
+        {
+            if (!sDestroyed) {
+                FreeList &list = freeList();
+                if (!list.blockSize)
+                    list.blockSize = size;
+                if (size == list.blockSize && !list.blocks.empty()) {
+                    void *ret = list.blocks.back();
+                    list.blocks.pop_back();
+                    return ret;
+                }
+            }
+            return ::operator new(size);
+        }
+
+        static void deallocate(void *block, size_t size)
+        {
+            if (!sDestroyed) {
+                FreeList &list = freeList();
+                if (size == list.blockSize && list.blocks.size() < sMaxPooled.load(std::memory_order_relaxed)) {
+                    list.blocks.push_back(block);
+                    return;
+                }
+            }
+            ::operator delete(block);
+        }
+
+        static inline std::atomic<size_t> sMaxPooled { 64 };
+
+    private:
+        struct FreeList
+        {
+            ~FreeList()
+            {
+                sDestroyed = true;
+                for (void *block : blocks)
+                    ::operator delete(block);
+            }
+
+            size_t blockSize = 0;
+            std::vector<void *> blocks;
+        };
+
+        static FreeList &freeList()
+        {
+            static thread_local FreeList list;
+            return list;
+        }
+
+        // messages released after the thread's list was destroyed go
+        // straight to operator delete
+        static inline thread_local bool sDestroyed = false;
+    };
+
+    template <typename T, typename Tag>
+    class MessagePoolAllocator
+    {
+    public:
+        typedef T value_type;
+
+        MessagePoolAllocator()
+        {
+        }
+
+        template <typename U>
+        MessagePoolAllocator(const MessagePoolAllocator<U, Tag> &)
+        {
+        }
+
+        T *allocate(size_t count)
+        {
+            return static_cast<T *>(MessagePool<Tag>::allocate(count * sizeof(T)));
+        }
+
+        void deallocate(T *ptr, size_t count)
+        {
+            MessagePool<Tag>::deallocate(ptr, count * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(const MessagePoolAllocator<U, Tag> &) const
+        {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const MessagePoolAllocator<U, Tag> &) const
+        {
+            return false;
+        }
+    };
+
+    template <typename T>
+    class PooledMessageCreator : public MessageCreatorBase
+    {
+    public:
+        virtual std::shared_ptr<Message> create(Deserializer &deserializer) override
         {
-            T *t = new T;
-            Deserializer deserializer(data, size);
+            std::shared_ptr<T> t = std::allocate_shared<T>(MessagePoolAllocator<T, T>());
             t->decode(deserializer);
             return t;
         }
     };
 
+    // takes ownership of creator, the first registration for an id wins,
+    // returns false and deletes @a creator if it wasn't this one
+    static bool registerCreator(uint8_t id, MessageCreatorBase *creator);
+    static void registerBuiltinMessages();
+    // deletes all creators, builtins included, at exit
+    static void clearFactory();
+
     void prepare(int version, String &header, String &value) const;
+    // the complete frame, length and header included, in a single buffer
+    std::shared_ptr<const String> frame(int version) const;
 
+protected:
+    // what a frame's length covers besides the value
     enum
     {
         HeaderExtra = Serializer::sizeOf<int>() + Serializer::sizeOf<uint8_t>() + Serializer::sizeOf<uint8_t>()
     };
 
+private:
+
     inline void encodeHeader(Serializer &serializer, uint32_t size, int version) const
+    {
+        encodeHeader(serializer, size, version, mFlags);
+    }
+
+    inline void encodeHeader(Serializer &serializer, uint32_t size, int version, uint8_t flags) const
     {
         size += HeaderExtra;
         serializer.write(&size, sizeof(size));
-        serializer << version << static_cast<uint8_t>(mMessageId) << mFlags;
+        serializer << version << static_cast<uint8_t>(mMessageId) << flags;
     }
     friend class Connection;
 
@@ -133,8 +319,36 @@ private:
     mutable String mHeader;
     mutable String mValue;
 
-    static Map<uint8_t, MessageCreatorBase *> sFactory;
-    static std::mutex sMutex;
+    // indexed by message id, published with release stores so decoding
+    // threads can look up creators without taking a lock
+    static std::atomic<MessageCreatorBase *> sFactory[256];
+    static const bool sBuiltinMessagesRegistered;
 };
 
+/**
+ * RCT_SERIALIZED_FIELDS() and RCT_TAGGED_FIELDS() for Message subclasses,
+ * encode(), decode() and encodedSize() are generated from the field list
+ * too.
+ */
+#define RCT_MESSAGE_FIELDS(Class, ...)          \
+    RCT_SERIALIZED_FIELDS(Class, __VA_ARGS__); \
+    RCT_MESSAGE_ENCODING(Class)
+#define RCT_MESSAGE_TAGGED_FIELDS(Class, ...) \
+    RCT_TAGGED_FIELDS(Class, __VA_ARGS__);    \
+    RCT_MESSAGE_ENCODING(Class)
+#define RCT_MESSAGE_ENCODING(Class)                                                    \
+    virtual size_t encodedSize(int version = Serializer::LatestVersion) const override \
+    {                                                                                  \
+        return EncodedSize<Class>::size(*this, version);                               \
+    }                                                                                  \
+    virtual void encode(Serializer &serializer) const override                         \
+    {                                                                                  \
+        serializer << *this;                                                           \
+    }                                                                                  \
+    virtual void decode(Deserializer &deserializer) override                           \
+    {                                                                                  \
+        deserializer >> *this;                                                         \
+    }                                                                                  \
+    static_assert(true, "")
+
 #endif // MESSAGE_H
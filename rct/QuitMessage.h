@@ -22,20 +22,7 @@ public:
         return mExitCode;
     }
 
-    virtual size_t encodedSize() const override
-    {
-        return sizeof(int);
-    }
-
-    void encode(Serializer &s) const override
-    {
-        s << mExitCode;
-    }
-
-    void decode(Deserializer &s) override
-    {
-        s >> mExitCode;
-    }
+    RCT_MESSAGE_FIELDS(QuitMessage, RCT_FIELD(mExitCode));
 
 private:
     int mExitCode;
@@ -42,6 +42,9 @@
 #endif
 
 #include <rct/Log.h>
+#ifdef HAVE_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
 
 struct timeval;
 
@@ -429,6 +432,80 @@ String colorize(const String &string, AnsiColor color, size_t from, size_t len)
     return ret;
 }
 
+static uint32_t crc32cTable[8][256];
+
+static bool initCrc32cTable()
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        crc32cTable[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int j = 1; j < 8; ++j)
+            crc32cTable[j][i] = (crc32cTable[j - 1][i] >> 8) ^ crc32cTable[0][crc32cTable[j - 1][i] & 0xff];
+    }
+    return true;
+}
+
+// slicing by 8, on the inverted crc
+static uint32_t crc32cSoftware(const unsigned char *data, size_t len, uint32_t crc)
+{
+    static const bool init = initCrc32cTable();
+    (void)init;
+    while (len && reinterpret_cast<uintptr_t>(data) & 7) {
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *data++) & 0xff];
+        --len;
+    }
+    while (len >= 8) {
+        uint32_t low, high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = crc32cTable[7][low & 0xff] ^ crc32cTable[6][(low >> 8) & 0xff] ^ crc32cTable[5][(low >> 16) & 0xff] ^ crc32cTable[4][low >> 24]
+            ^ crc32cTable[3][high & 0xff] ^ crc32cTable[2][(high >> 8) & 0xff] ^ crc32cTable[1][(high >> 16) & 0xff] ^ crc32cTable[0][high >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *data++) & 0xff];
+    return crc;
+}
+
+#ifdef HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2"))) static uint32_t crc32cHardware(const unsigned char *data, size_t len, uint32_t crc)
+{
+    while (len && reinterpret_cast<uintptr_t>(data) & 7) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --len;
+    }
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len--)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(const void *data, size_t len, uint32_t crc)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+#ifdef HAVE_CRC32C_SSE42
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware)
+        return ~crc32cHardware(bytes, len, ~crc);
+#endif
+    return ~crc32cSoftware(bytes, len, ~crc);
+}
+
 bool isIP(const String &addr, LookupMode mode)
 {
     union
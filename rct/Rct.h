@@ -142,6 +142,13 @@ String addrLookup(const String &addr, LookupMode mode = Auto, bool *ok = nullptr
 String nameLookup(const String &name, LookupMode mode = IPv4, bool *ok = nullptr);
 bool isIP(const String &addr, LookupMode mode = Auto);
 
+/**
+ * CRC32C (Castagnoli) of @a data, with SSE4.2 if the cpu has it. Pass a
+ * previous result as @a crc to continue it, the crc of several buffers is
+ * the crc of them one after another.
+ */
+uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+
 inline void jsonEscape(const String &str, std::function<void(const char *, size_t)> output)
 {
     output("\"", 1);
@@ -51,20 +51,8 @@ public:
         mData = data;
     }
 
-    virtual size_t encodedSize() const override
-    {
-        return mData.size() + sizeof(int);
-    }
-
-    virtual void encode(Serializer &serializer) const override
-    {
-        serializer << mData;
-    }
-
-    virtual void decode(Deserializer &deserializer) override
-    {
-        deserializer >> mData;
-    }
+    // the type isn't sent
+    RCT_MESSAGE_FIELDS(ResponseMessage, RCT_FIELD(mData));
 
 private:
     String mData;
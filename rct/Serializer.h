@@ -3,20 +3,27 @@
 
 // #define RCT_SERIALIZER_VERIFY_PRIMITIVE_SIZE
 #include <assert.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <rct/Hash.h>
 #include <rct/List.h>
 #include <rct/Log.h>
 #include <rct/Map.h>
+#include <rct/MemoryMappedFile.h>
 #include <rct/Path.h>
 #include <rct/Rct.h>
 #include <rct/Set.h>
 #include <rct/String.h>
+#include <rct/StringView.h>
 
 class Serializer
 {
@@ -57,6 +64,10 @@ public:
         assert(f);
     }
 
+    virtual ~Serializer()
+    {
+    }
+
     bool write(const String &string)
     {
         return write(string.c_str(), string.size());
@@ -67,14 +78,23 @@ public:
         assert(len > 0);
         if (mError)
             return false;
-        if (!mBuffer->write(data, len)) {
+        if (mChecksumming)
+            mChecksum = Rct::crc32c(data, len, mChecksum);
+        // the fast path for a BasicSerializer, everything else goes to
+        // overflow() right away
+        if (static_cast<size_t>(mLimit - mCursor) >= static_cast<size_t>(len)) {
+            memcpy(mCursor, data, len);
+            mCursor += len;
+            return true;
+        }
+        if (!overflow(data, len)) {
             mError = true;
             return false;
         }
         return true;
     }
 
-    int pos() const
+    virtual int pos() const
     {
         return mBuffer->pos();
     }
@@ -83,6 +103,117 @@ public:
     {
         return mError;
     }
+
+    /**
+     * Native writes integers with their full width. Compact writes every
+     * integer wider than a byte, string lengths and container sizes
+     * included, as an LEB128 varint, zigzag encoded first if it's signed.
+     * Both ends have to agree on it, EncodedSize always computes the
+     * native size.
+     */
+    enum Encoding
+    {
+        Native,
+        Compact
+    };
+
+    void setEncoding(Encoding encoding)
+    {
+        mEncoding = encoding;
+    }
+
+    Encoding encoding() const
+    {
+        return mEncoding;
+    }
+
+    bool isCompact() const
+    {
+        return mEncoding == Compact;
+    }
+
+    enum
+    {
+        LatestVersion = INT_MAX
+    };
+
+    /**
+     * Fields declared with RCT_FIELD_SINCE() are only written if their
+     * version is <= this. DataFile sets it to the file's version.
+     */
+    void setVersion(int version)
+    {
+        mVersion = version;
+    }
+
+    int version() const
+    {
+        return mVersion;
+    }
+
+    /**
+     * While on, checksum() is the CRC32C of everything written since it
+     * was turned on. It's computed as the data goes by, not in a pass of
+     * its own.
+     */
+    void setChecksumming(bool on)
+    {
+        if (on)
+            mChecksum = 0;
+        mChecksumming = on;
+    }
+
+    bool isChecksumming() const
+    {
+        return mChecksumming;
+    }
+
+    uint32_t checksum() const
+    {
+        return mChecksum;
+    }
+
+    bool writeVarint(uint64_t value)
+    {
+        unsigned char buf[10];
+        int len = 0;
+        while (value >= 0x80) {
+            buf[len++] = static_cast<unsigned char>(value) | 0x80;
+            value >>= 7;
+        }
+        buf[len++] = static_cast<unsigned char>(value);
+        return write(buf, len);
+    }
+
+    /**
+     * Counts the bytes that would be written without writing anything.
+     */
+    class SizeBuffer : public Buffer
+    {
+    public:
+        virtual bool write(const void *, int len) override
+        {
+            mSize += len;
+            return true;
+        }
+
+        virtual int pos() const override
+        {
+            return mSize;
+        }
+
+    private:
+        int mSize { 0 };
+    };
+
+    /**
+     * The exact number of bytes operator<< produces for @a args. Sizes of
+     * fixed size types, strings and containers of those are computed
+     * directly, anything else is measured by encoding it into a
+     * SizeBuffer. See EncodedSize.
+     */
+    template <typename... Args>
+    static size_t encodedSize(const Args &...args);
 #ifdef RCT_SERIALIZER_VERIFY_PRIMITIVE_SIZE
     template <typename T>
     bool encodeType()
@@ -110,6 +241,21 @@ public:
     }
 #endif
 
+protected:
+    Serializer()
+        : mError(false)
+    {
+    }
+
+    // called when [mCursor, mLimit) can't take @a len more bytes
+    virtual bool overflow(const void *data, int len)
+    {
+        return mBuffer->write(data, len);
+    }
+
+    char *mCursor { nullptr };
+    char *mLimit { nullptr };
+
 private:
     class StringBuffer : public Buffer
     {
@@ -164,14 +310,138 @@ private:
         FILE *mFile;
     };
 
+protected:
     bool mError;
+    Encoding mEncoding { Native };
+    int mVersion { LatestVersion };
+    bool mChecksumming { false };
+    uint32_t mChecksum { 0 };
+
+private:
     std::unique_ptr<Buffer> mBuffer;
 };
 
+/**
+ * A Serializer that writes straight into memory handed out by
+ * BufferPolicy, the virtual overflow() is only reached when that runs
+ * out. Works with every operator<<(Serializer &, ...). A BufferPolicy
+ * has:
+ *
+ * // write @a len bytes that didn't fit in [cursor, limit) and leave
+ * // the next window in cursor and limit, both are null at first
+ * bool write(char *&cursor, char *&limit, const void *data, size_t len);
+ * // bytes written so far
+ * int pos(const char *cursor) const;
+ * // hand on what's in the window, called by the destructor too
+ * bool flush(char *&cursor, char *&limit);
+ */
+template <typename BufferPolicy>
+class BasicSerializer : public Serializer
+{
+public:
+    template <typename... Args>
+    explicit BasicSerializer(Args &&...args)
+        : mPolicy(std::forward<Args>(args)...)
+    {
+    }
+
+    virtual ~BasicSerializer() override
+    {
+        flush();
+    }
+
+    bool flush()
+    {
+        if (!mPolicy.flush(mCursor, mLimit))
+            mError = true;
+        return !mError;
+    }
+
+    virtual int pos() const override
+    {
+        return mPolicy.pos(mCursor);
+    }
+
+    BufferPolicy &policy()
+    {
+        return mPolicy;
+    }
+
+protected:
+    virtual bool overflow(const void *data, int len) override
+    {
+        return mPolicy.write(mCursor, mLimit, data, len);
+    }
+
+private:
+    BufferPolicy mPolicy;
+};
+
+/**
+ * Appends to a String or std::string, growing it in chunks. The string
+ * has extra bytes at the end until flush() or the serializer is
+ * destroyed.
+ */
+class StringSerializerPolicy
+{
+public:
+    enum
+    {
+        MinChunkSize = 256
+    };
+
+    StringSerializerPolicy(std::string &out)
+        : mString(&out)
+    {
+    }
+
+    StringSerializerPolicy(String &out)
+        : mString(&out.ref())
+    {
+    }
+
+    bool write(char *&cursor, char *&limit, const void *data, size_t len)
+    {
+        const size_t used = cursor ? cursor - &(*mString)[0] : mString->size();
+        mString->resize(std::max(used + len, std::max<size_t>(used * 2, used + MinChunkSize)));
+        char *base = &(*mString)[0];
+        memcpy(base + used, data, len);
+        cursor = base + used + len;
+        limit  = base + mString->size();
+        return true;
+    }
+
+    int pos(const char *cursor) const
+    {
+        return cursor ? cursor - mString->data() : mString->size();
+    }
+
+    bool flush(char *&cursor, char *&limit)
+    {
+        if (cursor) {
+            mString->resize(cursor - &(*mString)[0]);
+            cursor = limit = nullptr;
+        }
+        return true;
+    }
+
+private:
+    std::string *mString;
+};
+
+typedef BasicSerializer<StringSerializerPolicy> StringSerializer;
+
 class Deserializer
 {
 public:
-    Deserializer(const char *data, int len, const char *key = "")
+    enum
+    {
+        // a good block size for Deserializer(FILE *) when reading many
+        // small values
+        ReadAheadBlockSize = 1024 * 1024
+    };
+
+    Deserializer(const char *data, size_t len, const char *key = "")
         : mData(data)
         , mLength(len)
         , mPos(0)
@@ -190,13 +460,45 @@ public:
     {
     }
 
-    Deserializer(FILE *file, const char *key = "")
+    /**
+     * Reads from the current position of @a file, only what's asked for
+     * by default or in blocks of @a readAhead bytes, see
+     * ReadAheadBlockSize. Blocks aren't bigger than what's left of the
+     * file. The file is put back where decoding stopped when this is
+     * destroyed. Its length is taken once, here.
+     */
+    Deserializer(FILE *file, const char *key = "", int readAhead = 0)
         : mData(nullptr)
         , mLength(0)
+        , mPos(0)
         , mFile(file)
         , mKey(key)
+        , mReadAhead(readAhead)
     {
         assert(file);
+        mFileOffset = ftello(file);
+        if (!fseeko(file, 0, SEEK_END)) {
+            mLength = ftello(file);
+            fseeko(file, mFileOffset, SEEK_SET);
+            if (mFileOffset >= 0 && mLength >= static_cast<size_t>(mFileOffset))
+                mReadAhead = std::min<size_t>(mReadAhead, mLength - mFileOffset);
+        }
+    }
+
+    // reads straight from the mapping, which has to outlive this
+    Deserializer(const MemoryMappedFile &file, const char *key = "")
+        : mData(file.filePtr<char>())
+        , mLength(file.size())
+        , mPos(0)
+        , mFile(nullptr)
+        , mKey(key)
+    {
+    }
+
+    ~Deserializer()
+    {
+        if (mFile && mBlockEnd)
+            fseeko(mFile, pos(), SEEK_SET);
     }
 
     int peek(char *target, int len)
@@ -206,11 +508,16 @@ public:
                 assert(mPos + len <= mLength);
                 memcpy(target, mData + mPos, len);
                 return len;
-            } else {
+            } else if (!mReadAhead) {
                 assert(mFile);
                 const int r = fread(target, sizeof(char), len, mFile);
                 fseek(mFile, -r, SEEK_CUR);
                 return r;
+            } else {
+                fill(std::min(len, mReadAhead));
+                const int r = std::min<size_t>(len, mBlockEnd - mBlockPos);
+                memcpy(target, mBlock.get() + mBlockPos, r);
+                return r;
             }
         }
         return 0;
@@ -222,37 +529,192 @@ public:
         if (dump) {
             printf("Reading %d bytes for %s\n", len, mKey);
         }
-        if (len) {
-            if (mData) {
-                if (mPos + len > mLength) {
-                    error() << "About to die" << mPos << len << mLength << '\n'
-                            << Rct::backtrace();
+        const int ret = readRaw(target, len);
+        if (mChecksumming && ret > 0)
+            mChecksum = Rct::crc32c(target, ret, mChecksum);
+        return ret;
+    }
+
+    // see Serializer::setChecksumming()
+    void setChecksumming(bool on)
+    {
+        if (on)
+            mChecksum = 0;
+        mChecksumming = on;
+    }
+
+    bool isChecksumming() const
+    {
+        return mChecksumming;
+    }
+
+    uint32_t checksum() const
+    {
+        return mChecksum;
+    }
+
+    bool atEnd() const
+    {
+        return pos() == mLength;
+    }
+
+    // set once view() or skip() couldn't do what was asked or a decoder
+    // found the data doesn't add up, what was decoded after that isn't to
+    // be trusted
+    bool hasError() const
+    {
+        return mError;
+    }
+
+    void setError()
+    {
+        mError = true;
+    }
+
+    size_t pos() const
+    {
+        return mFile ? mFileOffset + mBlockPos : mPos;
+    }
+
+    size_t length() const
+    {
+        return mLength;
+    }
+
+    // returns false and sets hasError() if there weren't @a len bytes
+    bool skip(size_t len)
+    {
+        if (mData) {
+            if (mPos + len > mLength) {
+                error() << "Can't skip" << len << "bytes at" << mPos << "of" << mLength << "for" << mKey;
+                mPos   = mLength;
+                mError = true;
+                return false;
+            }
+            if (mChecksumming)
+                mChecksum = Rct::crc32c(mData + mPos, len, mChecksum);
+            mPos += len;
+            return true;
+        }
+        assert(mFile);
+        if (mChecksumming) {
+            // the skipped bytes count too
+            char buf[4096];
+            while (len) {
+                const int chunk = std::min(len, sizeof(buf));
+                if (read(buf, chunk) != chunk) {
+                    mError = true;
+                    return false;
                 }
-                assert(mPos + len <= mLength);
-                memcpy(target, mData + mPos, len);
-                mPos += len;
-                return len;
-            } else {
-                assert(mFile);
-                return fread(target, sizeof(char), len, mFile);
+                len -= chunk;
             }
+            return true;
         }
-        return 0;
+        const size_t buffered = mBlockEnd - mBlockPos;
+        if (len <= buffered) {
+            mBlockPos += len;
+            return true;
+        }
+        mFileOffset += mBlockEnd + (len - buffered);
+        mBlockPos = mBlockEnd = 0;
+        fseeko(mFile, mFileOffset, SEEK_SET);
+        if (mFileOffset <= static_cast<off_t>(mLength))
+            return true;
+        mError = true;
+        return false;
     }
 
-    bool atEnd() const
+    /**
+     * Points at the next @a len bytes and skips them without copying.
+     * Only deserializers reading from memory can do that, one constructed
+     * from a String reads from its own copy so the pointer is only good
+     * while it's around. Returns nullptr and sets hasError() if there
+     * aren't @a len bytes left or this is reading from a FILE, the bytes
+     * are skipped either way so what follows still lines up.
+     */
+    const char *view(int len)
+    {
+        if (!mData) {
+            error() << "Can't view into a FILE for" << mKey;
+            if (len > 0)
+                skip(len);
+            mError = true;
+            return nullptr;
+        }
+        if (len < 0 || mPos + len > mLength) {
+            error() << "Can't view" << len << "bytes at" << mPos << "of" << mLength << "for" << mKey;
+            mPos   = mLength;
+            mError = true;
+            return nullptr;
+        }
+        const char *ret = mData + mPos;
+        mPos += len;
+        if (mChecksumming)
+            mChecksum = Rct::crc32c(ret, len, mChecksum);
+        return ret;
+    }
+
+    // see Serializer::Encoding
+    void setEncoding(Serializer::Encoding encoding)
+    {
+        mEncoding = encoding;
+    }
+
+    Serializer::Encoding encoding() const
+    {
+        return mEncoding;
+    }
+
+    bool isCompact() const
     {
-        return mPos == mLength;
+        return mEncoding == Serializer::Compact;
     }
 
-    int pos() const
+    // fields newer than this are left alone, see Serializer::setVersion()
+    void setVersion(int version)
     {
-        return mFile ? ftell(mFile) : mPos;
+        mVersion = version;
     }
 
-    int length() const
+    int version() const
     {
-        return mFile ? Rct::fileSize(mFile) : mLength;
+        return mVersion;
+    }
+
+    // @a value is 0 and hasError() is set if this returns false
+    bool readVarint(uint64_t &value)
+    {
+        value = 0;
+        unsigned char bytes[10];
+        for (int i = 0; i < 10; ++i) {
+            unsigned char &byte = bytes[i];
+            if (mData) {
+                if (mPos >= mLength) {
+                    error() << "Truncated varint at" << mPos << "for" << mKey;
+                    value  = 0;
+                    mError = true;
+                    return false;
+                }
+                byte = static_cast<unsigned char>(mData[mPos++]);
+            } else if (mBlockPos < mBlockEnd) {
+                byte = static_cast<unsigned char>(mBlock[mBlockPos++]);
+            } else if (readRaw(&byte, 1) != 1) {
+                error() << "Truncated varint at" << pos() << "for" << mKey;
+                value  = 0;
+                mError = true;
+                return false;
+            }
+            value |= static_cast<uint64_t>(byte & 0x7f) << (i * 7);
+            if (!(byte & 0x80)) {
+                if (mChecksumming)
+                    mChecksum = Rct::crc32c(bytes, i + 1, mChecksum);
+                return true;
+            }
+        }
+        error() << "Invalid varint at" << pos() << "for" << mKey;
+        value  = 0;
+        mError = true;
+        return false;
     }
 #ifdef RCT_SERIALIZER_VERIFY_PRIMITIVE_SIZE
     template <typename T>
@@ -276,25 +738,232 @@ public:
 #endif
 
 private:
+    int readRaw(void *target, int len)
+    {
+        if (len) {
+            if (mData) {
+                if (mPos + len > mLength) {
+                    error() << "About to die" << mPos << len << mLength << '\n'
+                            << Rct::backtrace();
+                }
+                assert(mPos + len <= mLength);
+                memcpy(target, mData + mPos, len);
+                mPos += len;
+                return len;
+            } else {
+                assert(mFile);
+                if (mBlockEnd - mBlockPos >= static_cast<size_t>(len)) {
+                    memcpy(target, mBlock.get() + mBlockPos, len);
+                    mBlockPos += len;
+                    return len;
+                }
+                return readFile(static_cast<char *>(target), len);
+            }
+        }
+        return 0;
+    }
+
+    // makes [mBlockPos, mBlockEnd) at least @a len bytes if the file has
+    // them, @a len can't be more than mReadAhead
+    bool fill(int len)
+    {
+        const size_t available = mBlockEnd - mBlockPos;
+        if (available >= static_cast<size_t>(len))
+            return true;
+        if (!mBlock)
+            mBlock.reset(new char[mReadAhead]);
+        memmove(mBlock.get(), mBlock.get() + mBlockPos, available);
+        mFileOffset += mBlockPos;
+        mBlockPos = 0;
+        mBlockEnd = available + fread(mBlock.get() + available, sizeof(char), mReadAhead - available, mFile);
+        return mBlockEnd >= static_cast<size_t>(len);
+    }
+
+    int readFile(char *target, int len)
+    {
+        // what's left of the block, then either straight into target or
+        // through a new block
+        const int buffered = mBlockEnd - mBlockPos;
+        if (buffered)
+            memcpy(target, mBlock.get() + mBlockPos, buffered);
+        mFileOffset += mBlockEnd;
+        mBlockPos = mBlockEnd = 0;
+        const int remaining = len - buffered;
+        if (remaining >= mReadAhead) {
+            const int r = fread(target + buffered, sizeof(char), remaining, mFile);
+            mFileOffset += r;
+            return buffered + r;
+        }
+        fill(remaining);
+        const int r = std::min<size_t>(remaining, mBlockEnd);
+        memcpy(target + buffered, mBlock.get(), r);
+        mBlockPos = r;
+        return buffered + r;
+    }
+
     String mString;
     const char *mData;
-    const int mLength;
-    int mPos;
+    size_t mLength;
+    size_t mPos;
     FILE *mFile;
     const char *mKey;
+    Serializer::Encoding mEncoding { Serializer::Native };
+    int mVersion { Serializer::LatestVersion };
+    bool mChecksumming { false };
+    uint32_t mChecksum { 0 };
+    bool mError { false };
+    // FILE reads, mFileOffset is where mBlock starts in the file
+    int mReadAhead { 0 };
+    std::unique_ptr<char[]> mBlock;
+    size_t mBlockPos { 0 }, mBlockEnd { 0 };
+    off_t mFileOffset { 0 };
+};
+
+/**
+ * Generates operator<<, operator>> and EncodedSize for a struct or class
+ * from a list of its members, in the order they are encoded:
+ *
+ * struct Record
+ * {
+ *     uint64_t id;
+ *     String path;
+ *     List<int> values;
+ *     int flags;
+ *
+ *     RCT_SERIALIZED_FIELDS(Record, RCT_FIELD(id), RCT_FIELD(path), RCT_FIELD(values),
+ *                           RCT_FIELD_SINCE(flags, 2));
+ * };
+ *
+ * A field with a version is skipped by Serializers and Deserializers whose
+ * version() is older, it keeps whatever value it had when decoding. Each
+ * field goes through the same operator<< and operator>> as it would on its
+ * own so lists of native types are still written in one go. Message
+ * subclasses can use RCT_MESSAGE_FIELDS() instead.
+ */
+template <typename Class, typename T>
+struct SerializedField
+{
+    T Class::*member;
+    int since;
+};
+
+template <typename Class, typename T>
+constexpr SerializedField<Class, T> serializedField(T Class::*member, int since = 0)
+{
+    return SerializedField<Class, T> { member, since };
+}
+
+#define RCT_SERIALIZED_FIELDS(Class, ...)    \
+    static constexpr auto serializedFields() \
+    {                                        \
+        typedef Class SerializedSelf;        \
+        return std::make_tuple(__VA_ARGS__); \
+    }                                        \
+    static_assert(true, "")
+#define RCT_FIELD(member) serializedField(&SerializedSelf::member)
+#define RCT_FIELD_SINCE(member, version) serializedField(&SerializedSelf::member, version)
+
+/**
+ * Like RCT_SERIALIZED_FIELDS() but every field is written with its id and
+ * encoded length, followed by a 0 id:
+ *
+ *     RCT_TAGGED_FIELDS(Record, RCT_TAGGED_FIELD(id, 1), RCT_TAGGED_FIELD(path, 2));
+ *
+ * Readers skip ids they don't know and leave fields that aren't there
+ * alone so fields can be added and removed without breaking anything
+ * written before or after. Ids have to be unique and not 0 and a field's
+ * id must never be reused for something else.
+ */
+template <typename Class, typename T>
+struct TaggedField
+{
+    T Class::*member;
+    uint32_t id;
+};
+
+template <typename Class, typename T>
+constexpr TaggedField<Class, T> taggedField(T Class::*member, uint32_t id)
+{
+    return TaggedField<Class, T> { member, id };
+}
+
+#define RCT_TAGGED_FIELDS(Class, ...)        \
+    static constexpr auto taggedFields()     \
+    {                                        \
+        typedef Class TaggedSelf;            \
+        return std::make_tuple(__VA_ARGS__); \
+    }                                        \
+    static_assert(true, "")
+#define RCT_TAGGED_FIELD(member, id) taggedField(&TaggedSelf::member, id)
+
+template <typename T, typename Enable = void>
+struct HasSerializedFields : public std::false_type
+{
+};
+
+template <typename T>
+struct HasSerializedFields<T, std::void_t<decltype(T::serializedFields())>> : public std::true_type
+{
+};
+
+template <typename T>
+inline void encodeFields(Serializer &s, const T &t)
+{
+    constexpr auto fields = T::serializedFields();
+    std::apply([&s, &t](const auto &...field) {
+        ((field.since <= s.version() ? static_cast<void>(s << t.*field.member) : static_cast<void>(0)), ...);
+    },
+               fields);
+}
+
+template <typename T>
+inline void decodeFields(Deserializer &s, T &t)
+{
+    constexpr auto fields = T::serializedFields();
+    std::apply([&s, &t](const auto &...field) {
+        ((field.since <= s.version() ? static_cast<void>(s >> t.*field.member) : static_cast<void>(0)), ...);
+    },
+               fields);
+}
+
+template <typename T, typename Enable = void>
+struct HasTaggedFields : public std::false_type
+{
 };
 
+template <typename T>
+struct HasTaggedFields<T, std::void_t<decltype(T::taggedFields())>> : public std::true_type
+{
+};
+
+template <typename T>
+void encodeTaggedFields(Serializer &s, const T &t);
+template <typename T>
+void decodeTaggedFields(Deserializer &s, T &t);
+
 template <typename T>
 Serializer &operator<<(Serializer &s, const T &t)
 {
-    YouNeedToDeclareLeftShiftOperators(t);
+    if constexpr (HasSerializedFields<T>::value) {
+        encodeFields(s, t);
+    } else if constexpr (HasTaggedFields<T>::value) {
+        encodeTaggedFields(s, t);
+    } else {
+        YouNeedToDeclareLeftShiftOperators(t);
+    }
     return s;
 }
 
 template <typename T>
 Deserializer &operator>>(Deserializer &s, T &t)
 {
-    YouNeedToDeclareRightShiftOperators(t);
+    if constexpr (HasSerializedFields<T>::value) {
+        decodeFields(s, t);
+    } else if constexpr (HasTaggedFields<T>::value) {
+        decodeTaggedFields(s, t);
+    } else {
+        YouNeedToDeclareRightShiftOperators(t);
+    }
     return s;
 }
 
@@ -304,6 +973,67 @@ struct FixedSize
     static constexpr size_t value = 0;
 };
 
+// integers Serializer::Compact writes as varints
+template <typename T>
+struct VarintEncodable
+{
+    static constexpr bool value = std::is_integral<T>::value && sizeof(T) > 1;
+};
+
+template <typename T>
+inline void encodeNative(Serializer &s, const T &t)
+{
+    if constexpr (VarintEncodable<T>::value) {
+        if (s.isCompact()) {
+            if constexpr (std::is_signed<T>::value) {
+                const int64_t value = t;
+                s.writeVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+            } else {
+                s.writeVarint(t);
+            }
+            return;
+        }
+    }
+    s.encodeType<T>();
+    union
+    {
+        T orig;
+        unsigned char buf[sizeof(T)];
+    };
+    orig = t;
+    s.write(buf, sizeof(buf));
+}
+
+template <typename T>
+inline void decodeNative(Deserializer &s, T &t)
+{
+    if constexpr (VarintEncodable<T>::value) {
+        if (s.isCompact()) {
+            uint64_t value;
+            if (!s.readVarint(value)) {
+                // see Deserializer::hasError()
+                t = T();
+                return;
+            }
+            if constexpr (std::is_signed<T>::value) {
+                t = static_cast<T>(static_cast<int64_t>((value >> 1) ^ (0 - (value & 1))));
+            } else {
+                t = static_cast<T>(value);
+            }
+            return;
+        }
+    }
+    if (s.decodeType<T>()) {
+        union
+        {
+            T value;
+            unsigned char buf[sizeof(T)];
+        };
+        s.read(buf, sizeof(buf));
+        t = value;
+    }
+}
+
 #define DECLARE_NATIVE_TYPE(T)                               \
     template <>                                              \
     struct FixedSize<T>                                      \
@@ -313,32 +1043,35 @@ struct FixedSize
     template <>                                              \
     inline Serializer &operator<<(Serializer &s, const T &t) \
     {                                                        \
-        s.encodeType<T>();                                   \
-        union                                                \
-        {                                                    \
-            T orig;                                          \
-            unsigned char buf[sizeof(T)];                    \
-        };                                                   \
-        orig = t;                                            \
-        s.write(buf, sizeof(buf));                           \
+        encodeNative(s, t);                                  \
         return s;                                            \
     }                                                        \
     template <>                                              \
     inline Deserializer &operator>>(Deserializer &s, T &t)   \
     {                                                        \
-        if (s.decodeType<T>()) {                             \
-            union                                            \
-            {                                                \
-                T value;                                     \
-                unsigned char buf[sizeof(T)];                \
-            };                                               \
-            s.read(buf, sizeof(buf));                        \
-            t = value;                                       \
-        }                                                    \
+        decodeNative(s, t);                                  \
         return s;                                            \
     }                                                        \
     struct macrohack
 
+/**
+ * Types whose encoding is just their bytes. Containers of these go out
+ * and come back in with one write()/read() instead of one per element,
+ * unless they're varints in Serializer::Compact.
+ * DECLARE_NATIVE_TYPE() a trivially copyable struct to get the same for
+ * it, its padding is written too.
+ */
+template <typename T>
+struct BulkSerializable
+{
+#ifdef RCT_SERIALIZER_VERIFY_PRIMITIVE_SIZE
+    static constexpr bool value = false;
+#else
+    // std::vector<bool> has no data()
+    static constexpr bool value = FixedSize<T>::value == sizeof(T) && std::is_trivially_copyable<T>::value && !std::is_same<T, bool>::value;
+#endif
+};
+
 DECLARE_NATIVE_TYPE(bool);
 DECLARE_NATIVE_TYPE(char);
 DECLARE_NATIVE_TYPE(signed char);
@@ -374,6 +1107,17 @@ inline Serializer &operator<<(Serializer &s, const Path &path)
     return s;
 }
 
+// the same as a String, either can decode the other
+template <>
+inline Serializer &operator<<(Serializer &s, const StringView &view)
+{
+    const uint32_t size = view.size();
+    s << size;
+    if (size)
+        s.write(view.data(), size);
+    return s;
+}
+
 template <>
 inline Serializer &operator<<(Serializer &s, const LogLevel &level)
 {
@@ -382,16 +1126,29 @@ inline Serializer &operator<<(Serializer &s, const LogLevel &level)
 }
 
 template <typename T>
-Serializer &operator<<(Serializer &s, const List<T> &list)
+Serializer &operator<<(Serializer &s, const std::vector<T> &list)
 {
     const uint32_t size = list.size();
     s << size;
+    if constexpr (BulkSerializable<T>::value) {
+        if (!VarintEncodable<T>::value || !s.isCompact()) {
+            if (size)
+                s.write(list.data(), size * sizeof(T));
+            return s;
+        }
+    }
     for (uint32_t i = 0; i < size; ++i) {
-        s << list.at(i);
+        s << list[i];
     }
     return s;
 }
 
+template <typename T>
+Serializer &operator<<(Serializer &s, const List<T> &list)
+{
+    return s << static_cast<const std::vector<T> &>(list);
+}
+
 template <typename Key, typename Value>
 Serializer &operator<<(Serializer &s, const Map<Key, Value> &map)
 {
@@ -512,7 +1269,7 @@ Deserializer &operator>>(Deserializer &s, Flags<T> &flags)
         s >> value;
         flags = Flags<T>::construct(value);
     } else {
-        int value;
+        uint32_t value;
         s >> value;
         flags = Flags<T>::construct(value);
     }
@@ -520,19 +1277,39 @@ Deserializer &operator>>(Deserializer &s, Flags<T> &flags)
 }
 
 template <typename T>
-Deserializer &operator>>(Deserializer &s, List<T> &list)
+Deserializer &operator>>(Deserializer &s, std::vector<T> &list)
 {
     uint32_t size;
     s >> size;
     if (size) {
         list.resize(size);
-        for (uint32_t i = 0; i < size; ++i) {
-            s >> list[i];
+        if constexpr (BulkSerializable<T>::value) {
+            if (!VarintEncodable<T>::value || !s.isCompact()) {
+                s.read(list.data(), size * sizeof(T));
+                return s;
+            }
+        }
+        if constexpr (std::is_same<T, bool>::value) {
+            for (uint32_t i = 0; i < size; ++i) {
+                bool value;
+                s >> value;
+                list[i] = value;
+            }
+        } else {
+            for (uint32_t i = 0; i < size; ++i) {
+                s >> list[i];
+            }
         }
     }
     return s;
 }
 
+template <typename T>
+Deserializer &operator>>(Deserializer &s, List<T> &list)
+{
+    return s >> static_cast<std::vector<T> &>(list);
+}
+
 template <typename T>
 Deserializer &operator>>(Deserializer &s, Set<T> &set)
 {
@@ -580,6 +1357,17 @@ inline Deserializer &operator>>(Deserializer &s, Path &path)
     return s;
 }
 
+// points into the Deserializer's data, see Deserializer::view()
+template <>
+inline Deserializer &operator>>(Deserializer &s, StringView &view)
+{
+    uint32_t size;
+    s >> size;
+    const char *data = size ? s.view(size) : nullptr;
+    view = data ? StringView(data, size) : StringView();
+    return s;
+}
+
 inline Deserializer &operator>>(Deserializer &s, LogLevel &level)
 {
     int l;
@@ -588,4 +1376,292 @@ inline Deserializer &operator>>(Deserializer &s, LogLevel &level)
     return s;
 }
 
+template <typename Fields>
+constexpr bool validTags(const Fields &fields)
+{
+    return std::apply([](const auto &...field) {
+        const uint32_t ids[] = { field.id... };
+        for (size_t i = 0; i < sizeof...(field); ++i) {
+            if (!ids[i])
+                return false;
+            for (size_t j = 0; j < i; ++j) {
+                if (ids[i] == ids[j])
+                    return false;
+            }
+        }
+        return true;
+    },
+                      fields);
+}
+
+template <typename T>
+size_t encodedFieldSize(const T &t, int version);
+
+template <typename T>
+void encodeTaggedFields(Serializer &s, const T &t)
+{
+    constexpr auto fields = T::taggedFields();
+    static_assert(validTags(fields), "Tagged field ids have to be unique and not 0");
+    std::apply([&s, &t](const auto &...field) {
+        auto encode = [&s](uint32_t id, const auto &value) {
+            s << id;
+            if (!s.isCompact()) {
+                s << static_cast<uint32_t>(encodedFieldSize(value, s.version())) << value;
+                return;
+            }
+            // varint sizes aren't known up front
+            String encoded;
+            {
+                StringSerializer serializer(encoded);
+                serializer.setEncoding(Serializer::Compact);
+                serializer.setVersion(s.version());
+                serializer << value;
+            }
+            s << static_cast<uint32_t>(encoded.size());
+            if (!encoded.empty())
+                s.write(encoded);
+        };
+        (encode(field.id, t.*field.member), ...);
+    },
+               fields);
+    s << static_cast<uint32_t>(0);
+}
+
+template <typename T>
+void decodeTaggedFields(Deserializer &s, T &t)
+{
+    constexpr auto fields = T::taggedFields();
+    while (true) {
+        uint32_t id, length;
+        if (s.atEnd()) {
+            error() << "Tagged fields end without a terminator at" << s.pos();
+            s.setError();
+            return;
+        }
+        s >> id;
+        if (!id)
+            break;
+        if (s.atEnd()) {
+            error() << "Tagged field" << id << "has no length at" << s.pos();
+            s.setError();
+            return;
+        }
+        s >> length;
+        const size_t start = s.pos();
+        if (length > s.length() - start) {
+            error() << "Tagged field" << id << "has" << length << "bytes, only" << (s.length() - start) << "left";
+            s.setError();
+            return;
+        }
+        std::apply([&s, &t, id](auto &...field) {
+            ((field.id == id ? static_cast<void>(s >> t.*field.member) : static_cast<void>(0)), ...);
+        },
+                   fields);
+        const size_t used = s.pos() - start;
+        if (used > length) {
+            error() << "Tagged field" << id << "used" << used << "bytes, it only has" << length;
+            s.setError();
+            return;
+        }
+        // unknown ids and whatever a newer writer added to a known one
+        if (!s.skip(length - used))
+            return;
+    }
+}
+
+// Specialize this for types whose encoded size can be computed cheaper
+// than by encoding them. @a version is the Serializer::version() it's
+// encoded with, it only matters for types with RCT_FIELD_SINCE() fields.
+template <typename T, typename Enable = void>
+struct EncodedSize
+{
+    static size_t size(const T &t, int version = Serializer::LatestVersion)
+    {
+        Serializer serializer(std::unique_ptr<Serializer::Buffer>(new Serializer::SizeBuffer));
+        serializer.setVersion(version);
+        serializer << t;
+        return serializer.pos();
+    }
+};
+
+template <typename T>
+struct EncodedSize<T, typename std::enable_if<FixedSize<T>::value != 0>::type>
+{
+    static constexpr size_t size(const T &, int = Serializer::LatestVersion)
+    {
+        return Serializer::sizeOf<T>();
+    }
+};
+
+template <typename T>
+inline size_t encodedFieldsSize(const T &t, int version)
+{
+    constexpr auto fields = T::serializedFields();
+    return std::apply([&t, version](const auto &...field) -> size_t {
+        return (size_t(0) + ... + (field.since <= version ? EncodedSize<typename std::decay<decltype(t.*field.member)>::type>::size(t.*field.member, version) : 0));
+    },
+                      fields);
+}
+
+template <typename T>
+struct EncodedSize<T, typename std::enable_if<HasSerializedFields<T>::value>::type>
+{
+    static size_t size(const T &t, int version = Serializer::LatestVersion)
+    {
+        return encodedFieldsSize(t, version);
+    }
+};
+
+template <typename T>
+inline size_t encodedTaggedFieldsSize(const T &t, int version)
+{
+    constexpr auto fields = T::taggedFields();
+    return std::apply([&t, version](const auto &...field) -> size_t {
+        return Serializer::sizeOf<uint32_t>() + (size_t(0) + ... + (Serializer::sizeOf<uint32_t>() * 2 + encodedFieldSize(t.*field.member, version)));
+    },
+                      fields);
+}
+
+template <typename T>
+struct EncodedSize<T, typename std::enable_if<HasTaggedFields<T>::value>::type>
+{
+    static size_t size(const T &t, int version = Serializer::LatestVersion)
+    {
+        return encodedTaggedFieldsSize(t, version);
+    }
+};
+
+template <typename T>
+inline size_t encodedFieldSize(const T &t, int version)
+{
+    return EncodedSize<T>::size(t, version);
+}
+
+template <>
+struct EncodedSize<String>
+{
+    static size_t size(const String &string, int = Serializer::LatestVersion)
+    {
+        return Serializer::sizeOf<uint32_t>() + string.size();
+    }
+};
+
+template <>
+struct EncodedSize<Path> : public EncodedSize<String>
+{
+};
+
+template <>
+struct EncodedSize<StringView>
+{
+    static size_t size(const StringView &view, int = Serializer::LatestVersion)
+    {
+        return Serializer::sizeOf<uint32_t>() + view.size();
+    }
+};
+
+template <typename T>
+struct EncodedSize<Flags<T>>
+{
+    static constexpr size_t size(const Flags<T> &, int = Serializer::LatestVersion)
+    {
+        return sizeof(T) == 8 ? Serializer::sizeOf<unsigned long long>() : Serializer::sizeOf<uint32_t>();
+    }
+};
+
+template <typename First, typename Second>
+struct EncodedSize<std::pair<First, Second>>
+{
+    static size_t size(const std::pair<First, Second> &pair, int version = Serializer::LatestVersion)
+    {
+        return EncodedSize<First>::size(pair.first, version) + EncodedSize<Second>::size(pair.second, version);
+    }
+};
+
+template <typename Container, typename Value = typename Container::value_type>
+inline size_t encodedContainerSize(const Container &container, int version)
+{
+    size_t ret = Serializer::sizeOf<uint32_t>();
+    if (FixedSize<Value>::value) {
+        ret += container.size() * Serializer::sizeOf<Value>();
+    } else {
+        for (const auto &value : container)
+            ret += EncodedSize<Value>::size(value, version);
+    }
+    return ret;
+}
+
+template <typename Container, typename Key = typename Container::key_type, typename Value = typename Container::mapped_type>
+inline size_t encodedMapSize(const Container &container, int version)
+{
+    size_t ret = Serializer::sizeOf<uint32_t>();
+    if (FixedSize<Key>::value && FixedSize<Value>::value) {
+        ret += container.size() * (Serializer::sizeOf<Key>() + Serializer::sizeOf<Value>());
+    } else {
+        for (const auto &pair : container)
+            ret += EncodedSize<Key>::size(pair.first, version) + EncodedSize<Value>::size(pair.second, version);
+    }
+    return ret;
+}
+
+template <typename T>
+struct EncodedSize<List<T>>
+{
+    static size_t size(const List<T> &list, int version = Serializer::LatestVersion)
+    {
+        return encodedContainerSize(list, version);
+    }
+};
+
+template <typename T>
+struct EncodedSize<std::vector<T>>
+{
+    static size_t size(const std::vector<T> &list, int version = Serializer::LatestVersion)
+    {
+        return encodedContainerSize(list, version);
+    }
+};
+
+template <typename T>
+struct EncodedSize<Set<T>>
+{
+    static size_t size(const Set<T> &set, int version = Serializer::LatestVersion)
+    {
+        return encodedContainerSize(set, version);
+    }
+};
+
+template <typename Key, typename Value>
+struct EncodedSize<Map<Key, Value>>
+{
+    static size_t size(const Map<Key, Value> &map, int version = Serializer::LatestVersion)
+    {
+        return encodedMapSize(map, version);
+    }
+};
+
+template <typename Key, typename Value>
+struct EncodedSize<MultiMap<Key, Value>>
+{
+    static size_t size(const MultiMap<Key, Value> &map, int version = Serializer::LatestVersion)
+    {
+        return encodedMapSize(map, version);
+    }
+};
+
+template <typename Key, typename Value>
+struct EncodedSize<Hash<Key, Value>>
+{
+    static size_t size(const Hash<Key, Value> &hash, int version = Serializer::LatestVersion)
+    {
+        return encodedMapSize(hash, version);
+    }
+};
+
+template <typename... Args>
+inline size_t Serializer::encodedSize(const Args &...args)
+{
+    return (static_cast<size_t>(0) + ... + EncodedSize<Args>::size(args));
+}
+
 #endif
@@ -1,5 +1,42 @@
 #ifdef _WIN32
-// todo: implement on windows
+// todo: implement on windows. Until then every segment is invalid so
+// callers like Connection fall back to not using shared memory.
+#include "SharedMemory.h"
+
+SharedMemory::SharedMemory(key_t, int, CreateMode)
+    : mShm(-1)
+    , mOwner(false)
+    , mAddr(nullptr)
+    , mKey(-1)
+    , mSize(0)
+{
+}
+
+SharedMemory::SharedMemory(const Path &, int, CreateMode)
+    : mShm(-1)
+    , mOwner(false)
+    , mAddr(nullptr)
+    , mKey(-1)
+    , mSize(0)
+{
+}
+
+SharedMemory::~SharedMemory()
+{
+}
+
+void *SharedMemory::attach(AttachFlag, void *)
+{
+    return nullptr;
+}
+
+void SharedMemory::detach()
+{
+}
+
+void SharedMemory::cleanup()
+{
+}
 #else
 #include "SharedMemory.h"
 
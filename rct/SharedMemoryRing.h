@@ -0,0 +1,180 @@
+#ifndef SharedMemoryRing_h
+#define SharedMemoryRing_h
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Single producer, single consumer byte ring living in memory shared by two
+ * processes, e.g. a SharedMemory segment. The ring doesn't know anything
+ * about wakeups, it only keeps two flags that tell the other side whether it
+ * needs to be woken up through some other channel.
+ */
+class SharedMemoryRing
+{
+public:
+    static size_t requiredSize(uint32_t capacity)
+    {
+        return sizeof(Header) + capacity;
+    }
+
+    /**
+     * @param capacity must be a power of two
+     * @param initialize true for the side that created the memory
+     */
+    SharedMemoryRing(void *address, uint32_t capacity, bool initialize)
+        : mHeader(static_cast<Header *>(address))
+        , mData(static_cast<unsigned char *>(address) + sizeof(Header))
+        , mCapacity(capacity)
+    {
+        assert(capacity && !(capacity & (capacity - 1)));
+        if (initialize) {
+            new (mHeader) Header;
+            mHeader->capacity = capacity;
+        }
+    }
+
+    bool isValid() const
+    {
+        return mHeader->capacity == mCapacity;
+    }
+
+    uint32_t capacity() const
+    {
+        return mCapacity;
+    }
+
+    /**
+     * Can be more than capacity() if the other side wrote nonsense into the
+     * header, see isCorrupted().
+     */
+    size_t available() const
+    {
+        return static_cast<uint32_t>(mHeader->head.load() - mHeader->tail.load(std::memory_order_relaxed));
+    }
+
+    // 0 if the ring is corrupted
+    size_t space() const
+    {
+        const uint32_t used = mHeader->head.load(std::memory_order_relaxed) - mHeader->tail.load();
+        return used > mCapacity ? 0 : mCapacity - used;
+    }
+
+    /**
+     * Head and tail are further apart than the ring is big. The header is
+     * shared with the other process so that's on them, neither read() nor
+     * write() touches the data anymore once it happened.
+     */
+    bool isCorrupted() const
+    {
+        return static_cast<uint32_t>(mHeader->head.load() - mHeader->tail.load()) > mCapacity;
+    }
+
+    /**
+     * Producer side. Writes as much of @a data as fits.
+     * @return number of bytes written, 0 if the ring is corrupted
+     */
+    size_t write(const void *data, size_t size)
+    {
+        const uint32_t head = mHeader->head.load(std::memory_order_relaxed);
+        size               = std::min(size, space());
+        if (!size)
+            return 0;
+        const uint32_t offset = head & (mCapacity - 1);
+        const size_t first    = std::min<size_t>(size, mCapacity - offset);
+        memcpy(mData + offset, data, first);
+        if (first < size)
+            memcpy(mData, static_cast<const unsigned char *>(data) + first, size - first);
+        mHeader->head.store(head + size);
+        return size;
+    }
+
+    /**
+     * Consumer side. Reads up to @a size bytes.
+     * @return number of bytes read, 0 if the ring is corrupted
+     */
+    size_t read(void *data, size_t size)
+    {
+        const uint32_t tail    = mHeader->tail.load(std::memory_order_relaxed);
+        const size_t available = static_cast<uint32_t>(mHeader->head.load() - tail);
+        if (available > mCapacity)
+            return 0;
+        size = std::min(size, available);
+        if (!size)
+            return 0;
+        const uint32_t offset = tail & (mCapacity - 1);
+        const size_t first    = std::min<size_t>(size, mCapacity - offset);
+        memcpy(data, mData + offset, first);
+        if (first < size)
+            memcpy(static_cast<unsigned char *>(data) + first, mData, size - first);
+        mHeader->tail.store(tail + size);
+        return size;
+    }
+
+    /**
+     * Called by the consumer when it has drained the ring and goes to
+     * sleep. Returns false if data arrived in the meantime, in which case
+     * the consumer should keep reading.
+     */
+    bool setReaderWaiting()
+    {
+        mHeader->readerWaiting.store(1);
+        if (available()) {
+            mHeader->readerWaiting.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Called by the producer after writing. Returns true if the consumer
+     * went to sleep and needs to be woken up.
+     */
+    bool takeReaderWaiting()
+    {
+        return mHeader->readerWaiting.exchange(0);
+    }
+
+    /**
+     * Called by the producer when the ring is full. Returns false if space
+     * became available in the meantime.
+     */
+    bool setWriterWaiting()
+    {
+        mHeader->writerWaiting.store(1);
+        if (space()) {
+            mHeader->writerWaiting.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    bool takeWriterWaiting()
+    {
+        return mHeader->writerWaiting.exchange(0);
+    }
+
+private:
+    struct Header
+    {
+        // head and tail are on separate cache lines so the producer and
+        // consumer don't keep stealing the line from each other
+        alignas(64) std::atomic<uint32_t> head { 0 };
+        alignas(64) std::atomic<uint32_t> tail { 0 };
+        alignas(64) std::atomic<uint32_t> readerWaiting { 1 };
+        std::atomic<uint32_t> writerWaiting { 0 };
+        uint32_t capacity { 0 };
+    };
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared memory rings need lock free atomics");
+
+    Header *mHeader;
+    unsigned char *mData;
+    const uint32_t mCapacity;
+};
+
+#endif
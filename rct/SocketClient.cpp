@@ -8,17 +8,24 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #endif
+#include <algorithm>
 #include <assert.h>
 #include <cstdint>
 #include <errno.h>
 #include <fcntl.h>
 #include <map>
+#ifndef _WIN32
+#include <poll.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "DnsResolver.h"
 #include "EventLoop.h"
 #include "Rct.h"
 #include "rct/Buffer.h"
@@ -27,6 +34,13 @@
 #include "rct/String.h"
 #include "rct/rct-config.h"
 
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
 #ifdef NDEBUG
 struct Null
 {
@@ -51,6 +65,7 @@ SocketClient::SocketClient(unsigned int mode)
     , mBlocking(mode & Blocking)
     , mWriteOffset(0)
 {
+    mReadBuffer.setPooled(true);
 }
 
 SocketClient::SocketClient(int f, unsigned int mode)
@@ -60,12 +75,14 @@ SocketClient::SocketClient(int f, unsigned int mode)
     , mWriteOffset(0)
 {
     assert(mFd >= 0);
+    mReadBuffer.setPooled(true);
 #ifdef HAVE_NOSIGPIPE
     int flags = 1;
     ::setsockopt(mFd, SOL_SOCKET, SO_NOSIGPIPE, (void *)&flags, sizeof(int));
 #endif
 #ifdef HAVE_CLOEXEC
-    setFlags(mFd, FD_CLOEXEC, F_GETFD, F_SETFD);
+    if (!(mode & Accepted))
+        setFlags(mFd, FD_CLOEXEC, F_GETFD, F_SETFD);
 #endif
     mBlocking = (mode & Blocking);
 
@@ -73,7 +90,7 @@ SocketClient::SocketClient(int f, unsigned int mode)
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
             loop->registerSocket(mFd, EventLoop::SocketRead, std::bind(&SocketClient::socketCallback, this, std::placeholders::_1, std::placeholders::_2));
 #ifndef _WIN32
-            if (!setFlags(mFd, O_NONBLOCK, F_GETFL, F_SETFL)) {
+            if (!(mode & Accepted) && !setFlags(mFd, O_NONBLOCK, F_GETFL, F_SETFL)) {
                 mSignalError(shared_from_this(), InitializeError);
                 close();
                 return;
@@ -90,14 +107,22 @@ SocketClient::~SocketClient()
 
 void SocketClient::close()
 {
-    if (mFd == -1)
+    if (mFd == -1) {
+        // drops the result of a pending lookup
+        mSocketState = Disconnected;
         return;
+    }
     mSocketState = Disconnected;
     if (!mBlocking) {
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop())
             loop->unregisterSocket(mFd);
     }
-    ::close(mFd);
+    if (mZeroCopyPending.empty()) {
+        ::close(mFd);
+    } else {
+        drainZeroCopy();
+    }
+    mZeroCopySequence = 0;
     mSocketPort = 0;
     mAddress.clear();
     mFd = -1;
@@ -220,10 +245,76 @@ Resolver::~Resolver()
     }
 }
 
+struct SocketClient::Destination
+{
+    sockaddr_storage storage;
+    socklen_t size;
+
+    const sockaddr *addr() const
+    {
+        return reinterpret_cast<const sockaddr *>(&storage);
+    }
+};
+
+const SocketClient::Destination *SocketClient::destination(const String &host, uint16_t port)
+{
+    enum
+    {
+        MaxDestinations = 64
+    };
+
+    String key = host;
+    key += ':';
+    key += String::number(port);
+    auto it = mDestinations.find(key);
+    if (it != mDestinations.end())
+        return it->second.get();
+
+    Resolver resolver(host, port, shared_from_this());
+    if (!resolver.addr)
+        return nullptr;
+    if (mDestinations.size() >= MaxDestinations)
+        mDestinations.clear();
+    std::shared_ptr<Destination> dest = std::make_shared<Destination>();
+    memcpy(&dest->storage, resolver.addr, resolver.size);
+    dest->size = resolver.size;
+    mDestinations[key] = dest;
+    return dest.get();
+}
+
 bool SocketClient::connect(const String &host, uint16_t port)
+{
+    List<String> addresses;
+    if (DnsResolver::cached(host, &addresses)) {
+        if (addresses.empty()) {
+            mSignalError(shared_from_this(), DnsError);
+            return false;
+        }
+        return connectAddress(host, addresses.first(), port);
+    }
+    if (mBlocking || !EventLoop::eventLoop())
+        return connectAddress(host, host, port);
+
+    std::weak_ptr<SocketClient> weak = shared_from_this();
+    mSocketState = Resolving;
+    DnsResolver::resolve(host, [weak, port](const String &name, const List<String> &result) {
+        std::shared_ptr<SocketClient> socket = weak.lock();
+        if (!socket || socket->mSocketState != Resolving)
+            return; // closed or gone while resolving
+        socket->mSocketState = Disconnected;
+        if (result.empty()) {
+            socket->mSignalError(socket, DnsError);
+            return;
+        }
+        socket->connectAddress(name, result.first(), port);
+    });
+    return true;
+}
+
+bool SocketClient::connectAddress(const String &host, const String &address, uint16_t port)
 {
     std::shared_ptr<SocketClient> tcpSocket = shared_from_this();
-    Resolver resolver(host, port, tcpSocket);
+    Resolver resolver(address, port, tcpSocket);
     if (!resolver.addr)
         return false;
 
@@ -242,6 +333,9 @@ bool SocketClient::connect(const String &host, uint16_t port)
         mSocketState = Connected;
 
         signalConnected(tcpSocket);
+        // written while resolving
+        if (mFd != -1 && pendingWrite())
+            write(nullptr, 0);
     } else {
         if (errno != EINPROGRESS) {
             // bad
@@ -250,7 +344,7 @@ bool SocketClient::connect(const String &host, uint16_t port)
             return false;
         }
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-            loop->updateSocket(mFd, EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot);
+            loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
             mWriteWait = true;
         }
         mSocketState = Connecting;
@@ -294,7 +388,7 @@ bool SocketClient::connect(const String &path)
             return false;
         }
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-            loop->updateSocket(mFd, EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot);
+            loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
             mWriteWait = true;
         }
         mSocketState = Connecting;
@@ -454,9 +548,9 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
     assert((!size) == (!data));
     std::shared_ptr<SocketClient> socketPtr = shared_from_this();
 
-    Resolver resolver;
-    if (port != 0)
-        resolver.resolve(host, port, socketPtr);
+    const Destination *dest = nullptr;
+    if (port != 0 && !(dest = destination(host, port)))
+        return false;
 
     int e;
     unsigned int total = 0;
@@ -467,15 +561,16 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
     const int sendFlags = 0;
 #endif
 
-    if (!mWriteWait) {
+    // nothing to write to until the host name is resolved
+    if (!mWriteWait && mSocketState != Resolving) {
         if (!mWriteBuffer.empty()) {
             // assert(mWriteOffset < mWriteBuffer.size());
             const size_t writeBufferSize = mWriteBuffer.size() - mWriteOffset;
             while (total < writeBufferSize) {
                 assert(mWriteBuffer.size() > total);
-                if (resolver.addr) {
+                if (dest) {
                     eintrwrap(e,
-                              ::sendto(mFd, reinterpret_cast<const char *>(mWriteBuffer.data()) + total + mWriteOffset, writeBufferSize - total, sendFlags, resolver.addr, resolver.size));
+                              ::sendto(mFd, reinterpret_cast<const char *>(mWriteBuffer.data()) + total + mWriteOffset, writeBufferSize - total, sendFlags, dest->addr(), dest->size));
                 } else {
                     eintrwrap(e, ::write(mFd, mWriteBuffer.data() + total + mWriteOffset, writeBufferSize - total));
                 }
@@ -484,7 +579,7 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
                     if (errno == EAGAIN || errno == EWOULDBLOCK) {
                         assert(!mWriteWait);
                         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-                            loop->updateSocket(mFd, EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot);
+                            loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
                             mWriteWait = true;
                         }
                         break;
@@ -509,18 +604,22 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
             }
         }
 
+        if (!mWriteWait && mWriteBuffer.empty() && !mWriteQueue.empty() && !flushWriteQueue())
+            return false;
+
         if (mFd == -1 || !data) {
+            updateWriteBlocked();
             return mFd != -1;
         }
         total = 0;
 
         assert(data != nullptr && size > 0);
 
-        if (mWriteBuffer.empty()) {
+        if (mWriteBuffer.empty() && mWriteQueue.empty()) {
             for (;;) {
                 assert(size > total);
-                if (resolver.addr) {
-                    eintrwrap(e, ::sendto(mFd, data + total, size - total, sendFlags, resolver.addr, resolver.size));
+                if (dest) {
+                    eintrwrap(e, ::sendto(mFd, data + total, size - total, sendFlags, dest->addr(), dest->size));
                 } else {
                     eintrwrap(e, ::write(mFd, data + total, size - total));
                 }
@@ -529,7 +628,7 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
                     if (errno == EAGAIN || errno == EWOULDBLOCK) {
                         assert(!mWriteWait);
                         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-                            loop->updateSocket(mFd, EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot);
+                            loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
                             mWriteWait = true;
                         }
                         break;
@@ -545,6 +644,7 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
                 assert(total <= size);
                 if (total == size) {
                     // we're done
+                    updateWriteBlocked();
                     return true;
                 }
             }
@@ -554,22 +654,500 @@ bool SocketClient::writeTo(const String &host, uint16_t port, const unsigned cha
     if (total < size) {
         // store the rest
         const unsigned int rem = size - total;
-        if (mMaxWriteBufferSize && mWriteBuffer.size() + rem > mMaxWriteBufferSize) {
+        if (mMaxWriteBufferSize && pendingWrite() + rem > mMaxWriteBufferSize) {
             close();
             return false;
         }
-        mWriteBuffer.reserve(mWriteBuffer.size() + rem);
-        memcpy(mWriteBuffer.end(), data + total, rem);
-        mWriteBuffer.resize(mWriteBuffer.size() + rem);
+        if (!mWriteQueue.empty()) {
+            // keep the order, this has to go out after the shared buffers
+            mWriteQueue.push_back({ std::make_shared<const String>(reinterpret_cast<const char *>(data + total), rem), nullptr, rem });
+            mWriteQueueSize += rem;
+        } else {
+            mWriteBuffer.reserve(mWriteBuffer.size() + rem);
+            memcpy(mWriteBuffer.end(), data + total, rem);
+            mWriteBuffer.resize(mWriteBuffer.size() + rem);
+        }
     }
+    updateWriteBlocked();
     return true;
 }
 
+void SocketClient::updateWriteBlocked()
+{
+    if (mWriteBlocked) {
+        if (!mHighWatermark || pendingWrite() <= mLowWatermark || mFd == -1) {
+            mWriteBlocked = false;
+            mSignalWriteUnblocked(shared_from_this());
+        }
+    } else if (mHighWatermark && pendingWrite() >= mHighWatermark && mFd != -1) {
+        mWriteBlocked = true;
+        mSignalWriteBlocked(shared_from_this());
+    }
+}
+
 bool SocketClient::write(const void *data, unsigned int size)
 {
     return writeTo(String(), 0, reinterpret_cast<const unsigned char *>(data), size);
 }
 
+bool SocketClient::write(const std::shared_ptr<const String> &data)
+{
+    if (!data || data->empty())
+        return isConnected();
+    if (mSocketMode & Udp)
+        return write(data->constData(), data->size());
+    if (mMaxWriteBufferSize && pendingWrite() + data->size() > mMaxWriteBufferSize) {
+        close();
+        return false;
+    }
+    mWriteQueue.push_back({ data, nullptr, data->size() });
+    mWriteQueueSize += data->size();
+    return write(nullptr, 0);
+}
+
+#ifndef _WIN32
+struct SocketClient::QueuedFile
+{
+    enum Method
+    {
+        SendFile,
+        Splice,
+        Copy
+    };
+
+    QueuedFile(int f, uint64_t o, Method m)
+        : fd(f)
+        , offset(o)
+        , method(m)
+    {
+    }
+
+    ~QueuedFile()
+    {
+        if (waitingForInput) {
+            if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop())
+                loop->unregisterSocket(fd);
+        }
+        ::close(fd);
+    }
+
+    // a pipe that's empty for now, send() failed with EAGAIN because of it
+    // rather than the socket
+    bool inputPending() const
+    {
+        if (method != Splice)
+            return false;
+        pollfd p = { fd, POLLIN, 0 };
+        int e;
+        eintrwrap(e, ::poll(&p, 1, 0));
+        return !e;
+    }
+
+    // returns what was written, 0 if the file ended early
+    ssize_t send(int socket, size_t pos, size_t count)
+    {
+        // what sendfile() transfers at most in one go anyway
+        count = std::min<size_t>(count, 0x7ffff000);
+        ssize_t e;
+#ifdef HAVE_SENDFILE
+        if (method == SendFile) {
+            off_t off = offset + pos;
+            eintrwrap(e, ::sendfile(socket, fd, &off, count));
+            if (e != -1 || (errno != EINVAL && errno != ENOSYS))
+                return e;
+            method = Copy;
+        }
+#endif
+#ifdef HAVE_SPLICE
+        if (method == Splice) {
+            // pipes have no offset, what's been read is gone. EAGAIN is
+            // either side, an empty pipe or a full socket
+            eintrwrap(e, ::splice(fd, nullptr, socket, nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+            return e;
+        }
+#endif
+        char buf[16384];
+        eintrwrap(e, ::pread(fd, buf, std::min(count, sizeof(buf)), offset + pos));
+        if (e <= 0)
+            return e;
+        const ssize_t read = e;
+#ifdef HAVE_NOSIGNAL
+        eintrwrap(e, ::send(socket, buf, read, MSG_NOSIGNAL));
+#else
+        eintrwrap(e, ::send(socket, buf, read, 0));
+#endif
+        return e;
+    }
+
+    int fd;
+    const uint64_t offset;
+    Method method;
+    // registered with the EventLoop until the pipe has something
+    bool waitingForInput { false };
+};
+
+bool SocketClient::sendFile(const Path &path, uint64_t offset, int64_t length)
+{
+    int fd;
+    eintrwrap(fd, ::open(path.constData(), O_RDONLY | O_CLOEXEC));
+    if (fd == -1)
+        return false;
+    const bool ret = sendFile(fd, offset, length);
+    ::close(fd);
+    return ret;
+}
+
+bool SocketClient::sendFile(int fd, uint64_t offset, int64_t length)
+{
+    if (!isConnected() || mSocketMode & Udp)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st))
+        return false;
+    QueuedFile::Method method = QueuedFile::SendFile;
+    if (S_ISFIFO(st.st_mode)) {
+#ifdef HAVE_SPLICE
+        method = QueuedFile::Splice;
+#else
+        return false;
+#endif
+        if (length < 0 || offset)
+            return false;
+    } else if (!S_ISREG(st.st_mode)) {
+        return false;
+    } else if (length < 0) {
+        if (static_cast<uint64_t>(st.st_size) < offset)
+            return false;
+        length = st.st_size - offset;
+    }
+    if (!length)
+        return true;
+    if (mMaxWriteBufferSize && pendingWrite() + static_cast<uint64_t>(length) > mMaxWriteBufferSize) {
+        close();
+        return false;
+    }
+
+    const int dup = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup == -1)
+        return false;
+    mWriteQueue.push_back({ nullptr, std::make_shared<QueuedFile>(dup, offset, method), static_cast<size_t>(length) });
+    mWriteQueueSize += length;
+    return write(nullptr, 0);
+}
+#endif
+
+bool SocketClient::writeTo(const String &host, uint16_t port, const List<String> &datagrams)
+{
+    assert(mSocketMode & Udp);
+    const Destination *dest = destination(host, port);
+    if (!dest)
+        return false;
+
+    size_t sent = 0;
+#ifdef HAVE_SENDMMSG
+    if (!mWriteWait && mWriteBuffer.empty()) {
+        std::shared_ptr<SocketClient> socketPtr = shared_from_this();
+#ifdef HAVE_NOSIGNAL
+        const int sendFlags = MSG_NOSIGNAL;
+#else
+        const int sendFlags = 0;
+#endif
+        enum { MaxBatch = 64 };
+        mmsghdr headers[MaxBatch];
+        iovec vectors[MaxBatch];
+        while (sent < datagrams.size()) {
+            const unsigned int count = std::min<size_t>(MaxBatch, datagrams.size() - sent);
+            memset(headers, 0, count * sizeof(mmsghdr));
+            for (unsigned int i = 0; i < count; ++i) {
+                const String &datagram          = datagrams.at(sent + i);
+                vectors[i].iov_base             = const_cast<char *>(datagram.constData());
+                vectors[i].iov_len              = datagram.size();
+                headers[i].msg_hdr.msg_name    = const_cast<sockaddr *>(dest->addr());
+                headers[i].msg_hdr.msg_namelen = dest->size;
+                headers[i].msg_hdr.msg_iov     = vectors + i;
+                headers[i].msg_hdr.msg_iovlen  = 1;
+            }
+            int e;
+            eintrwrap(e, ::sendmmsg(mFd, headers, count, sendFlags));
+            DEBUG() << "SENT(3)" << count << "DATAGRAMS" << e << errno;
+            if (e == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                // bad
+                mSignalError(socketPtr, WriteError);
+                close();
+                return false;
+            }
+            int bytes = 0;
+            for (int i = 0; i < e; ++i)
+                bytes += headers[i].msg_len;
+            mSignalBytesWritten(socketPtr, bytes);
+            sent += e;
+        }
+    }
+#endif
+    // whatever didn't go out in a batch takes the regular path
+    for (; sent < datagrams.size(); ++sent) {
+        const String &datagram = datagrams.at(sent);
+        if (!datagram.empty() && !writeTo(host, port, datagram))
+            return false;
+    }
+    return true;
+}
+
+bool SocketClient::flushWriteQueue()
+{
+    std::shared_ptr<SocketClient> socketPtr = shared_from_this();
+    while (!mWriteQueue.empty()) {
+        ssize_t e;
+#ifdef _WIN32
+        const String &front = *mWriteQueue.front().data;
+        eintrwrap(e, ::send(mFd, front.constData() + mWriteQueueOffset, front.size() - mWriteQueueOffset, 0));
+#else
+        QueuedWrite &front = mWriteQueue.front();
+        if (front.file) {
+            if (front.file->waitingForInput)
+                return true;
+            e = front.file->send(mFd, mWriteQueueOffset, front.size - mWriteQueueOffset);
+            if (!e) {
+                // the frame around it can't be completed anymore
+                errno = ENODATA;
+                e     = -1;
+            } else if (e == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && front.file->inputPending()) {
+                return waitForInput(front.file);
+            }
+        } else if (!sendZeroCopy(front, &e)) {
+            enum { MaxVectors = 64 };
+            iovec vectors[MaxVectors];
+            int count = 0;
+            for (auto it = mWriteQueue.begin(); it != mWriteQueue.end() && it->data && count < MaxVectors; ++it, ++count) {
+                const size_t offset    = count ? 0 : mWriteQueueOffset;
+                vectors[count].iov_base = const_cast<char *>(it->data->constData() + offset);
+                vectors[count].iov_len  = it->size - offset;
+            }
+            eintrwrap(e, ::writev(mFd, vectors, count));
+        }
+#endif
+        DEBUG() << "SENT(3)" << (mWriteQueueSize - mWriteQueueOffset) << "BYTES" << e << errno;
+        if (e == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                assert(!mWriteWait);
+                if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
+                    loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
+                    mWriteWait = true;
+                }
+                return true;
+            }
+            mSignalError(socketPtr, WriteError);
+            close();
+            return false;
+        }
+        // release the buffers that made it out completely
+        size_t written = e;
+        while (written) {
+            const size_t remaining = mWriteQueue.front().size - mWriteQueueOffset;
+            if (written < remaining) {
+                mWriteQueueOffset += written;
+                break;
+            }
+            written -= remaining;
+            mWriteQueueSize -= mWriteQueue.front().size;
+            mWriteQueueOffset = 0;
+            mWriteQueue.pop_front();
+        }
+        mSignalBytesWritten(socketPtr, e);
+        if (mFd == -1)
+            return false;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+// the socket could take more, the pipe in front of the write queue is
+// empty. The queue continues once the pipe is readable or hung up, the
+// latter fails the write with ENODATA like a file that ended early.
+bool SocketClient::waitForInput(const std::shared_ptr<QueuedFile> &file)
+{
+    std::shared_ptr<EventLoop> loop = EventLoop::eventLoop();
+    if (!loop) {
+        mSignalError(shared_from_this(), WriteError);
+        close();
+        return false;
+    }
+    std::weak_ptr<SocketClient> weak = shared_from_this();
+    std::weak_ptr<QueuedFile> weakFile = file;
+    file->waitingForInput = true;
+    loop->registerSocket(file->fd, EventLoop::SocketRead | EventLoop::SocketOneShot, [weak, weakFile](int fd, unsigned int) {
+        if (std::shared_ptr<EventLoop> eventLoop = EventLoop::eventLoop())
+            eventLoop->unregisterSocket(fd);
+        std::shared_ptr<QueuedFile> queued = weakFile.lock();
+        if (!queued)
+            return;
+        queued->waitingForInput = false;
+        if (std::shared_ptr<SocketClient> client = weak.lock()) {
+            if (client->mFd != -1 && !client->mWriteWait && client->mWriteBuffer.empty())
+                client->flushWriteQueue();
+        }
+    });
+    return true;
+}
+#endif
+
+bool SocketClient::setZeroCopy(bool on, size_t threshold)
+{
+    if (!on) {
+        // completions for what's in flight still come in through the error queue
+        mZeroCopyThreshold = 0;
+        return true;
+    }
+#ifdef HAVE_ZEROCOPY
+    mZeroCopyThreshold = std::max<size_t>(threshold, 1);
+    if (mFd == -1 || enableZeroCopy())
+        return true;
+#else
+    (void)threshold;
+#endif
+    mZeroCopyThreshold = 0;
+    return false;
+}
+
+bool SocketClient::enableZeroCopy()
+{
+#ifdef HAVE_ZEROCOPY
+    std::shared_ptr<EventLoop> loop = EventLoop::eventLoop();
+    if (mBlocking || !loop || !(mSocketMode & Tcp))
+        return false;
+    int on = 1;
+    if (::setsockopt(mFd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+        return false;
+    loop->updateSocket(mFd, eventMode(mWriteWait ? EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot : EventLoop::SocketRead));
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SocketClient::sendZeroCopy(const QueuedWrite &write, ssize_t *result)
+{
+#ifdef HAVE_ZEROCOPY
+    const size_t size = write.size - mWriteQueueOffset;
+    if (!mZeroCopyThreshold || size < mZeroCopyThreshold)
+        return false;
+    ssize_t e;
+    eintrwrap(e, ::send(mFd, write.data->constData() + mWriteQueueOffset, size, MSG_ZEROCOPY | MSG_NOSIGNAL));
+    if (e == -1 && errno == ENOBUFS) {
+        // out of option memory for the notifications, copy this one
+        return false;
+    }
+    if (e > 0) {
+        // the kernel numbers every successful zero copy send
+        mZeroCopyPending.push_back({ mZeroCopySequence++, write.data });
+    }
+    *result = e;
+    return true;
+#else
+    (void)write;
+    (void)result;
+    return false;
+#endif
+}
+
+void SocketClient::readZeroCopyCompletions()
+{
+    bool copied = false;
+    readZeroCopyCompletions(mFd, mZeroCopyPending, &copied);
+    if (copied) {
+        // no point pinning pages that are copied anyway
+        mZeroCopyThreshold = 0;
+    }
+}
+
+void SocketClient::readZeroCopyCompletions(int fd, LinkedList<ZeroCopyWrite> &pending, bool *copied)
+{
+#ifdef HAVE_ZEROCOPY
+    for (;;) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        int e;
+        eintrwrap(e, ::recvmsg(fd, &msg, MSG_ERRQUEUE));
+        if (e == -1)
+            break;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            const sock_extended_err *err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                *copied = true;
+            // [ee_info, ee_data], the sequence wraps
+            const uint32_t first = err->ee_info;
+            const uint32_t count = err->ee_data - first;
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (it->sequence - first <= count) {
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+#else
+    (void)fd;
+    (void)pending;
+    (void)copied;
+#endif
+}
+
+// The kernel may still be reading the buffers of zero copy sends, they
+// can't be released or reused before it says so and that's only said on
+// the socket's error queue. The socket is shut down so the peer sees the
+// end of the stream but the fd stays open until the completions are in.
+void SocketClient::drainZeroCopy()
+{
+    ::shutdown(mFd, SHUT_RDWR);
+    struct Drain
+    {
+        int fd;
+        LinkedList<ZeroCopyWrite> pending;
+        uint64_t deadline;
+    };
+    std::shared_ptr<Drain> drain(new Drain { mFd, std::move(mZeroCopyPending), Rct::monoMs() + ZeroCopyDrainTimeout });
+    mZeroCopyPending.clear();
+    std::shared_ptr<EventLoop> loop = EventLoop::eventLoop();
+    if (!loop) {
+        // nothing to wait on, keeping the buffers forever beats releasing them early
+        new LinkedList<ZeroCopyWrite>(std::move(drain->pending));
+        ::close(drain->fd);
+        return;
+    }
+    loop->registerTimer([drain](int id) {
+        bool copied = false;
+        readZeroCopyCompletions(drain->fd, drain->pending, &copied);
+        if (!drain->pending.empty()) {
+            if (Rct::monoMs() < drain->deadline)
+                return;
+            ::error() << "Gave up on" << drain->pending.size() << "zero copy completions for fd" << drain->fd;
+            new LinkedList<ZeroCopyWrite>(std::move(drain->pending));
+        }
+        ::close(drain->fd);
+        if (std::shared_ptr<EventLoop> eventLoop = EventLoop::eventLoop())
+            eventLoop->unregisterTimer(id);
+    }, ZeroCopyDrainInterval);
+}
+
+unsigned int SocketClient::eventMode(unsigned int mode) const
+{
+    if (mZeroCopyThreshold || !mZeroCopyPending.empty())
+        mode |= EventLoop::SocketErrorQueue;
+    return mode;
+}
+
 static String addrToString(const sockaddr *addr, bool IPv6)
 {
     String ip(INET6_ADDRSTRLEN, '\0');
@@ -605,6 +1183,113 @@ static uint16_t addrToPort(const sockaddr *addr, bool IPv6)
     return ntohs(reinterpret_cast<const sockaddr_in *>(addr)->sin_port);
 }
 
+struct SocketClient::DatagramBatch
+{
+    unsigned int count, maxSize;
+    Buffer buffers;
+    List<sockaddr_storage> addresses;
+#ifdef HAVE_RECVMMSG
+    List<mmsghdr> headers;
+    List<iovec> vectors;
+#else
+    List<unsigned int> sizes;
+#endif
+    List<Datagram> datagrams;
+};
+
+void SocketClient::setDatagramBatching(unsigned int count, unsigned int maxSize)
+{
+    if (!count || !maxSize) {
+        mDatagramBatch.reset();
+        return;
+    }
+    std::unique_ptr<DatagramBatch> batch(new DatagramBatch);
+    batch->count   = count;
+    batch->maxSize = maxSize;
+    batch->buffers.reserve(static_cast<size_t>(count) * maxSize);
+    batch->addresses.resize(count);
+    batch->datagrams.reserve(count);
+#ifdef HAVE_RECVMMSG
+    batch->headers.resize(count);
+    batch->vectors.resize(count);
+    memset(batch->headers.data(), 0, count * sizeof(mmsghdr));
+    for (unsigned int i = 0; i < count; ++i) {
+        batch->vectors[i].iov_base             = batch->buffers.data() + static_cast<size_t>(i) * maxSize;
+        batch->vectors[i].iov_len              = maxSize;
+        batch->headers[i].msg_hdr.msg_name    = &batch->addresses[i];
+        batch->headers[i].msg_hdr.msg_iov     = &batch->vectors[i];
+        batch->headers[i].msg_hdr.msg_iovlen  = 1;
+    }
+#else
+    batch->sizes.resize(count);
+#endif
+    mDatagramBatch = std::move(batch);
+}
+
+void SocketClient::readDatagrams(const std::shared_ptr<SocketClient> &socketPtr)
+{
+    DatagramBatch *batch = mDatagramBatch.get();
+    const bool isIPv6    = mSocketMode & IPv6;
+    for (;;) {
+        int received;
+#ifdef HAVE_RECVMMSG
+        for (mmsghdr &header : batch->headers) {
+            header.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            header.msg_hdr.msg_flags   = 0;
+        }
+        eintrwrap(received, ::recvmmsg(mFd, batch->headers.data(), batch->count, MSG_DONTWAIT, nullptr));
+#else
+        received = 0;
+        while (received < static_cast<int>(batch->count)) {
+            socklen_t fromLen = sizeof(sockaddr_storage);
+            int e;
+            eintrwrap(e, ::recvfrom(mFd, reinterpret_cast<char *>(batch->buffers.data()) + static_cast<size_t>(received) * batch->maxSize,
+                                    batch->maxSize, 0, reinterpret_cast<sockaddr *>(&batch->addresses[received]), &fromLen));
+            if (e == -1)
+                break;
+            batch->sizes[received++] = e;
+        }
+        if (!received)
+            received = -1;
+#endif
+        DEBUG() << "RECEIVED(3)" << received << "DATAGRAMS" << errno;
+        if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            // bad
+            mSignalError(socketPtr, ReadError);
+            close();
+            return;
+        }
+
+        batch->datagrams.clear();
+        for (int i = 0; i < received; ++i) {
+            const sockaddr *from = reinterpret_cast<const sockaddr *>(&batch->addresses[i]);
+            Datagram datagram;
+            datagram.data = batch->buffers.data() + static_cast<size_t>(i) * batch->maxSize;
+#ifdef HAVE_RECVMMSG
+            datagram.size      = batch->headers[i].msg_len;
+            datagram.truncated = batch->headers[i].msg_hdr.msg_flags & MSG_TRUNC;
+#else
+            datagram.size      = batch->sizes[i];
+            datagram.truncated = false;
+#endif
+            // senders tend to repeat, only convert new addresses
+            if (i && !memcmp(from, &batch->addresses[i - 1], isIPv6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in))) {
+                datagram.address = batch->datagrams.last().address;
+                datagram.port    = batch->datagrams.last().port;
+            } else {
+                datagram.address = addrToString(from, isIPv6);
+                datagram.port    = addrToPort(from, isIPv6);
+            }
+            batch->datagrams.append(std::move(datagram));
+        }
+        mSignalReadyReadDatagrams(socketPtr, batch->datagrams);
+        if (mFd == -1 || mDatagramBatch.get() != batch)
+            return;
+    }
+}
+
 void SocketClient::socketCallback(int f, int mode)
 {
     assert(f == mFd);
@@ -618,9 +1303,18 @@ void SocketClient::socketCallback(int f, int mode)
         return;
     }
 
+    if (mode & EventLoop::SocketErrorQueue) {
+        readZeroCopyCompletions();
+        if (mWriteWait && !(mode & (EventLoop::SocketRead | EventLoop::SocketWrite))) {
+            // the error disarmed the one shot write notification
+            if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop())
+                loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
+        }
+    }
+
     if (mWriteWait && (mode & EventLoop::SocketWrite)) {
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-            loop->updateSocket(mFd, EventLoop::SocketRead);
+            loop->updateSocket(mFd, eventMode(EventLoop::SocketRead));
             mWriteWait = false;
         }
     }
@@ -635,10 +1329,18 @@ void SocketClient::socketCallback(int f, int mode)
     socklen_t fromLen = 0;
     const bool isIPv6 = mSocketMode & IPv6;
 
-    if (mode & EventLoop::SocketRead) {
+    if ((mode & EventLoop::SocketRead) && mDatagramBatch) {
+        readDatagrams(socketPtr);
+        if (mFd == -1)
+            return;
+        if (mWriteWait) {
+            if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
+                loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
+            }
+        }
+    } else if (mode & EventLoop::SocketRead) {
         enum
         {
-            BlockSize  = 1024,
             AllocateAt = 512
         };
 
@@ -647,12 +1349,10 @@ void SocketClient::socketCallback(int f, int mode)
         unsigned int total = 0;
         for (;;) {
             unsigned int rem = mReadBuffer.capacity() - mReadBuffer.size();
-            // printf("reading, remaining size %u\n", rem);
             if (rem <= AllocateAt) {
-                // printf("allocating more\n");
-                mReadBuffer.reserve(mReadBuffer.size() + BlockSize);
+                // start with what recent reads needed, then double
+                mReadBuffer.reserve(std::max<size_t>(mReadBuffer.size() + mReadSize, mReadBuffer.capacity() * 2));
                 rem = mReadBuffer.capacity() - mReadBuffer.size();
-                // printf("Rem is now %d\n", rem);
             }
             if (mSocketMode & Udp) {
                 if (isIPv6) {
@@ -694,12 +1394,14 @@ void SocketClient::socketCallback(int f, int mode)
             }
         }
         assert(total <= mReadBuffer.capacity());
-        if (!fromLen)
+        if (!fromLen) {
+            updateReadSize(total);
             mSignalReadyRead(socketPtr, std::move(mReadBuffer));
+        }
 
         if (mWriteWait) {
             if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-                loop->updateSocket(mFd, EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot);
+                loop->updateSocket(mFd, eventMode(EventLoop::SocketRead | EventLoop::SocketWrite | EventLoop::SocketOneShot));
             }
         }
     }
@@ -731,6 +1433,15 @@ void SocketClient::socketCallback(int f, int mode)
     }
 }
 
+void SocketClient::updateReadSize(size_t bytes)
+{
+    if (bytes >= mReadSize) {
+        mReadSize = std::min<size_t>(mReadSize * 2, MaxReadSize);
+    } else if (bytes < mReadSize / 4) {
+        mReadSize = std::max<size_t>(mReadSize / 2, MinReadSize);
+    }
+}
+
 bool SocketClient::init(unsigned int mode)
 {
     int domain = -1, type = -1;
@@ -762,6 +1473,8 @@ bool SocketClient::init(unsigned int mode)
 #ifdef HAVE_CLOEXEC
     setFlags(mFd, FD_CLOEXEC, F_GETFD, F_SETFD);
 #endif
+    if (!mSocketOptions.isEmpty() && !mSocketOptions.apply(mFd, mode & Tcp))
+        warning() << "Unable to apply all socket options" << Rct::strerror();
 
     if (!mBlocking) {
         if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
@@ -776,9 +1489,21 @@ bool SocketClient::init(unsigned int mode)
     }
 
     mSocketMode = mode;
+    if (mZeroCopyThreshold && !enableZeroCopy()) {
+        warning() << "Unable to enable zero copy" << Rct::strerror();
+        mZeroCopyThreshold = 0;
+    }
     return true;
 }
 
+bool SocketClient::setSocketOptions(const SocketOptions &options)
+{
+    mSocketOptions.merge(options);
+    if (mFd == -1)
+        return true;
+    return options.apply(mFd, mSocketMode & Tcp, mSocketState == Connected ? SocketOptions::Connected : SocketOptions::Client);
+}
+
 bool SocketClient::setFlags(int mFd, int flag, int getcmd, int setcmd, FlagMode mode)
 {
 #ifdef _WIN32
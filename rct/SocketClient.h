@@ -1,6 +1,7 @@
 #ifndef TCPSOCKET_H
 #define TCPSOCKET_H
 
+#include <assert.h>
 #include <functional>
 #include <memory>
 #include <stddef.h>
@@ -8,8 +9,11 @@
 #include <utility>
 
 #include "Buffer.h"
+#include "Hash.h"
+#include "LinkedList.h"
 #include "Rct.h"
 #include "SignalSlot.h"
+#include "SocketOptions.h"
 #include "String.h"
 
 // #define RCT_SOCKETCLIENT_TIMING_ENABLED
@@ -23,7 +27,10 @@ public:
         Udp      = 0x2,
         Unix     = 0x4,
         IPv6     = 0x8,
-        Blocking = 0x10
+        Blocking = 0x10,
+        // for SocketClient(int, unsigned int), the fd is non-blocking and
+        // close-on-exec already, e.g. from accept4()
+        Accepted = 0x20
     };
 
     SocketClient(unsigned int mode = 0);
@@ -40,6 +47,7 @@ public:
     enum State
     {
         Disconnected,
+        Resolving,
         Connecting,
         Connected
     };
@@ -56,6 +64,8 @@ public:
 #ifndef _WIN32
     bool connect(const String &path); // UNIX
 #endif
+    // host names are resolved with DnsResolver unless the socket is
+    // blocking or there's no EventLoop, state() is Resolving meanwhile
     bool connect(const String &host, uint16_t port); // TCP
     bool bind(uint16_t port);                        // UDP
 
@@ -74,9 +84,11 @@ public:
         return mSocketPort;
     }
 
+    // also true while the host name passed to connect() is being resolved,
+    // writes are buffered until there's a socket
     bool isConnected() const
     {
-        return mFd != -1;
+        return mFd != -1 || mSocketState == Resolving;
     }
 
     int socket() const
@@ -94,6 +106,68 @@ public:
         return write(&data[0], data.size());
     }
 
+    /**
+     * Queues a reference to @a data instead of copying whatever can't be
+     * written right away. Meant for the same payload going out on many
+     * sockets, e.g. Connection::broadcast(). @a data must not change
+     * until it has been written.
+     */
+    bool write(const std::shared_ptr<const String> &data);
+
+#ifndef _WIN32
+    /**
+     * Queues @a length bytes of @a path starting at @a offset, or
+     * everything from @a offset if @a length is -1. The contents go
+     * straight from the file to the socket with sendfile() where available
+     * and are reported with bytesWritten() like any other write. The file
+     * is opened right away so it can be removed or replaced afterwards.
+     * The queued length counts towards maxWriteBufferSize() like any
+     * other write.
+     */
+    bool sendFile(const Path &path, uint64_t offset = 0, int64_t length = -1);
+
+    /**
+     * Like sendFile(const Path &) but @a fd is dup()'ed, the caller can
+     * close it right away. Pipes are moved with splice() on Linux, a
+     * @a length is required for those.
+     */
+    bool sendFile(int fd, uint64_t offset = 0, int64_t length = -1);
+#endif
+
+    /**
+     * Sends queued shared buffers of at least @a threshold bytes with
+     * MSG_ZEROCOPY on Linux. The kernel pins the pages instead of copying
+     * them and the buffer is held on to until the completion arrives on
+     * the socket's error queue, so a write(std::shared_ptr<const String>)
+     * may keep its data alive longer than pendingWrite() suggests, even
+     * past close(): the socket is shut down then and its fd only closed
+     * once the kernel is done with every buffer.
+     * Smaller writes and everything written with write(const void *)
+     * are copied as usual. The kernel copies anyway for loopback and
+     * some devices, once it reports that zero copy is turned off again.
+     *
+     * Only for non-blocking TCP sockets, returns false if the platform or
+     * socket doesn't support it.
+     */
+    bool setZeroCopy(bool on, size_t threshold = DefaultZeroCopyThreshold);
+
+    bool isZeroCopy() const
+    {
+        return mZeroCopyThreshold;
+    }
+
+    // zero copy sends the kernel hasn't completed yet
+    size_t pendingZeroCopy() const
+    {
+        return mZeroCopyPending.size();
+    }
+
+    enum
+    {
+        // below this the page pinning and completion cost more than the copy
+        DefaultZeroCopyThreshold = 65536
+    };
+
     String peerName(uint16_t *port = nullptr) const;
 
     String peerString() const
@@ -126,6 +200,38 @@ public:
         return writeTo(host, port, reinterpret_cast<const unsigned char *>(&data[0]), data.size());
     }
 
+    /**
+     * Sends each of @a datagrams to @a host:@a port, with a single sendmmsg()
+     * where available. Resolved destinations are cached per socket for
+     * this and the single datagram writeTo().
+     */
+    bool writeTo(const String &host, uint16_t port, const List<String> &datagrams);
+
+    struct Datagram
+    {
+        // points into the socket's receive buffers and is only valid
+        // while readyReadDatagrams() is emitted
+        const unsigned char *data;
+        unsigned int size;
+        String address;
+        uint16_t port;
+        // the datagram was larger than the maxSize it was received with
+        bool truncated;
+    };
+
+    /**
+     * With a @a count > 0 datagrams are received up to @a count at a time
+     * with recvmmsg() into buffers owned by the socket and emitted with
+     * readyReadDatagrams() instead of readyReadFrom(). Longer datagrams
+     * are truncated to @a maxSize.
+     */
+    void setDatagramBatching(unsigned int count, unsigned int maxSize = DefaultMaxDatagramSize);
+
+    enum
+    {
+        DefaultMaxDatagramSize = 2048
+    };
+
     // UDP Multicast
     bool addMembership(const String &ip);
     bool dropMembership(const String &ip);
@@ -152,6 +258,11 @@ public:
         return mSignalReadyReadFrom;
     }
 
+    Signal<std::function<void(const std::shared_ptr<SocketClient> &, const List<Datagram> &)>> &readyReadDatagrams()
+    {
+        return mSignalReadyReadDatagrams;
+    }
+
     Signal<std::function<void(const std::shared_ptr<SocketClient> &)>> &connected()
     {
         return signalConnected;
@@ -167,6 +278,22 @@ public:
         return mSignalBytesWritten;
     }
 
+    /**
+     * Emitted when the number of bytes waiting to be written reaches the
+     * high watermark. Producers should stop writing until writeUnblocked()
+     * is emitted, which happens once the pending bytes drop to the low
+     * watermark.
+     */
+    Signal<std::function<void(const std::shared_ptr<SocketClient> &)>> &writeBlocked()
+    {
+        return mSignalWriteBlocked;
+    }
+
+    Signal<std::function<void(const std::shared_ptr<SocketClient> &)>> &writeUnblocked()
+    {
+        return mSignalWriteUnblocked;
+    }
+
     enum Error
     {
         InitializeError,
@@ -201,6 +328,68 @@ public:
         mMaxWriteBufferSize = maxWriteBufferSize;
     }
 
+    /**
+     * Options set in @a options replace the ones set before. They are
+     * applied right away if there is a socket and to the socket connect()
+     * or bind() creates. Returns false if any of them couldn't be applied
+     * right away.
+     */
+    bool setSocketOptions(const SocketOptions &options);
+
+    const SocketOptions &socketOptions() const
+    {
+        return mSocketOptions;
+    }
+
+    /**
+     * A @a high of 0 disables the watermarks. Unlike setMaxWriteBufferSize()
+     * writes never fail because of the watermarks, they only drive the
+     * writeBlocked() and writeUnblocked() signals.
+     */
+    void setWriteWatermarks(size_t low, size_t high)
+    {
+        assert(low <= high);
+        mLowWatermark  = low;
+        mHighWatermark = high;
+        updateWriteBlocked();
+    }
+
+    size_t lowWriteWatermark() const
+    {
+        return mLowWatermark;
+    }
+
+    size_t highWriteWatermark() const
+    {
+        return mHighWatermark;
+    }
+
+    bool isWriteBlocked() const
+    {
+        return mWriteBlocked;
+    }
+
+    /**
+     * Reads go into buffers from the thread's BufferPool. The first block
+     * of each read is sized after how much recent reads returned, between
+     * MinReadSize and MaxReadSize.
+     */
+    size_t readSize() const
+    {
+        return mReadSize;
+    }
+
+    enum
+    {
+        MinReadSize = BufferPool::MinBlockSize,
+        MaxReadSize = 256 * 1024
+    };
+
+    size_t pendingWrite() const
+    {
+        return mWriteBuffer.size() - mWriteOffset + mWriteQueueSize - mWriteQueueOffset;
+    }
+
 #ifdef RCT_SOCKETCLIENT_TIMING_ENABLED
     double mbpsWritten() const;
 #endif
@@ -216,6 +405,7 @@ public:
 
 private:
     bool init(unsigned int mode);
+    bool connectAddress(const String &host, const String &address, uint16_t port);
 
     int mFd { -1 };
     uint16_t mSocketPort { 0 };
@@ -226,17 +416,74 @@ private:
     bool mBlocking { false };
     bool mLogsEnabled { true };
     size_t mMaxWriteBufferSize { 0 };
+    size_t mLowWatermark { 0 };
+    size_t mHighWatermark { 0 };
+    bool mWriteBlocked { false };
+    SocketOptions mSocketOptions;
 
     Signal<std::function<void(const std::shared_ptr<SocketClient> &, Buffer &&)>> mSignalReadyRead;
     Signal<std::function<void(const std::shared_ptr<SocketClient> &, const String &, uint16_t, Buffer &&)>> mSignalReadyReadFrom;
+    Signal<std::function<void(const std::shared_ptr<SocketClient> &, const List<Datagram> &)>> mSignalReadyReadDatagrams;
     Signal<std::function<void(const std::shared_ptr<SocketClient> &)>> signalConnected, signalDisconnected;
+    Signal<std::function<void(const std::shared_ptr<SocketClient> &)>> mSignalWriteBlocked, mSignalWriteUnblocked;
     Signal<std::function<void(const std::shared_ptr<SocketClient> &, Error)>> mSignalError;
     Signal<std::function<void(const std::shared_ptr<SocketClient> &, int)>> mSignalBytesWritten;
     void bytesWritten(const std::shared_ptr<SocketClient> &socket, uint64_t bytes);
     Buffer mReadBuffer, mWriteBuffer;
+    size_t mReadSize { MinReadSize };
     size_t mWriteOffset;
+    // shared buffers, always written after everything in mWriteBuffer
+    struct QueuedFile;
+    struct QueuedWrite
+    {
+        std::shared_ptr<const String> data;
+        // a file region when data is null
+        std::shared_ptr<QueuedFile> file;
+        size_t size;
+    };
+    LinkedList<QueuedWrite> mWriteQueue;
+    size_t mWriteQueueSize { 0 };
+    size_t mWriteQueueOffset { 0 };
+
+    bool flushWriteQueue();
+#ifndef _WIN32
+    bool waitForInput(const std::shared_ptr<QueuedFile> &file);
+#endif
+
+    // buffers sent with MSG_ZEROCOPY until the kernel is done with them
+    struct ZeroCopyWrite
+    {
+        uint32_t sequence;
+        std::shared_ptr<const String> data;
+    };
+    size_t mZeroCopyThreshold { 0 };
+    uint32_t mZeroCopySequence { 0 };
+    LinkedList<ZeroCopyWrite> mZeroCopyPending;
+
+    enum
+    {
+        ZeroCopyDrainInterval = 10,
+        ZeroCopyDrainTimeout  = 60000
+    };
+
+    bool enableZeroCopy();
+    bool sendZeroCopy(const QueuedWrite &write, ssize_t *result);
+    void readZeroCopyCompletions();
+    static void readZeroCopyCompletions(int fd, LinkedList<ZeroCopyWrite> &pending, bool *copied);
+    void drainZeroCopy();
+    unsigned int eventMode(unsigned int mode) const;
+
+    struct DatagramBatch;
+    struct Destination;
+    std::unique_ptr<DatagramBatch> mDatagramBatch;
+    Hash<String, std::shared_ptr<Destination>> mDestinations;
+
+    void readDatagrams(const std::shared_ptr<SocketClient> &socketPtr);
+    const Destination *destination(const String &host, uint16_t port);
 
     int writeData(const unsigned char *data, int size);
+    void updateWriteBlocked();
+    void updateReadSize(size_t bytes);
     void socketCallback(int, int);
 
 #ifdef RCT_SOCKETCLIENT_TIMING_ENABLED
@@ -0,0 +1,119 @@
+#include "SocketOptions.h"
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+void SocketOptions::merge(const SocketOptions &other)
+{
+    if (other.isSet(NoDelay))
+        setNoDelay(other.mNoDelay);
+    if (other.isSet(QuickAck))
+        setQuickAck(other.mQuickAck);
+    if (other.isSet(SendBufferSize))
+        setSendBufferSize(other.mSendBufferSize);
+    if (other.isSet(ReceiveBufferSize))
+        setReceiveBufferSize(other.mReceiveBufferSize);
+    if (other.isSet(KeepAlive))
+        setKeepAlive(other.mKeepAlive, other.mKeepAliveIdle, other.mKeepAliveInterval, other.mKeepAliveCount);
+    if (other.isSet(BusyPoll))
+        setBusyPoll(other.mBusyPoll);
+    if (other.isSet(FastOpen))
+        setFastOpen(other.mFastOpen);
+    if (other.isSet(DeferAccept))
+        setDeferAccept(other.mDeferAccept);
+}
+
+static bool setOption(int fd, int level, int name, int value)
+{
+#ifdef _WIN32
+    return !::setsockopt(fd, level, name, reinterpret_cast<const char *>(&value), sizeof(value));
+#else
+    return !::setsockopt(fd, level, name, &value, sizeof(value));
+#endif
+}
+
+bool SocketOptions::apply(int fd, bool tcp, ApplyMode mode) const
+{
+    bool ok = true;
+    // these are inherited by accepted sockets and only affect the window
+    // scale if set before connect() or listen()
+    if (isSet(SendBufferSize))
+        ok = setOption(fd, SOL_SOCKET, SO_SNDBUF, mSendBufferSize) && ok;
+    if (isSet(ReceiveBufferSize))
+        ok = setOption(fd, SOL_SOCKET, SO_RCVBUF, mReceiveBufferSize) && ok;
+
+    if (mode == Listener) {
+        if (!tcp)
+            return ok;
+        if (isSet(FastOpen)) {
+#ifdef TCP_FASTOPEN
+            ok = setOption(fd, IPPROTO_TCP, TCP_FASTOPEN, mFastOpen) && ok;
+#else
+            ok = false;
+#endif
+        }
+        if (isSet(DeferAccept)) {
+#ifdef TCP_DEFER_ACCEPT
+            ok = setOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, mDeferAccept) && ok;
+#else
+            ok = false;
+#endif
+        }
+        return ok;
+    }
+
+    if (isSet(BusyPoll)) {
+#ifdef SO_BUSY_POLL
+        ok = setOption(fd, SOL_SOCKET, SO_BUSY_POLL, mBusyPoll) && ok;
+#else
+        ok = false;
+#endif
+    }
+    if (!tcp)
+        return ok;
+
+    if (isSet(NoDelay))
+        ok = setOption(fd, IPPROTO_TCP, TCP_NODELAY, mNoDelay) && ok;
+    if (isSet(QuickAck)) {
+#ifdef TCP_QUICKACK
+        ok = setOption(fd, IPPROTO_TCP, TCP_QUICKACK, mQuickAck) && ok;
+#else
+        ok = false;
+#endif
+    }
+    if (isSet(KeepAlive)) {
+        ok = setOption(fd, SOL_SOCKET, SO_KEEPALIVE, mKeepAlive) && ok;
+        if (mKeepAlive && mKeepAliveIdle > 0) {
+#if defined(TCP_KEEPIDLE)
+            ok = setOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, mKeepAliveIdle) && ok;
+#elif defined(TCP_KEEPALIVE)
+            ok = setOption(fd, IPPROTO_TCP, TCP_KEEPALIVE, mKeepAliveIdle) && ok;
+#else
+            ok = false;
+#endif
+        }
+#if defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        if (mKeepAlive && mKeepAliveInterval > 0)
+            ok = setOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, mKeepAliveInterval) && ok;
+        if (mKeepAlive && mKeepAliveCount > 0)
+            ok = setOption(fd, IPPROTO_TCP, TCP_KEEPCNT, mKeepAliveCount) && ok;
+#else
+        if (mKeepAlive && (mKeepAliveInterval > 0 || mKeepAliveCount > 0))
+            ok = false;
+#endif
+    }
+    if (mode == Client && isSet(FastOpen) && mFastOpen > 0) {
+#ifdef TCP_FASTOPEN_CONNECT
+        ok = setOption(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1) && ok;
+#else
+        ok = false;
+#endif
+    }
+    return ok;
+}
@@ -0,0 +1,206 @@
+#ifndef SOCKETOPTIONS_H
+#define SOCKETOPTIONS_H
+
+#include <stdint.h>
+
+/**
+ * A set of socket options where only the ones that have been set are
+ * applied. Used with SocketClient::setSocketOptions(),
+ * Connection::setSocketOptions() and SocketServer::setSocketOptions(), in
+ * the latter case they are the defaults for every accepted client.
+ *
+ * TCP options are skipped for unix sockets. Options the platform doesn't
+ * have make apply() return false but everything else is still applied.
+ */
+class SocketOptions
+{
+public:
+    enum Option
+    {
+        NoDelay           = 0x001, // TCP_NODELAY
+        QuickAck          = 0x002, // TCP_QUICKACK, Linux only
+        SendBufferSize    = 0x004, // SO_SNDBUF
+        ReceiveBufferSize = 0x008, // SO_RCVBUF
+        KeepAlive         = 0x010, // SO_KEEPALIVE, TCP_KEEPIDLE/KEEPINTVL/KEEPCNT
+        BusyPoll          = 0x020, // SO_BUSY_POLL, Linux only
+        FastOpen          = 0x040, // TCP_FASTOPEN on listeners, TCP_FASTOPEN_CONNECT on clients
+        DeferAccept       = 0x080  // TCP_DEFER_ACCEPT, listeners only, Linux only
+    };
+
+    SocketOptions()
+        : mSet(0)
+        , mNoDelay(false)
+        , mQuickAck(false)
+        , mKeepAlive(false)
+        , mSendBufferSize(0)
+        , mReceiveBufferSize(0)
+        , mKeepAliveIdle(0)
+        , mKeepAliveInterval(0)
+        , mKeepAliveCount(0)
+        , mBusyPoll(0)
+        , mFastOpen(0)
+        , mDeferAccept(0)
+    {
+    }
+
+    bool isSet(Option option) const
+    {
+        return mSet & option;
+    }
+
+    bool isEmpty() const
+    {
+        return !mSet;
+    }
+
+    void unset(Option option)
+    {
+        mSet &= ~option;
+    }
+
+    // options set in @a other replace the ones in this
+    void merge(const SocketOptions &other);
+
+    SocketOptions &setNoDelay(bool on = true)
+    {
+        mNoDelay = on;
+        mSet |= NoDelay;
+        return *this;
+    }
+
+    bool noDelay() const
+    {
+        return mNoDelay;
+    }
+
+    SocketOptions &setQuickAck(bool on = true)
+    {
+        mQuickAck = on;
+        mSet |= QuickAck;
+        return *this;
+    }
+
+    bool quickAck() const
+    {
+        return mQuickAck;
+    }
+
+    SocketOptions &setSendBufferSize(int bytes)
+    {
+        mSendBufferSize = bytes;
+        mSet |= SendBufferSize;
+        return *this;
+    }
+
+    int sendBufferSize() const
+    {
+        return mSendBufferSize;
+    }
+
+    SocketOptions &setReceiveBufferSize(int bytes)
+    {
+        mReceiveBufferSize = bytes;
+        mSet |= ReceiveBufferSize;
+        return *this;
+    }
+
+    int receiveBufferSize() const
+    {
+        return mReceiveBufferSize;
+    }
+
+    /**
+     * @a idle seconds before the first probe, @a interval seconds between
+     * probes and @a count unanswered probes before the connection is
+     * dropped. 0 leaves the system default.
+     */
+    SocketOptions &setKeepAlive(bool on, int idle = 0, int interval = 0, int count = 0)
+    {
+        mKeepAlive         = on;
+        mKeepAliveIdle     = idle;
+        mKeepAliveInterval = interval;
+        mKeepAliveCount    = count;
+        mSet |= KeepAlive;
+        return *this;
+    }
+
+    bool keepAlive() const
+    {
+        return mKeepAlive;
+    }
+
+    int keepAliveIdle() const
+    {
+        return mKeepAliveIdle;
+    }
+
+    int keepAliveInterval() const
+    {
+        return mKeepAliveInterval;
+    }
+
+    int keepAliveCount() const
+    {
+        return mKeepAliveCount;
+    }
+
+    // microseconds to busy poll the device queue on blocking reads
+    SocketOptions &setBusyPoll(int usec)
+    {
+        mBusyPoll = usec;
+        mSet |= BusyPoll;
+        return *this;
+    }
+
+    int busyPoll() const
+    {
+        return mBusyPoll;
+    }
+
+    // the pending fast open queue length for listeners, clients only care
+    // whether it's > 0
+    SocketOptions &setFastOpen(int queueLength)
+    {
+        mFastOpen = queueLength;
+        mSet |= FastOpen;
+        return *this;
+    }
+
+    int fastOpen() const
+    {
+        return mFastOpen;
+    }
+
+    // seconds to wait for data before accept() returns a connection
+    SocketOptions &setDeferAccept(int seconds)
+    {
+        mDeferAccept = seconds;
+        mSet |= DeferAccept;
+        return *this;
+    }
+
+    int deferAccept() const
+    {
+        return mDeferAccept;
+    }
+
+    enum ApplyMode
+    {
+        Client,
+        Listener,
+        // an accepted or otherwise connected socket, nothing that only
+        // matters before connect() is applied
+        Connected
+    };
+
+    bool apply(int fd, bool tcp, ApplyMode mode = Client) const;
+
+private:
+    unsigned int mSet;
+    bool mNoDelay, mQuickAck, mKeepAlive;
+    int mSendBufferSize, mReceiveBufferSize;
+    int mKeepAliveIdle, mKeepAliveInterval, mKeepAliveCount;
+    int mBusyPoll, mFastOpen, mDeferAccept;
+};
+
+#endif
@@ -30,6 +30,8 @@
 SocketServer::SocketServer()
     : fd(-1)
     , isIPv6(false)
+    , maxAccepts(DefaultMaxAcceptsPerWakeup)
+    , nextLoop(0)
 {
 }
 
@@ -86,6 +88,11 @@ bool SocketServer::listen(uint16_t port, Mode mode)
 #ifdef HAVE_CLOEXEC
     SocketClient::setFlags(fd, FD_CLOEXEC, F_GETFD, F_SETFD);
 #endif
+    if (!options.apply(fd, true, SocketOptions::Listener)) {
+        serverError(this, InitializeError);
+        close();
+        return false;
+    }
 
     // ### support specific interfaces
     union
@@ -127,6 +134,11 @@ bool SocketServer::listen(const Path &p)
 #ifdef HAVE_CLOEXEC
     SocketClient::setFlags(fd, FD_CLOEXEC, F_GETFD, F_SETFD);
 #endif
+    if (!options.apply(fd, false, SocketOptions::Listener)) {
+        serverError(this, InitializeError);
+        close();
+        return false;
+    }
 
     union
     {
@@ -183,7 +195,8 @@ bool SocketServer::commonListen()
     }
 
     if (std::shared_ptr<EventLoop> loop = EventLoop::eventLoop()) {
-        loop->registerSocket(fd, EventLoop::SocketRead,
+        // level triggered, whatever is left after maxAccepts is reported again
+        loop->registerSocket(fd, EventLoop::SocketRead | EventLoop::SocketLevelTriggered,
                              //|EventLoop::SocketWrite,
                              std::bind(&SocketServer::socketCallback, this, std::placeholders::_1, std::placeholders::_2));
 #ifndef _WIN32
@@ -198,13 +211,25 @@ bool SocketServer::commonListen()
     return true;
 }
 
+unsigned int SocketServer::clientMode() const
+{
+    unsigned int mode = path.empty() ? SocketClient::Tcp : SocketClient::Unix;
+#ifdef HAVE_ACCEPT4
+    mode |= SocketClient::Accepted;
+#endif
+    return mode;
+}
+
 std::shared_ptr<SocketClient> SocketServer::nextConnection()
 {
     if (accepted.empty())
         return nullptr;
     const int sock = accepted.front();
     accepted.pop();
-    return std::shared_ptr<SocketClient>(new SocketClient(sock, path.empty() ? SocketClient::Tcp : SocketClient::Unix));
+    std::shared_ptr<SocketClient> client(new SocketClient(sock, clientMode()));
+    if (!options.isEmpty())
+        client->setSocketOptions(options);
+    return client;
 }
 
 void SocketServer::socketCallback(int /*fd*/, int mode)
@@ -216,30 +241,50 @@ void SocketServer::socketCallback(int /*fd*/, int mode)
         sockaddr client;
     };
 
-    socklen_t size = 0;
-    if (isIPv6) {
-        size = sizeof(client6);
-    } else {
-        size = sizeof(client4);
-    }
     int e;
 
     if (!(mode & EventLoop::SocketRead))
         return;
 
-    for (;;) {
+    bool failed = false;
+    int count   = 0;
+    while (count < maxAccepts) {
+        socklen_t size = isIPv6 ? sizeof(client6) : sizeof(client4);
+#ifdef HAVE_ACCEPT4
+        eintrwrap(e, ::accept4(fd, &client, &size, SOCK_NONBLOCK | SOCK_CLOEXEC));
+#else
         eintrwrap(e, ::accept(fd, &client, &size));
+#endif
         if (e == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;
-            }
-            serverError(this, AcceptError);
-            close();
-            return;
+            failed = (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
         }
-
-        // EventLoop::eventLoop()->unregisterSocket( fd );
         accepted.push(e);
-        serverNewConnection(this);
+        ++count;
+    }
+
+    if (!loops.empty()) {
+        const unsigned int socketMode = clientMode();
+        while (!accepted.empty()) {
+            const int sock = accepted.front();
+            accepted.pop();
+            const std::shared_ptr<EventLoop> &loop = loops.at(nextLoop++ % loops.size());
+            const SocketOptions clientOptions      = options;
+            const ConnectionHandler handler        = connectionHandler;
+            loop->callLater([sock, socketMode, clientOptions, handler]() {
+                std::shared_ptr<SocketClient> socket(new SocketClient(sock, socketMode));
+                if (!clientOptions.isEmpty())
+                    socket->setSocketOptions(clientOptions);
+                handler(socket);
+            });
+        }
+    } else {
+        while (count--)
+            serverNewConnection(this);
+    }
+
+    if (failed) {
+        serverError(this, AcceptError);
+        close();
     }
 }
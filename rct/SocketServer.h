@@ -4,15 +4,18 @@
 #include <functional>
 #include <memory>
 #include <queue>
+#include <rct/List.h>
 #include <rct/Path.h>
 #include <rct/SignalSlot.h>
 #include <rct/SocketClient.h>
+#include <rct/SocketOptions.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "rct/SignalSlot.h"
 
 struct sockaddr;
+class EventLoop;
 class SocketClient;
 
 class SocketServer
@@ -40,6 +43,56 @@ public:
 
     std::shared_ptr<SocketClient> nextConnection();
 
+    /**
+     * Listener options (buffer sizes, FastOpen, DeferAccept) are applied
+     * by the next listen(), everything else to each accepted client.
+     */
+    void setSocketOptions(const SocketOptions &socketOptions)
+    {
+        options = socketOptions;
+    }
+
+    const SocketOptions &socketOptions() const
+    {
+        return options;
+    }
+
+    enum
+    {
+        DefaultMaxAcceptsPerWakeup = 64
+    };
+
+    /**
+     * At most @a count connections are accepted each time the listening
+     * socket is readable. The rest wait for the next iteration of the
+     * EventLoop so a burst of connections doesn't starve other sockets.
+     */
+    void setMaxAcceptsPerWakeup(int count)
+    {
+        maxAccepts = count > 0 ? count : 1;
+    }
+
+    int maxAcceptsPerWakeup() const
+    {
+        return maxAccepts;
+    }
+
+    typedef std::function<void(const std::shared_ptr<SocketClient> &)> ConnectionHandler;
+
+    /**
+     * Hands accepted connections to @a eventLoops in turn instead of
+     * emitting newConnection(). Each SocketClient is created on the thread
+     * of its EventLoop and passed to @a handler there, so @a handler must
+     * be safe to call from all of them. An empty @a eventLoops goes back
+     * to newConnection().
+     */
+    void setEventLoops(const List<std::shared_ptr<EventLoop>> &eventLoops, ConnectionHandler &&handler)
+    {
+        loops             = eventLoops;
+        connectionHandler = std::move(handler);
+        nextLoop          = 0;
+    }
+
     Signal<std::function<void(SocketServer *)>> &newConnection()
     {
         return serverNewConnection;
@@ -62,12 +115,18 @@ private:
     void socketCallback(int fd, int mode);
     bool commonBindAndListen(sockaddr *addr, size_t size);
     bool commonListen();
+    unsigned int clientMode() const;
 
 private:
     int fd;
     bool isIPv6;
     Path path;
+    SocketOptions options;
     std::queue<int> accepted;
+    int maxAccepts;
+    List<std::shared_ptr<EventLoop>> loops;
+    ConnectionHandler connectionHandler;
+    size_t nextLoop;
     Signal<std::function<void(SocketServer *)>> serverNewConnection;
     Signal<std::function<void(SocketServer *, Error)>> serverError;
 };
@@ -0,0 +1,128 @@
+#ifndef StringView_h
+#define StringView_h
+
+#include <string.h>
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include <rct/String.h>
+
+/**
+ * A pointer and a length into memory someone else owns, strings or any
+ * other bytes. Deserializing one doesn't copy, it points into the data
+ * the Deserializer reads from so that has to outlive it. See
+ * operator>>(Deserializer &, StringView &).
+ */
+class StringView
+{
+public:
+    StringView()
+        : mData(nullptr)
+        , mSize(0)
+    {
+    }
+
+    StringView(const char *data, size_t size)
+        : mData(data)
+        , mSize(size)
+    {
+    }
+
+    StringView(const char *str)
+        : mData(str)
+        , mSize(str ? strlen(str) : 0)
+    {
+    }
+
+    StringView(const String &string)
+        : mData(string.constData())
+        , mSize(string.size())
+    {
+    }
+
+    StringView(const std::string &string)
+        : mData(string.data())
+        , mSize(string.size())
+    {
+    }
+
+    const char *data() const
+    {
+        return mData;
+    }
+
+    size_t size() const
+    {
+        return mSize;
+    }
+
+    bool empty() const
+    {
+        return !mSize;
+    }
+
+    const char *begin() const
+    {
+        return mData;
+    }
+
+    const char *end() const
+    {
+        return mData + mSize;
+    }
+
+    char operator[](size_t idx) const
+    {
+        return mData[idx];
+    }
+
+    std::string_view ref() const
+    {
+        return std::string_view(mData, mSize);
+    }
+
+    String toString() const
+    {
+        return String(mData, mSize);
+    }
+
+    bool operator==(const StringView &other) const
+    {
+        return ref() == other.ref();
+    }
+
+    bool operator!=(const StringView &other) const
+    {
+        return ref() != other.ref();
+    }
+
+    bool operator<(const StringView &other) const
+    {
+        return ref() < other.ref();
+    }
+
+    bool operator>(const StringView &other) const
+    {
+        return ref() > other.ref();
+    }
+
+private:
+    const char *mData;
+    size_t mSize;
+};
+
+namespace std {
+template <>
+struct hash<StringView>
+{
+    size_t operator()(const StringView &value) const
+    {
+        std::hash<std::string_view> h;
+        return h(value.ref());
+    }
+};
+} // namespace std
+
+#endif
@@ -0,0 +1,81 @@
+#include "BufferTestSuite.h"
+
+#include <rct/Buffer.h>
+
+void BufferTestSuite::pooledBuffers()
+{
+    BufferPool::clear();
+
+    const unsigned char *block;
+    {
+        Buffer buffer;
+        buffer.setPooled(true);
+        buffer.reserve(100);
+        // rounded up to the smallest block
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize), buffer.capacity());
+        memcpy(buffer.data(), "hello", 5);
+        buffer.resize(5);
+
+        // growing keeps the contents
+        buffer.reserve(BufferPool::MinBlockSize + 1);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize * 2), buffer.capacity());
+        CPPUNIT_ASSERT(!memcmp(buffer.data(), "hello", 5));
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(5), buffer.size());
+        // the smaller block went back already
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize), BufferPool::pooledBytes());
+
+        // moved from buffers stay pooled
+        Buffer moved(std::move(buffer));
+        CPPUNIT_ASSERT(buffer.isPooled());
+        CPPUNIT_ASSERT(!buffer.data());
+        block = moved.data();
+    }
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize * 3), BufferPool::pooledBytes());
+
+    // and the next one of that size gets the same block
+    Buffer buffer;
+    buffer.setPooled(true);
+    buffer.resize(BufferPool::MinBlockSize * 2);
+    CPPUNIT_ASSERT(buffer.data() == block);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize), BufferPool::pooledBytes());
+
+    // assigning over a pooled buffer gives its block back
+    buffer = Buffer();
+    CPPUNIT_ASSERT(!buffer.isPooled());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize * 3), BufferPool::pooledBytes());
+
+    // turning it off copies into regular memory
+    Buffer other;
+    other.setPooled(true);
+    other.resize(3);
+    memcpy(other.data(), "abc", 3);
+    other.setPooled(false);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), other.size());
+    CPPUNIT_ASSERT(!memcmp(other.data(), "abc", 3));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize * 3), BufferPool::pooledBytes());
+
+    BufferPool::clear();
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), BufferPool::pooledBytes());
+}
+
+void BufferTestSuite::poolLimit()
+{
+    BufferPool::clear();
+    const size_t max = BufferPool::maxPoolBytes();
+    BufferPool::setMaxPoolBytes(BufferPool::MinBlockSize * 2);
+    {
+        Buffer buffers[4];
+        for (Buffer &buffer : buffers) {
+            buffer.setPooled(true);
+            buffer.resize(1);
+        }
+        // too big for the pool
+        Buffer large;
+        large.setPooled(true);
+        large.resize(BufferPool::MaxBlockSize + 1);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MaxBlockSize + 1), large.capacity());
+    }
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(BufferPool::MinBlockSize * 2), BufferPool::pooledBytes());
+    BufferPool::setMaxPoolBytes(max);
+    BufferPool::clear();
+}
@@ -0,0 +1,20 @@
+#ifndef BUFFERTESTSUITE_H
+#define BUFFERTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class BufferTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(BufferTestSuite);
+    CPPUNIT_TEST(pooledBuffers);
+    CPPUNIT_TEST(poolLimit);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void pooledBuffers();
+    void poolLimit();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BufferTestSuite);
+
+#endif
@@ -0,0 +1,538 @@
+#include "ConnectionTestSuite.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <rct/CompressionStream.h>
+#include <rct/Connection.h>
+#include <rct/EventLoop.h>
+#include <rct/FileMessage.h>
+#include <rct/ResponseMessage.h>
+#include <rct/SharedMemoryRing.h>
+#include <rct/SocketServer.h>
+#include <rct/Timer.h>
+
+// Sends Count messages of increasing size in both directions and checks that
+// they all arrive in order. The server side echoes every message back.
+static void exchange(bool serverSharedMemory, bool expectSharedMemory)
+{
+    enum {
+        Count = 500
+    };
+
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+
+    std::shared_ptr<Connection> serverConnection;
+    server.newConnection().connect([&](SocketServer *) {
+        serverConnection = Connection::create(server.nextConnection());
+        if (serverSharedMemory)
+            serverConnection->setSharedMemoryTransport(true);
+        serverConnection->newMessage().connect([](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &connection) {
+            connection->send(ResponseMessage(std::static_pointer_cast<ResponseMessage>(message)->data()));
+        });
+    });
+
+    std::shared_ptr<Connection> connection = Connection::create();
+    connection->setSharedMemoryTransport(true, 16 * 1024);
+    int received = 0;
+    bool ordered = true;
+    connection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+        const String data = std::static_pointer_cast<ResponseMessage>(message)->data();
+        if (data != String(received * 97, static_cast<char>('a' + received % 26)))
+            ordered = false;
+        if (++received == Count)
+            loop->quit();
+    });
+    CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+    // large messages don't fit into the 16k rings in one go
+    for (int i = 0; i < Count; ++i)
+        CPPUNIT_ASSERT(connection->send(ResponseMessage(String(i * 97, static_cast<char>('a' + i % 26)))));
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<int>(Count), received);
+    CPPUNIT_ASSERT(ordered);
+    CPPUNIT_ASSERT_EQUAL(expectSharedMemory, connection->isSharedMemoryActive());
+    CPPUNIT_ASSERT(serverConnection);
+    CPPUNIT_ASSERT_EQUAL(expectSharedMemory, serverConnection->isSharedMemoryActive());
+    unlink(socketFile.constData());
+}
+
+void ConnectionTestSuite::sharedMemoryTransport()
+{
+    exchange(true, true);
+}
+
+void ConnectionTestSuite::sharedMemoryRejected()
+{
+    exchange(false, false);
+}
+
+void ConnectionTestSuite::sharedMemoryRingCorrupted()
+{
+    enum {
+        Capacity = 1024
+    };
+    alignas(64) unsigned char memory[4096];
+    CPPUNIT_ASSERT(SharedMemoryRing::requiredSize(Capacity) <= sizeof(memory));
+    SharedMemoryRing writer(memory, Capacity, true);
+    SharedMemoryRing reader(memory, Capacity, false);
+    char data[Capacity];
+    memset(data, 'r', sizeof(data));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(100), writer.write(data, 100));
+    CPPUNIT_ASSERT(!reader.isCorrupted());
+
+    // the head is the first thing in the header, the peer moves it way
+    // past what the ring can hold
+    const uint32_t head = 100 + 4 * Capacity;
+    memcpy(memory, &head, sizeof(head));
+    CPPUNIT_ASSERT(reader.isCorrupted());
+    CPPUNIT_ASSERT(writer.isCorrupted());
+    CPPUNIT_ASSERT(reader.available() > reader.capacity());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), reader.read(data, sizeof(data)));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), writer.space());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), writer.write(data, 10));
+}
+
+void ConnectionTestSuite::broadcast()
+{
+    enum {
+        Clients = 20,
+        Count = 100
+    };
+
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+
+    List<std::shared_ptr<Connection>> subscribers;
+    server.newConnection().connect([&](SocketServer *) {
+        subscribers.append(Connection::create(server.nextConnection()));
+        if (subscribers.size() < Clients)
+            return;
+        for (int i = 0; i < Count; ++i) {
+            const int sent = Connection::broadcast(ResponseMessage(String(i * 1000, static_cast<char>('a' + i % 26))), subscribers);
+            CPPUNIT_ASSERT_EQUAL(static_cast<int>(Clients), sent);
+        }
+    });
+
+    List<std::shared_ptr<Connection>> clients;
+    int received = 0, done = 0;
+    bool ordered = true;
+    for (int c = 0; c < Clients; ++c) {
+        std::shared_ptr<Connection> connection = Connection::create();
+        std::shared_ptr<int> count = std::make_shared<int>(0);
+        connection->newMessage().connect([&, count](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+            const String data = std::static_pointer_cast<ResponseMessage>(message)->data();
+            if (data != String(*count * 1000, static_cast<char>('a' + *count % 26)))
+                ordered = false;
+            ++received;
+            if (++*count == Count && ++done == Clients)
+                loop->quit();
+        });
+        CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+        clients.append(connection);
+    }
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<int>(Clients * Count), received);
+    CPPUNIT_ASSERT(ordered);
+    unlink(socketFile.constData());
+}
+
+void ConnectionTestSuite::fileMessage()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    Message::registerMessage<FileMessage>();
+
+    const Path file = String::format<64>("/tmp/rct-connection-file-%d", getpid());
+    String contents;
+    for (int i = 0; contents.size() < 300000; ++i)
+        contents += String::format<32>("line %d\n", i);
+    CPPUNIT_ASSERT(Path::write(file, contents));
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    // sendfile() over the socket and encode() into the shared memory rings
+    for (bool sharedMemory : { false, true }) {
+        unlink(socketFile.constData());
+        SocketServer server;
+        CPPUNIT_ASSERT(server.listen(socketFile));
+        std::shared_ptr<Connection> serverConnection;
+        server.newConnection().connect([&](SocketServer *) {
+            serverConnection = Connection::create(server.nextConnection());
+            if (sharedMemory)
+                serverConnection->setSharedMemoryTransport(true);
+            serverConnection->newMessage().connect([&](const std::shared_ptr<Message> &, const std::shared_ptr<Connection> &connection) {
+                CPPUNIT_ASSERT(connection->send(FileMessage(file)));
+                CPPUNIT_ASSERT(connection->send(FileMessage(file, 1000, 5000)));
+                connection->finish();
+            });
+        });
+
+        std::shared_ptr<Connection> connection = Connection::create();
+        if (sharedMemory)
+            connection->setSharedMemoryTransport(true);
+        List<String> received;
+        connection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+            if (message->messageId() == FileMessage::MessageId) {
+                const std::shared_ptr<FileMessage> fileMessage = std::static_pointer_cast<FileMessage>(message);
+                CPPUNIT_ASSERT_EQUAL(file, fileMessage->path());
+                received.append(fileMessage->contents());
+            }
+        });
+        connection->finished().connect([&](const std::shared_ptr<Connection> &, int) { loop->quit(); });
+        CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+        CPPUNIT_ASSERT(connection->send(ResponseMessage("send")));
+
+        loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+        loop->exec();
+
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), received.size());
+        CPPUNIT_ASSERT(received.at(0) == contents);
+        CPPUNIT_ASSERT(received.at(1) == contents.mid(1000, 5000));
+        CPPUNIT_ASSERT_EQUAL(sharedMemory, connection->isSharedMemoryActive());
+    }
+    unlink(socketFile.constData());
+
+    // a length the frame doesn't hold isn't allocated
+    String value;
+    {
+        Serializer serializer(value);
+        FileMessage(file).encodePrefix(serializer);
+    }
+    value += "truncated";
+    Deserializer deserializer(value);
+    FileMessage truncated;
+    truncated.decode(deserializer);
+    CPPUNIT_ASSERT(!truncated.isValid());
+    CPPUNIT_ASSERT(truncated.contents().empty());
+    unlink(file.constData());
+}
+
+void ConnectionTestSuite::fileMessageRemoved()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    Message::registerMessage<FileMessage>();
+
+    const Path file = String::format<64>("/tmp/rct-connection-file-%d", getpid());
+    const Path gone = String::format<64>("/tmp/rct-connection-gone-%d", getpid());
+    const String contents(20000, 'f');
+    CPPUNIT_ASSERT(Path::write(file, contents));
+    CPPUNIT_ASSERT(Path::write(gone, contents));
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+    std::shared_ptr<Connection> serverConnection;
+    server.newConnection().connect([&](SocketServer *) {
+        serverConnection = Connection::create(server.nextConnection());
+        serverConnection->newMessage().connect([&](const std::shared_ptr<Message> &, const std::shared_ptr<Connection> &connection) {
+            // the length was taken when the message was made, the file is
+            // gone or shorter by the time it's sent
+            const FileMessage removed(gone);
+            CPPUNIT_ASSERT(removed.isValid());
+            unlink(gone.constData());
+            CPPUNIT_ASSERT(!connection->send(removed));
+            const FileMessage shrunk(file);
+            CPPUNIT_ASSERT(::truncate(file.constData(), 100) == 0);
+            CPPUNIT_ASSERT(!connection->send(shrunk));
+            // nothing of them went out, the stream is still in sync
+            CPPUNIT_ASSERT(connection->isConnected());
+            CPPUNIT_ASSERT(connection->send(FileMessage(file)));
+            connection->finish();
+        });
+    });
+
+    std::shared_ptr<Connection> connection = Connection::create();
+    List<String> received;
+    connection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+        if (message->messageId() == FileMessage::MessageId)
+            received.append(std::static_pointer_cast<FileMessage>(message)->contents());
+    });
+    bool finished = false;
+    connection->finished().connect([&](const std::shared_ptr<Connection> &, int) {
+        finished = true;
+        loop->quit();
+    });
+    CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+    CPPUNIT_ASSERT(connection->send(ResponseMessage("send")));
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+
+    CPPUNIT_ASSERT(finished);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), received.size());
+    CPPUNIT_ASSERT(received.at(0) == contents.left(100));
+    unlink(socketFile.constData());
+    unlink(file.constData());
+}
+
+void ConnectionTestSuite::checksums()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    Message::registerMessage<FileMessage>();
+
+    const Path file = String::format<64>("/tmp/rct-connection-checksums-%d", getpid());
+    CPPUNIT_ASSERT(Path::write(file, "file contents"));
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+    std::shared_ptr<Connection> serverConnection;
+    server.newConnection().connect([&](SocketServer *) {
+        serverConnection = Connection::create(server.nextConnection());
+        serverConnection->setChecksums(true);
+        serverConnection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &connection) {
+            CPPUNIT_ASSERT_EQUAL(static_cast<uint8_t>(ResponseMessage::MessageId), message->messageId());
+            // FileMessage can't go out with sendfile() and falls back to encode()
+            CPPUNIT_ASSERT(connection->send(ResponseMessage(std::static_pointer_cast<ResponseMessage>(message)->data())));
+            CPPUNIT_ASSERT(connection->send(ResponseMessage("second")));
+            CPPUNIT_ASSERT(connection->send(FileMessage(file)));
+            connection->finish();
+        });
+    });
+
+    std::shared_ptr<Connection> connection = Connection::create();
+    connection->setChecksums(true);
+    List<String> received;
+    connection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+        if (message->messageId() == FileMessage::MessageId)
+            received.append(std::static_pointer_cast<FileMessage>(message)->contents());
+        else if (message->messageId() == ResponseMessage::MessageId)
+            received.append(std::static_pointer_cast<ResponseMessage>(message)->data());
+    });
+    connection->finished().connect([&](const std::shared_ptr<Connection> &, int) { loop->quit(); });
+    CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+    CPPUNIT_ASSERT(connection->send(ResponseMessage("echo")));
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), received.size());
+    CPPUNIT_ASSERT(received.at(0) == "echo");
+    CPPUNIT_ASSERT(received.at(1) == "second");
+    CPPUNIT_ASSERT(received.at(2) == "file contents");
+    unlink(socketFile.constData());
+    unlink(file.constData());
+}
+
+// added is only sent to peers of version 2 and later
+class VersionedMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = 201
+    };
+
+    VersionedMessage(int flags = None)
+        : Message(MessageId, flags)
+    {
+    }
+
+    int before = 0;
+    String added;
+    int after = 0;
+
+    RCT_MESSAGE_FIELDS(VersionedMessage, RCT_FIELD(before), RCT_FIELD_SINCE(added, 2), RCT_FIELD(after));
+};
+
+void ConnectionTestSuite::versionedFields()
+{
+    Message::registerMessage<VersionedMessage>();
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+    std::shared_ptr<Connection> serverConnection;
+    server.newConnection().connect([&](SocketServer *) {
+        serverConnection = Connection::create(server.nextConnection(), 1);
+        serverConnection->newMessage().connect([&](const std::shared_ptr<Message> &, const std::shared_ptr<Connection> &connection) {
+            // streamed, cached and broadcast
+            for (int flags : { Message::None, Message::MessageCache }) {
+                VersionedMessage message(flags);
+                message.before = 1;
+                message.added  = "not for version 1";
+                message.after  = 2;
+                CPPUNIT_ASSERT(connection->send(message));
+            }
+            VersionedMessage message;
+            message.before = 1;
+            message.added  = "not for version 1";
+            message.after  = 2;
+            CPPUNIT_ASSERT_EQUAL(1, Connection::broadcast(message, List<std::shared_ptr<Connection>>() << connection));
+            connection->finish();
+        });
+    });
+
+    std::shared_ptr<Connection> connection = Connection::create(1);
+    List<std::shared_ptr<VersionedMessage>> received;
+    connection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+        if (message->messageId() == VersionedMessage::MessageId)
+            received.append(std::static_pointer_cast<VersionedMessage>(message));
+    });
+    connection->finished().connect([&](const std::shared_ptr<Connection> &, int) { loop->quit(); });
+    CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+    CPPUNIT_ASSERT(connection->send(ResponseMessage("send")));
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), received.size());
+    for (const std::shared_ptr<VersionedMessage> &message : received) {
+        CPPUNIT_ASSERT_EQUAL(1, message->before);
+        CPPUNIT_ASSERT(message->added.isEmpty());
+        CPPUNIT_ASSERT_EQUAL(2, message->after);
+    }
+    VersionedMessage message;
+    message.added = "abc";
+    CPPUNIT_ASSERT_EQUAL(Serializer::encodedSize(0, 0), message.encodedSize(1));
+    CPPUNIT_ASSERT_EQUAL(Serializer::encodedSize(0, message.added, 0), message.encodedSize(2));
+    unlink(socketFile.constData());
+}
+
+#ifdef RCT_HAVE_ZLIB
+class TextMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = 202
+    };
+
+    TextMessage(const String &text = String(), int flags = None)
+        : Message(MessageId, flags)
+        , text(text)
+    {
+    }
+
+    String text;
+
+    RCT_MESSAGE_FIELDS(TextMessage, RCT_FIELD(text));
+};
+
+// Sends @a texts with the flags in @a flags from a connection with stream
+// compression and returns what the other end received. The other end quits
+// on the first message it can't decode and stores the error in @a error.
+static List<String> streamCompressed(const List<String> &texts, const List<int> &flags, const String &dictionary,
+                                     Message::MessageError *error = nullptr)
+{
+    Message::registerMessage<TextMessage>();
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    const Path socketFile = String::format<64>("/tmp/rct-connection-test-%d", getpid());
+    unlink(socketFile.constData());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(socketFile));
+    std::shared_ptr<Connection> serverConnection;
+    List<String> received;
+    server.newConnection().connect([&](SocketServer *) {
+        serverConnection = Connection::create(server.nextConnection());
+        serverConnection->setErrorHandler([&](const std::shared_ptr<SocketClient> &, Message::MessageError &&e) {
+            if (error)
+                *error = std::move(e);
+            loop->quit();
+        });
+        serverConnection->newMessage().connect([&](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &) {
+            received.append(std::static_pointer_cast<TextMessage>(message)->text);
+            if (received.size() == texts.size())
+                loop->quit();
+        });
+    });
+
+    std::shared_ptr<Connection> connection = Connection::create();
+    CPPUNIT_ASSERT(connection->setStreamCompression(true, dictionary));
+    CPPUNIT_ASSERT(connection->connectUnix(socketFile));
+    for (size_t i = 0; i < texts.size(); ++i)
+        CPPUNIT_ASSERT(connection->send(TextMessage(texts.at(i), flags.at(i))));
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+    unlink(socketFile.constData());
+    return received;
+}
+
+static String logLines(int first, int count)
+{
+    String text;
+    for (int i = first; i < first + count; ++i)
+        text += String::format<96>("line %d of some log output with a path /src/file%d.cpp\n", i, i % 97);
+    return text;
+}
+
+void ConnectionTestSuite::streamCompression()
+{
+    List<String> texts;
+    List<int> flags;
+    for (int i = 0; i < 20; ++i) {
+        texts.append(logLines(i * 50, 50));
+        flags.append(Message::Compressed);
+    }
+    CPPUNIT_ASSERT(streamCompressed(texts, flags, String()) == texts);
+
+    // later chunks refer back to earlier ones
+    CompressionStream compressor(CompressionStream::Compress), uncompressor(CompressionStream::Uncompress);
+    String first, second, uncompressed;
+    CPPUNIT_ASSERT(compressor.process(texts.at(0).constData(), texts.at(0).size(), first));
+    CPPUNIT_ASSERT(compressor.process(texts.at(0).constData(), texts.at(0).size(), second));
+    CPPUNIT_ASSERT(second.size() < first.size() / 4);
+    CPPUNIT_ASSERT(uncompressor.process(first.constData(), first.size(), uncompressed));
+    CPPUNIT_ASSERT(uncompressor.process(second.constData(), second.size(), uncompressed));
+    CPPUNIT_ASSERT(uncompressed == texts.at(0) + texts.at(0));
+}
+
+void ConnectionTestSuite::streamCompressionDictionary()
+{
+    const String dictionary = logLines(0, 20);
+    CPPUNIT_ASSERT(CompressionStream::registerDictionary(dictionary));
+    const List<String> texts = { logLines(5, 10), logLines(100, 10) };
+    CPPUNIT_ASSERT(streamCompressed(texts, { Message::Compressed, Message::Compressed }, dictionary) == texts);
+}
+
+void ConnectionTestSuite::streamCompressionMissingDictionary()
+{
+    // never registered
+    const String dictionary = "a dictionary only the sending end has " + logLines(1000, 20);
+    Message::MessageError error;
+    const List<String> received = streamCompressed({ logLines(1000, 10) }, { Message::Compressed }, dictionary, &error);
+    CPPUNIT_ASSERT(received.isEmpty());
+    CPPUNIT_ASSERT_EQUAL(Message::Message_CreateError, error.type);
+}
+
+void ConnectionTestSuite::streamCompressionInterleaved()
+{
+    List<String> texts;
+    List<int> flags;
+    for (int i = 0; i < 20; ++i) {
+        texts.append(logLines(i * 10, 10));
+        flags.append(i % 2 ? Message::None : Message::Compressed);
+    }
+    // cached values don't go through the stream
+    texts.append(logLines(500, 10));
+    flags.append(Message::Compressed | Message::MessageCache);
+    texts.append(logLines(600, 10));
+    flags.append(Message::Compressed);
+    CPPUNIT_ASSERT(streamCompressed(texts, flags, String()) == texts);
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef CONNECTIONTESTSUITE_H
+#define CONNECTIONTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ConnectionTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(ConnectionTestSuite);
+    CPPUNIT_TEST(sharedMemoryTransport);
+    CPPUNIT_TEST(sharedMemoryRejected);
+    CPPUNIT_TEST(sharedMemoryRingCorrupted);
+    CPPUNIT_TEST(broadcast);
+    CPPUNIT_TEST(fileMessage);
+    CPPUNIT_TEST(fileMessageRemoved);
+    CPPUNIT_TEST(checksums);
+    CPPUNIT_TEST(versionedFields);
+#ifdef RCT_HAVE_ZLIB
+    CPPUNIT_TEST(streamCompression);
+    CPPUNIT_TEST(streamCompressionDictionary);
+    CPPUNIT_TEST(streamCompressionMissingDictionary);
+    CPPUNIT_TEST(streamCompressionInterleaved);
+#endif
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void sharedMemoryTransport();
+    void sharedMemoryRejected();
+    void sharedMemoryRingCorrupted();
+    void broadcast();
+    void fileMessage();
+    void fileMessageRemoved();
+    void checksums();
+    void versionedFields();
+#ifdef RCT_HAVE_ZLIB
+    void streamCompression();
+    void streamCompressionDictionary();
+    void streamCompressionMissingDictionary();
+    void streamCompressionInterleaved();
+#endif
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ConnectionTestSuite);
+
+#endif
@@ -0,0 +1,310 @@
+#include "DataFileTestSuite.h"
+
+#include <unistd.h>
+
+#include <rct/DataFile.h>
+#include <rct/EventLoop.h>
+#include <rct/Timer.h>
+
+static Path testPath(const char *name)
+{
+    return String::format<128>("/tmp/rct_datafile_%d_%s", getpid(), name);
+}
+
+static bool writeFile(const Path &path, Serializer::Encoding encoding, const Map<String, List<int>> &contents)
+{
+    DataFile file(path, 7, encoding);
+    if (!file.open(DataFile::Write))
+        return false;
+    file << contents;
+    return file.flush();
+}
+
+void DataFileTestSuite::compactFiles()
+{
+    Map<String, List<int>> contents;
+    for (int i = 0; i < 100; ++i) {
+        List<int> &list = contents[String::number(i)];
+        for (int j = 0; j < i; ++j)
+            list.append(j - i);
+    }
+
+    const Path native = testPath("native");
+    const Path compact = testPath("compact");
+    CPPUNIT_ASSERT(writeFile(native, Serializer::Native, contents));
+    CPPUNIT_ASSERT(writeFile(compact, Serializer::Compact, contents));
+    CPPUNIT_ASSERT(compact.fileSize() * 3 < native.fileSize());
+
+    {
+        DataFile file(compact, 7, Serializer::Compact);
+        CPPUNIT_ASSERT(file.open(DataFile::Read));
+        Map<String, List<int>> decoded;
+        file >> decoded;
+        CPPUNIT_ASSERT_EQUAL(contents.size(), decoded.size());
+        for (const auto &it : contents)
+            CPPUNIT_ASSERT(static_cast<const std::vector<int> &>(decoded[it.first]) == it.second);
+    }
+
+    // the encoding is part of the version
+    {
+        DataFile file(compact, 7);
+        CPPUNIT_ASSERT(!file.open(DataFile::Read));
+        CPPUNIT_ASSERT(file.error().contains("Wrong database version"));
+    }
+    {
+        DataFile file(native, 7, Serializer::Compact);
+        CPPUNIT_ASSERT(!file.open(DataFile::Read));
+    }
+
+    Path::rm(native);
+    Path::rm(compact);
+}
+
+struct Entry
+{
+    String name;
+    int size = 0;
+
+    RCT_TAGGED_FIELDS(Entry, RCT_TAGGED_FIELD(name, 1), RCT_TAGGED_FIELD(size, 2));
+};
+
+void DataFileTestSuite::acceptedVersions()
+{
+    const Path path = testPath("versions");
+    {
+        DataFile file(path, 2);
+        CPPUNIT_ASSERT(file.open(DataFile::Write));
+        Entry entry;
+        entry.name = "entry";
+        entry.size = 10;
+        file << entry;
+        CPPUNIT_ASSERT(file.flush());
+    }
+
+    {
+        DataFile file(path, 3);
+        CPPUNIT_ASSERT(!file.open(DataFile::Read));
+    }
+
+    DataFile file(path, 3);
+    file.setAcceptedVersions(1, 3);
+    CPPUNIT_ASSERT(file.open(DataFile::Read));
+    CPPUNIT_ASSERT_EQUAL(2, file.fileVersion());
+    Entry entry;
+    file >> entry;
+    CPPUNIT_ASSERT(entry.name == "entry");
+    CPPUNIT_ASSERT_EQUAL(10, entry.size);
+    Path::rm(path);
+}
+
+void DataFileTestSuite::checksums()
+{
+    const Path path = testPath("checksums");
+    List<String> names;
+    for (int i = 0; i < 50; ++i)
+        names.append(String::format<32>("name%d", i + 1));
+    for (Serializer::Encoding encoding : { Serializer::Native, Serializer::Compact }) {
+        {
+            DataFile file(path, 4, encoding);
+            file.setChecksums(true);
+            CPPUNIT_ASSERT(file.open(DataFile::Write));
+            file << names;
+            CPPUNIT_ASSERT(file.endSection());
+            // the last section is ended by flush()
+            file << 1234;
+            CPPUNIT_ASSERT(file.flush());
+        }
+
+        const String contents = path.readAll();
+        for (int corrupt = 0; corrupt < 2; ++corrupt) {
+            if (corrupt) {
+                String damaged = contents;
+                damaged[contents.size() / 2] ^= 0x1;
+                CPPUNIT_ASSERT(Path::write(path, damaged));
+            }
+            DataFile file(path, 4, encoding);
+            CPPUNIT_ASSERT(file.open(DataFile::Read));
+            CPPUNIT_ASSERT(file.checksums());
+            List<String> decoded;
+            file >> decoded;
+            CPPUNIT_ASSERT_EQUAL(!corrupt, file.endSection());
+            if (corrupt) {
+                CPPUNIT_ASSERT(file.error().contains("Checksum mismatch"));
+                continue;
+            }
+            CPPUNIT_ASSERT(decoded == names);
+            int trailer;
+            file >> trailer;
+            CPPUNIT_ASSERT(file.endSection());
+            CPPUNIT_ASSERT_EQUAL(1234, trailer);
+        }
+    }
+
+    // files without checksums don't have any sections to check
+    CPPUNIT_ASSERT(writeFile(path, Serializer::Native, Map<String, List<int>>()));
+    DataFile file(path, 7);
+    CPPUNIT_ASSERT(file.open(DataFile::Read));
+    CPPUNIT_ASSERT(!file.checksums());
+    CPPUNIT_ASSERT(file.endSection());
+    Path::rm(path);
+}
+
+void DataFileTestSuite::sections()
+{
+    const Path path = testPath("sections");
+    List<String> names;
+    for (int i = 0; i < 100; ++i)
+        names.append(String::format<32>("name%d", i + 1));
+    for (bool checksums : { false, true }) {
+        {
+            DataFile file(path, 5, Serializer::Compact);
+            file.setChecksums(checksums);
+            CPPUNIT_ASSERT(file.open(DataFile::Write));
+            CPPUNIT_ASSERT(file.beginSection("names"));
+            file << names;
+            CPPUNIT_ASSERT(file.beginSection("count"));
+            file << 1234;
+            CPPUNIT_ASSERT(file.beginSection("empty"));
+            CPPUNIT_ASSERT(file.flush());
+        }
+
+        {
+            DataFile file(path, 5, Serializer::Compact);
+            CPPUNIT_ASSERT(file.open(DataFile::Read));
+            CPPUNIT_ASSERT_EQUAL(checksums, file.checksums());
+            CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), file.sections().size());
+            CPPUNIT_ASSERT(file.hasSection("empty"));
+            CPPUNIT_ASSERT(!file.beginSection("missing"));
+            CPPUNIT_ASSERT(file.error().contains("no section missing"));
+
+            // out of order and in part
+            int count;
+            CPPUNIT_ASSERT(file.beginSection("count"));
+            file >> count;
+            CPPUNIT_ASSERT(file.endSection());
+            CPPUNIT_ASSERT_EQUAL(1234, count);
+            CPPUNIT_ASSERT(file.beginSection("names"));
+            String first;
+            uint32_t size;
+            file >> size >> first;
+            CPPUNIT_ASSERT(file.endSection());
+            CPPUNIT_ASSERT_EQUAL(100u, size);
+            CPPUNIT_ASSERT(first == "name1");
+            List<String> decoded;
+            CPPUNIT_ASSERT(file.beginSection("names"));
+            file >> decoded;
+            CPPUNIT_ASSERT(decoded == names);
+            CPPUNIT_ASSERT(file.beginSection("empty"));
+            CPPUNIT_ASSERT(file.endSection());
+        }
+
+        // the rest of a section counts even if it isn't decoded
+        String damaged = path.readAll();
+        damaged[sizeof(int) * 2 + 100] ^= 0x1;
+        CPPUNIT_ASSERT(Path::write(path, damaged));
+        DataFile file(path, 5, Serializer::Compact);
+        CPPUNIT_ASSERT(file.open(DataFile::Read));
+        int count;
+        CPPUNIT_ASSERT(file.beginSection("count"));
+        file >> count;
+        CPPUNIT_ASSERT(file.endSection());
+        CPPUNIT_ASSERT(file.beginSection("names"));
+        uint32_t size;
+        file >> size;
+        CPPUNIT_ASSERT_EQUAL(!checksums, file.endSection());
+    }
+
+    // the table of contents is checked before it's decoded
+    {
+        DataFile file(path, 5);
+        CPPUNIT_ASSERT(file.open(DataFile::Write));
+        CPPUNIT_ASSERT(file.beginSection("names"));
+        file << names;
+        CPPUNIT_ASSERT(file.flush());
+    }
+    String damaged = path.readAll();
+    // the last byte of the last section's checksum, before the trailer
+    damaged[damaged.size() - sizeof(uint32_t) - sizeof(uint64_t) - 1] ^= 0x1;
+    CPPUNIT_ASSERT(Path::write(path, damaged));
+    {
+        DataFile file(path, 5);
+        CPPUNIT_ASSERT(!file.open(DataFile::Read));
+        CPPUNIT_ASSERT(file.error().contains("table of contents"));
+    }
+
+    // files without sections
+    CPPUNIT_ASSERT(writeFile(path, Serializer::Native, Map<String, List<int>>()));
+    DataFile file(path, 7);
+    CPPUNIT_ASSERT(file.open(DataFile::Read));
+    CPPUNIT_ASSERT(file.sections().isEmpty());
+    CPPUNIT_ASSERT(!file.beginSection("names"));
+    Path::rm(path);
+}
+
+void DataFileTestSuite::asyncWrites()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    enum
+    {
+        Count = 20
+    };
+    Map<Path, String> written;
+    for (int i = 0; i < Count; ++i) {
+        const Path path = testPath(String::format<32>("async%d", i + 1).constData());
+        DataFile file(path, 6);
+        file.setChecksums(i % 2);
+        CPPUNIT_ASSERT(file.open(DataFile::WriteAsync));
+        CPPUNIT_ASSERT(file.beginSection("index"));
+        file << i;
+        CPPUNIT_ASSERT(file.beginSection("name"));
+        file << path;
+        CPPUNIT_ASSERT(file.flush([&written](const Path &p, const String &error) {
+            written[p] = error;
+            if (written.size() == Count + 1)
+                EventLoop::eventLoop()->quit();
+        }));
+        // nothing is written on this thread
+        CPPUNIT_ASSERT(!path.exists() || written.contains(path));
+    }
+    // can't create a directory under a regular file
+    const Path blocker = testPath("async_blocker");
+    CPPUNIT_ASSERT(Path::write(blocker, "file"));
+    {
+        DataFile file(blocker + "/sub/file", 6);
+        CPPUNIT_ASSERT(file.open(DataFile::WriteAsync));
+        file << 1;
+        CPPUNIT_ASSERT(file.flush([&written](const Path &p, const String &error) {
+            written[p] = error;
+            if (written.size() == Count + 1)
+                EventLoop::eventLoop()->quit();
+        }));
+    }
+
+    loop->registerTimer([&](int) { loop->quit(); }, 10000, Timer::SingleShot);
+    loop->exec();
+    DataFileWriter::waitForPending();
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(Count + 1), written.size());
+    CPPUNIT_ASSERT(!written[blocker + "/sub/file"].isEmpty());
+    for (int i = 0; i < Count; ++i) {
+        const Path path = testPath(String::format<32>("async%d", i + 1).constData());
+        CPPUNIT_ASSERT(written.value(path, "missing").isEmpty());
+        DataFile file(path, 6);
+        CPPUNIT_ASSERT(file.open(DataFile::Read));
+        CPPUNIT_ASSERT_EQUAL(static_cast<bool>(i % 2), file.checksums());
+        Path name;
+        int index;
+        CPPUNIT_ASSERT(file.beginSection("name"));
+        file >> name;
+        CPPUNIT_ASSERT(file.endSection());
+        CPPUNIT_ASSERT(file.beginSection("index"));
+        file >> index;
+        CPPUNIT_ASSERT(file.endSection());
+        CPPUNIT_ASSERT(name == path);
+        CPPUNIT_ASSERT_EQUAL(i, index);
+        Path::rm(path);
+    }
+    Path::rm(blocker);
+}
@@ -0,0 +1,26 @@
+#ifndef DATAFILETESTSUITE_H
+#define DATAFILETESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class DataFileTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(DataFileTestSuite);
+    CPPUNIT_TEST(compactFiles);
+    CPPUNIT_TEST(acceptedVersions);
+    CPPUNIT_TEST(checksums);
+    CPPUNIT_TEST(sections);
+    CPPUNIT_TEST(asyncWrites);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void compactFiles();
+    void acceptedVersions();
+    void checksums();
+    void sections();
+    void asyncWrites();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DataFileTestSuite);
+
+#endif
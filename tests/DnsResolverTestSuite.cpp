@@ -0,0 +1,123 @@
+#include "DnsResolverTestSuite.h"
+
+#include <thread>
+#include <unistd.h>
+
+#include <rct/DnsResolver.h>
+#include <rct/EventLoop.h>
+#include <rct/SocketClient.h>
+#include <rct/SocketServer.h>
+
+// localhost comes from /etc/hosts so none of this needs a network
+
+void DnsResolverTestSuite::resolveLocalhost()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    DnsResolver::clearCache();
+
+    const std::thread::id self = std::this_thread::get_id();
+    int calls = 0;
+    bool sameThread = true;
+    List<String> first, second;
+    auto callback = [&](const String &host, const List<String> &addresses) {
+        CPPUNIT_ASSERT_EQUAL(String("localhost"), host);
+        sameThread = sameThread && std::this_thread::get_id() == self;
+        (calls++ ? second : first) = addresses;
+        if (calls == 2)
+            loop->quit();
+    };
+    // the second one joins the lookup of the first
+    DnsResolver::resolve("localhost", callback);
+    DnsResolver::resolve("localhost", callback);
+    loop->exec(10000);
+
+    CPPUNIT_ASSERT_EQUAL(2, calls);
+    CPPUNIT_ASSERT(sameThread);
+    CPPUNIT_ASSERT(first.contains("127.0.0.1") || first.contains("::1"));
+    CPPUNIT_ASSERT(first == second);
+
+    List<String> cached;
+    CPPUNIT_ASSERT(DnsResolver::cached("localhost", &cached));
+    CPPUNIT_ASSERT(cached == first);
+
+    // ip addresses never hit getaddrinfo()
+    CPPUNIT_ASSERT(DnsResolver::cached("10.1.2.3", &cached));
+    CPPUNIT_ASSERT(cached == List<String>() << "10.1.2.3");
+}
+
+void DnsResolverTestSuite::cacheTimeout()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    DnsResolver::clearCache();
+    DnsResolver::setCacheTimeout(50);
+
+    bool done = false;
+    DnsResolver::resolve("localhost", [&](const String &, const List<String> &) {
+        done = true;
+        loop->quit();
+    });
+    loop->exec(10000);
+    CPPUNIT_ASSERT(done);
+    CPPUNIT_ASSERT(DnsResolver::cached("localhost", nullptr));
+    usleep(100 * 1000);
+    CPPUNIT_ASSERT(!DnsResolver::cached("localhost", nullptr));
+
+    // nothing is cached with a timeout of 0
+    DnsResolver::setCacheTimeout(0, 0);
+    CPPUNIT_ASSERT(DnsResolver::lookup("localhost").size() > 0);
+    done = false;
+    DnsResolver::resolve("localhost", [&](const String &, const List<String> &) {
+        done = true;
+        loop->quit();
+    });
+    loop->exec(10000);
+    CPPUNIT_ASSERT(done);
+    CPPUNIT_ASSERT(!DnsResolver::cached("localhost", nullptr));
+
+    DnsResolver::setCacheTimeout(DnsResolver::DefaultCacheTimeout);
+}
+
+void DnsResolverTestSuite::connectByName()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+    DnsResolver::clearCache();
+
+    const List<String> addresses = DnsResolver::lookup("localhost");
+    CPPUNIT_ASSERT(!addresses.empty());
+    const SocketServer::Mode mode = addresses.first().contains(':') ? SocketServer::IPv6 : SocketServer::IPv4;
+    SocketServer server;
+    uint16_t port = 0;
+    for (uint16_t p = 30000 + getpid() % 20000; !port && p < 60000; p += 7) {
+        if (server.listen(p, mode))
+            port = p;
+    }
+    CPPUNIT_ASSERT(port);
+
+    String received;
+    std::shared_ptr<SocketClient> accepted;
+    server.newConnection().connect([&](SocketServer *) {
+        accepted = server.nextConnection();
+        accepted->readyRead().connect([&](const std::shared_ptr<SocketClient> &, Buffer &&buffer) {
+            received.append(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+            if (received.size() == 5)
+                loop->quit();
+        });
+    });
+
+    std::shared_ptr<SocketClient> client(new SocketClient);
+    bool connected = false;
+    client->connected().connect([&](const std::shared_ptr<SocketClient> &) { connected = true; });
+    CPPUNIT_ASSERT(client->connect("localhost", port));
+    CPPUNIT_ASSERT_EQUAL(SocketClient::Resolving, client->state());
+    CPPUNIT_ASSERT(client->isConnected());
+    // buffered until the lookup is done
+    CPPUNIT_ASSERT(client->write(String("hello")));
+    loop->exec(10000);
+
+    CPPUNIT_ASSERT(connected);
+    CPPUNIT_ASSERT_EQUAL(String("localhost"), client->hostName());
+    CPPUNIT_ASSERT_EQUAL(String("hello"), received);
+}
@@ -0,0 +1,22 @@
+#ifndef DNSRESOLVERTESTSUITE_H
+#define DNSRESOLVERTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class DnsResolverTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(DnsResolverTestSuite);
+    CPPUNIT_TEST(resolveLocalhost);
+    CPPUNIT_TEST(cacheTimeout);
+    CPPUNIT_TEST(connectByName);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void resolveLocalhost();
+    void cacheTimeout();
+    void connectByName();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DnsResolverTestSuite);
+
+#endif
@@ -0,0 +1,805 @@
+#include "SerializerTestSuite.h"
+
+#include <limits>
+#include <unistd.h>
+
+#include <rct/MemoryMappedFile.h>
+#include <rct/QuitMessage.h>
+#include <rct/ResponseMessage.h>
+#include <rct/Serializer.h>
+
+template <typename T>
+static size_t actualSize(const T &t)
+{
+    String out;
+    Serializer serializer(out);
+    serializer << t;
+    return out.size();
+}
+
+struct Custom
+{
+    int a;
+    String b;
+};
+
+struct Point3
+{
+    int32_t x, y, z;
+};
+
+DECLARE_NATIVE_TYPE(Point3);
+
+struct Record
+{
+    uint64_t id;
+    String path;
+    List<Point3> points;
+    int flags;
+
+    RCT_SERIALIZED_FIELDS(Record, RCT_FIELD(id), RCT_FIELD(path), RCT_FIELD(points), RCT_FIELD_SINCE(flags, 2));
+};
+
+// the same thing, before and after a field was added and one removed
+struct OldSettings
+{
+    int width = 0;
+    String name;
+    List<int> removed;
+
+    RCT_TAGGED_FIELDS(OldSettings, RCT_TAGGED_FIELD(width, 1), RCT_TAGGED_FIELD(name, 2), RCT_TAGGED_FIELD(removed, 3));
+};
+
+struct NewSettings
+{
+    String name;
+    int width = 0;
+    Map<String, int> added;
+
+    RCT_TAGGED_FIELDS(NewSettings, RCT_TAGGED_FIELD(name, 2), RCT_TAGGED_FIELD(width, 1), RCT_TAGGED_FIELD(added, 4));
+};
+
+class SettingsMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = 200
+    };
+
+    SettingsMessage()
+        : Message(MessageId)
+    {
+    }
+
+    NewSettings settings;
+
+    RCT_MESSAGE_TAGGED_FIELDS(SettingsMessage, RCT_TAGGED_FIELD(settings, 1));
+};
+
+class PooledMessage : public Message
+{
+public:
+    enum
+    {
+        MessageId = 203
+    };
+
+    PooledMessage()
+        : Message(MessageId)
+    {
+    }
+
+    String name;
+    List<String> values;
+
+    RCT_MESSAGE_FIELDS(PooledMessage, RCT_FIELD(name), RCT_FIELD(values));
+};
+
+class Wrapper
+{
+public:
+    Wrapper(const String &name = String())
+        : mName(name)
+    {
+    }
+
+    const String &name() const
+    {
+        return mName;
+    }
+
+    List<Record> records;
+
+    RCT_SERIALIZED_FIELDS(Wrapper, RCT_FIELD(mName), RCT_FIELD(records));
+
+private:
+    String mName;
+};
+
+static Serializer &operator<<(Serializer &s, const Custom &custom)
+{
+    s << custom.a << custom.b;
+    return s;
+}
+
+void SerializerTestSuite::encodedSize()
+{
+    const int i = 12;
+    const double d = 1.5;
+    const String string = "foobar";
+    const List<int> ints = { 1, 2, 3, 4 };
+    const List<String> strings = { "a", "bb", "", "cccc" };
+    Map<String, List<int>> map;
+    map["one"] = { 1 };
+    map["three"] = { 1, 2, 3 };
+    Hash<int, String> hash;
+    hash[1] = "one";
+    hash[2] = "two";
+    Set<String> set;
+    set.insert("x");
+    set.insert("yy");
+    const std::pair<int, String> pair(1, "pair");
+    const List<Custom> customs = { { 1, "custom" }, { 2, String() } };
+
+    CPPUNIT_ASSERT_EQUAL(actualSize(i), Serializer::encodedSize(i));
+    CPPUNIT_ASSERT_EQUAL(actualSize(d), Serializer::encodedSize(d));
+    CPPUNIT_ASSERT_EQUAL(actualSize(string), Serializer::encodedSize(string));
+    CPPUNIT_ASSERT_EQUAL(actualSize(ints), Serializer::encodedSize(ints));
+    CPPUNIT_ASSERT_EQUAL(actualSize(strings), Serializer::encodedSize(strings));
+    CPPUNIT_ASSERT_EQUAL(actualSize(map), Serializer::encodedSize(map));
+    CPPUNIT_ASSERT_EQUAL(actualSize(hash), Serializer::encodedSize(hash));
+    CPPUNIT_ASSERT_EQUAL(actualSize(set), Serializer::encodedSize(set));
+    CPPUNIT_ASSERT_EQUAL(actualSize(pair), Serializer::encodedSize(pair));
+    CPPUNIT_ASSERT_EQUAL(actualSize(customs), Serializer::encodedSize(customs));
+    CPPUNIT_ASSERT_EQUAL(actualSize(i) + actualSize(string) + actualSize(map),
+                         Serializer::encodedSize(i, string, map));
+}
+
+void SerializerTestSuite::stringSerializer()
+{
+    Map<String, List<int>> map;
+    for (int i = 0; i < 1000; ++i) {
+        List<int> &values = map[String::format<32>("key%d", i)];
+        for (int j = 0; j < i % 10; ++j)
+            values.append(i + j);
+    }
+    const List<Custom> customs = { { 1, "custom" }, { 2, String() } };
+    const String large(100000, 'x');
+
+    String expected;
+    {
+        Serializer serializer(expected);
+        serializer << map << customs << large << 12;
+    }
+
+    // appends to what's there already
+    String out = "prefix";
+    {
+        StringSerializer serializer(out);
+        CPPUNIT_ASSERT_EQUAL(6, serializer.pos());
+        serializer << map << customs << large << 12;
+        CPPUNIT_ASSERT_EQUAL(static_cast<int>(expected.size() + 6), serializer.pos());
+        CPPUNIT_ASSERT(serializer.flush());
+        CPPUNIT_ASSERT_EQUAL(expected.size() + 6, out.size());
+        // and keeps going after a flush
+        serializer << 13;
+    }
+    CPPUNIT_ASSERT_EQUAL(expected.size() + 6 + sizeof(int), out.size());
+    CPPUNIT_ASSERT(out.startsWith("prefix"));
+    CPPUNIT_ASSERT(!memcmp(out.constData() + 6, expected.constData(), expected.size()));
+
+    Deserializer deserializer(out.constData() + 6, out.size() - 6);
+    Map<String, List<int>> decoded;
+    deserializer >> decoded;
+    CPPUNIT_ASSERT_EQUAL(map.size(), decoded.size());
+    for (const auto &entry : map) {
+        const std::vector<int> &values = decoded[entry.first];
+        CPPUNIT_ASSERT(values == static_cast<const std::vector<int> &>(entry.second));
+    }
+}
+
+template <typename T>
+static String encodeElementwise(const List<T> &list)
+{
+    String out;
+    Serializer serializer(out);
+    serializer << static_cast<uint32_t>(list.size());
+    for (const T &t : list)
+        serializer << t;
+    return out;
+}
+
+void SerializerTestSuite::bulkLists()
+{
+    CPPUNIT_ASSERT(BulkSerializable<int>::value);
+    CPPUNIT_ASSERT(BulkSerializable<Point3>::value);
+    CPPUNIT_ASSERT(!BulkSerializable<bool>::value);
+    CPPUNIT_ASSERT(!BulkSerializable<String>::value);
+
+    List<uint64_t> numbers;
+    for (uint64_t i = 0; i < 10000; ++i)
+        numbers.append(i * 0x100000001ull);
+    List<Point3> points;
+    for (int i = 0; i < 100; ++i)
+        points.append(Point3 { i, -i, i * i });
+    const List<bool> bools = { true, false, true };
+
+    // same bytes as one element at a time
+    String out;
+    {
+        StringSerializer serializer(out);
+        serializer << numbers << points << bools << static_cast<const std::vector<uint64_t> &>(numbers);
+    }
+    const String expected = encodeElementwise(numbers) + encodeElementwise(points) + encodeElementwise(bools) + encodeElementwise(numbers);
+    CPPUNIT_ASSERT(out == expected);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), Serializer::encodedSize(numbers, points, bools, numbers));
+
+    List<uint64_t> decodedNumbers;
+    List<Point3> decodedPoints;
+    List<bool> decodedBools;
+    std::vector<uint64_t> vector;
+    Deserializer deserializer(out);
+    deserializer >> decodedNumbers >> decodedPoints >> decodedBools >> vector;
+    CPPUNIT_ASSERT(deserializer.atEnd());
+    CPPUNIT_ASSERT(static_cast<const std::vector<uint64_t> &>(decodedNumbers) == numbers);
+    CPPUNIT_ASSERT(vector == numbers);
+    CPPUNIT_ASSERT_EQUAL(points.size(), decodedPoints.size());
+    CPPUNIT_ASSERT(!memcmp(points.data(), decodedPoints.data(), points.size() * sizeof(Point3)));
+    CPPUNIT_ASSERT(static_cast<const std::vector<bool> &>(decodedBools) == bools);
+}
+
+void SerializerTestSuite::compactEncoding()
+{
+    List<int> numbers;
+    for (int i = -1000; i <= 1000; ++i)
+        numbers.append(i);
+    Map<String, uint64_t> map;
+    map["small"] = 1;
+    map["large"] = 0xffffffffffffffffull;
+    const String string(300, 'x');
+
+    String out;
+    {
+        Serializer serializer(out);
+        serializer.setEncoding(Serializer::Compact);
+        serializer << 0 << -1 << 1 << 127 << 128 << std::numeric_limits<int64_t>::min() << std::numeric_limits<int64_t>::max()
+                   << static_cast<unsigned short>(65535) << 'c' << true << 1.5 << numbers << map << string << Path("/tmp");
+    }
+    // zigzag puts 127 and 128 at 254 and 256, the extremes take 10 bytes
+    // and the short 3
+    const size_t scalars = 1 + 1 + 1 + 2 + 2 + 10 + 10 + 3 + 1 + 1 + sizeof(double);
+    // -64..63 fit in one byte, the rest in two
+    const size_t list = 2 + 128 + (numbers.size() - 128) * 2;
+    const size_t strings = 1 + (1 + 5 + 10) + (1 + 5 + 1) + 2 + string.size() + 1 + 4;
+    CPPUNIT_ASSERT_EQUAL(scalars + list + strings, out.size());
+
+    int a, b, c, d, e;
+    int64_t min, max;
+    unsigned short us;
+    char ch;
+    bool boolean;
+    double dbl;
+    List<int> decodedNumbers;
+    Map<String, uint64_t> decodedMap;
+    String decodedString;
+    Path path;
+    Deserializer deserializer(out);
+    deserializer.setEncoding(Serializer::Compact);
+    deserializer >> a >> b >> c >> d >> e >> min >> max >> us >> ch >> boolean >> dbl >> decodedNumbers >> decodedMap >> decodedString >> path;
+    CPPUNIT_ASSERT(deserializer.atEnd());
+    CPPUNIT_ASSERT_EQUAL(0, a);
+    CPPUNIT_ASSERT_EQUAL(-1, b);
+    CPPUNIT_ASSERT_EQUAL(1, c);
+    CPPUNIT_ASSERT_EQUAL(127, d);
+    CPPUNIT_ASSERT_EQUAL(128, e);
+    CPPUNIT_ASSERT(min == std::numeric_limits<int64_t>::min());
+    CPPUNIT_ASSERT(max == std::numeric_limits<int64_t>::max());
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(65535), us);
+    CPPUNIT_ASSERT_EQUAL('c', ch);
+    CPPUNIT_ASSERT(boolean);
+    CPPUNIT_ASSERT_EQUAL(1.5, dbl);
+    CPPUNIT_ASSERT(static_cast<const std::vector<int> &>(decodedNumbers) == numbers);
+    CPPUNIT_ASSERT(decodedMap == map);
+    CPPUNIT_ASSERT(decodedString == string);
+    CPPUNIT_ASSERT(path == "/tmp");
+
+    // a truncated varint is an error, not a crash
+    const char truncated[] = { static_cast<char>(0x80) };
+    Deserializer truncatedDeserializer(truncated, sizeof(truncated));
+    truncatedDeserializer.setEncoding(Serializer::Compact);
+    uint64_t value;
+    CPPUNIT_ASSERT(!truncatedDeserializer.readVarint(value));
+    CPPUNIT_ASSERT(truncatedDeserializer.hasError());
+
+    // and so is one that never ends, from memory and from a file
+    const String overlong(11, static_cast<char>(0x80));
+    const String cut = out.left(1 + 1 + 1 + 2 + 2 + 5);
+    FILE *f = tmpfile();
+    for (const String &data : { overlong, cut }) {
+        for (int file = 0; file < 2; ++file) {
+            if (file) {
+                CPPUNIT_ASSERT(!ftruncate(fileno(f), 0));
+                rewind(f);
+                fwrite(data.constData(), 1, data.size(), f);
+                rewind(f);
+            }
+            Deserializer deserializer = file ? Deserializer(f, "", 4) : Deserializer(data);
+            deserializer.setEncoding(Serializer::Compact);
+            // the cut one ends in the middle of the sixth
+            int64_t values[6];
+            for (int64_t &v : values)
+                deserializer >> v;
+            CPPUNIT_ASSERT(deserializer.hasError());
+            CPPUNIT_ASSERT_EQUAL(static_cast<int64_t>(0), values[5]);
+        }
+    }
+    fclose(f);
+}
+
+void SerializerTestSuite::stringViews()
+{
+    const List<String> strings = { "one", "", "three" };
+    Map<String, int> map;
+    map["a"] = 1;
+    map["b"] = 2;
+    const String blob("\0\1\2\3", 4);
+
+    for (Serializer::Encoding encoding : { Serializer::Native, Serializer::Compact }) {
+        String out;
+        {
+            Serializer serializer(out);
+            serializer.setEncoding(encoding);
+            serializer << strings << map << map << blob << StringView(blob);
+        }
+
+        List<StringView> views;
+        Map<StringView, int> viewMap;
+        Hash<StringView, int> viewHash;
+        StringView blobView;
+        String copy;
+        Deserializer deserializer(out.constData(), out.size());
+        deserializer.setEncoding(encoding);
+        deserializer >> views >> viewMap >> viewHash >> blobView >> copy;
+        CPPUNIT_ASSERT(deserializer.atEnd());
+
+        CPPUNIT_ASSERT_EQUAL(strings.size(), views.size());
+        for (size_t i = 0; i < strings.size(); ++i) {
+            CPPUNIT_ASSERT(views[i] == strings[i]);
+            // pointing into the encoded data
+            CPPUNIT_ASSERT(views[i].empty() || (views[i].data() > out.constData() && views[i].end() <= out.constData() + out.size()));
+        }
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), viewMap.size());
+        CPPUNIT_ASSERT_EQUAL(2, viewMap[StringView("b")]);
+        CPPUNIT_ASSERT_EQUAL(1, viewHash[StringView("a")]);
+        CPPUNIT_ASSERT(blobView == StringView(blob));
+        CPPUNIT_ASSERT(blobView.toString() == blob);
+        CPPUNIT_ASSERT(copy == blob);
+        CPPUNIT_ASSERT_EQUAL(Serializer::encodedSize(blob), Serializer::encodedSize(StringView(blob)));
+    }
+
+    // not enough data left
+    const String truncated = String("\x10\0\0\0abc", 7);
+    Deserializer deserializer(truncated);
+    StringView view("x");
+    CPPUNIT_ASSERT(!deserializer.hasError());
+    deserializer >> view;
+    CPPUNIT_ASSERT(view.empty());
+    CPPUNIT_ASSERT(deserializer.hasError());
+}
+
+// List<int>::operator== doesn't compile
+static bool sameMap(const Map<String, List<int>> &a, const Map<String, List<int>> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (auto it = a.begin(), bit = b.begin(); it != a.end(); ++it, ++bit) {
+        if (it->first != bit->first || static_cast<const std::vector<int> &>(it->second) != bit->second)
+            return false;
+    }
+    return true;
+}
+
+void SerializerTestSuite::fileSources()
+{
+    Map<String, List<int>> map;
+    for (int i = 0; i < 200; ++i) {
+        List<int> &values = map[String::format<32>("key%d", i)];
+        for (int j = 0; j < i; ++j)
+            values.append(i * j);
+    }
+    const String blob(100000, 'b');
+
+    const Path path = String::format<64>("/tmp/rct_serializer_%d", getpid());
+    FILE *f = fopen(path.constData(), "w+");
+    CPPUNIT_ASSERT(f);
+    {
+        Serializer serializer(f);
+        serializer << 1234 << map << blob << 5678;
+    }
+    fflush(f);
+
+    // block sizes smaller than most reads, bigger than some and 0
+    for (int readAhead : { 0, 7, 4096, static_cast<int>(Deserializer::ReadAheadBlockSize) }) {
+        rewind(f);
+        int first, last;
+        Map<String, List<int>> decodedMap;
+        String decodedBlob;
+        size_t end;
+        {
+            Deserializer deserializer(f, "", readAhead);
+            CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(path.fileSize()), deserializer.length());
+            char peeked[4];
+            CPPUNIT_ASSERT_EQUAL(4, deserializer.peek(peeked, 4));
+            deserializer >> first >> decodedMap >> decodedBlob;
+            end = deserializer.pos();
+            CPPUNIT_ASSERT(!deserializer.atEnd());
+        }
+        // the FILE is left where decoding stopped
+        CPPUNIT_ASSERT_EQUAL(static_cast<long>(end), ftell(f));
+        CPPUNIT_ASSERT_EQUAL(4, static_cast<int>(fread(&last, 1, 4, f)));
+        CPPUNIT_ASSERT_EQUAL(1234, first);
+        CPPUNIT_ASSERT_EQUAL(5678, last);
+        CPPUNIT_ASSERT(sameMap(decodedMap, map));
+        CPPUNIT_ASSERT(decodedBlob == blob);
+    }
+    // views can't point into a FILE, what follows still decodes
+    for (int readAhead : { 0, 4096 }) {
+        rewind(f);
+        int first, last = 0;
+        Map<String, List<int>> decodedMap;
+        StringView view("x");
+        Deserializer deserializer(f, "", readAhead);
+        deserializer >> first >> decodedMap >> view >> last;
+        CPPUNIT_ASSERT(view.empty());
+        CPPUNIT_ASSERT(deserializer.hasError());
+        CPPUNIT_ASSERT(deserializer.atEnd());
+        CPPUNIT_ASSERT_EQUAL(5678, last);
+    }
+    fclose(f);
+
+    MemoryMappedFile mapped(path);
+    CPPUNIT_ASSERT(mapped.isOpen());
+    {
+        int first, last;
+        Map<String, List<int>> decodedMap;
+        StringView view;
+        Deserializer deserializer(mapped);
+        deserializer >> first >> decodedMap >> view >> last;
+        CPPUNIT_ASSERT(deserializer.atEnd());
+        CPPUNIT_ASSERT_EQUAL(5678, last);
+        CPPUNIT_ASSERT(sameMap(decodedMap, map));
+        // straight out of the mapping
+        CPPUNIT_ASSERT(view.data() > mapped.filePtr<char>() && view.end() < mapped.filePtr<char>() + mapped.size());
+        CPPUNIT_ASSERT(view == StringView(blob));
+    }
+    Path::rm(path);
+}
+
+void SerializerTestSuite::serializedFields()
+{
+    Wrapper wrapper("wrapper");
+    for (int i = 0; i < 3; ++i) {
+        Record record;
+        record.id    = i;
+        record.path  = String::format<32>("/path/%d", i);
+        record.flags = i + 10;
+        for (int j = 0; j < i; ++j)
+            record.points.append(Point3 { i, j, i * j });
+        wrapper.records.append(record);
+    }
+
+    // the same bytes as written by hand
+    String out, expected;
+    {
+        Serializer serializer(out);
+        serializer << wrapper;
+    }
+    {
+        Serializer serializer(expected);
+        serializer << String("wrapper") << static_cast<uint32_t>(wrapper.records.size());
+        for (const Record &record : wrapper.records)
+            serializer << record.id << record.path << record.points << record.flags;
+    }
+    CPPUNIT_ASSERT(out == expected);
+    CPPUNIT_ASSERT_EQUAL(out.size(), Serializer::encodedSize(wrapper));
+
+    Wrapper decoded;
+    {
+        Deserializer deserializer(out);
+        deserializer >> decoded;
+        CPPUNIT_ASSERT(deserializer.atEnd());
+    }
+    CPPUNIT_ASSERT(decoded.name() == "wrapper");
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), decoded.records.size());
+    CPPUNIT_ASSERT_EQUAL(12, decoded.records[2].flags);
+    CPPUNIT_ASSERT(decoded.records[2].path == "/path/2");
+    CPPUNIT_ASSERT_EQUAL(2, decoded.records[2].points[1].z);
+
+    // version 1 streams don't have the flags
+    Record record = wrapper.records[1];
+    String old;
+    {
+        Serializer serializer(old);
+        serializer.setVersion(1);
+        serializer << record;
+    }
+    CPPUNIT_ASSERT_EQUAL(Serializer::encodedSize(record.id, record.path, record.points), old.size());
+    Record decodedRecord;
+    decodedRecord.flags = -1;
+    {
+        Deserializer deserializer(old);
+        deserializer.setVersion(1);
+        deserializer >> decodedRecord;
+        CPPUNIT_ASSERT(deserializer.atEnd());
+    }
+    CPPUNIT_ASSERT_EQUAL(-1, decodedRecord.flags);
+    CPPUNIT_ASSERT_EQUAL(record.id, decodedRecord.id);
+
+    // and messages
+    const QuitMessage quit(42);
+    String message;
+    {
+        Serializer serializer(message);
+        quit.encode(serializer);
+    }
+    CPPUNIT_ASSERT_EQUAL(message.size(), quit.encodedSize());
+    QuitMessage decodedQuit;
+    Deserializer deserializer(message);
+    decodedQuit.decode(deserializer);
+    CPPUNIT_ASSERT_EQUAL(42, decodedQuit.exitCode());
+}
+
+void SerializerTestSuite::taggedFields()
+{
+    OldSettings oldSettings;
+    oldSettings.width = 80;
+    oldSettings.name  = "old";
+    oldSettings.removed << 1 << 2 << 3;
+    NewSettings newSettings;
+    newSettings.width          = 120;
+    newSettings.name           = "new";
+    newSettings.added["added"] = 1;
+
+    for (Serializer::Encoding encoding : { Serializer::Native, Serializer::Compact }) {
+        String oldOut, newOut;
+        {
+            Serializer serializer(oldOut);
+            serializer.setEncoding(encoding);
+            serializer << oldSettings << 1234;
+        }
+        {
+            Serializer serializer(newOut);
+            serializer.setEncoding(encoding);
+            serializer << newSettings << 5678;
+        }
+        if (encoding == Serializer::Native) {
+            CPPUNIT_ASSERT_EQUAL(oldOut.size(), Serializer::encodedSize(oldSettings, 1234));
+            CPPUNIT_ASSERT_EQUAL(newOut.size(), Serializer::encodedSize(newSettings, 5678));
+        }
+
+        // new readers default what's missing
+        NewSettings fromOld;
+        int trailer;
+        {
+            Deserializer deserializer(oldOut);
+            deserializer.setEncoding(encoding);
+            deserializer >> fromOld >> trailer;
+            CPPUNIT_ASSERT(deserializer.atEnd());
+        }
+        CPPUNIT_ASSERT_EQUAL(80, fromOld.width);
+        CPPUNIT_ASSERT(fromOld.name == "old");
+        CPPUNIT_ASSERT(fromOld.added.isEmpty());
+        CPPUNIT_ASSERT_EQUAL(1234, trailer);
+
+        // old readers skip what they don't know, from memory and from files
+        FILE *f = tmpfile();
+        fwrite(newOut.constData(), 1, newOut.size(), f);
+        for (int file = 0; file < 2; ++file) {
+            OldSettings fromNew;
+            rewind(f);
+            Deserializer deserializer = file ? Deserializer(f, "", 4) : Deserializer(newOut);
+            deserializer.setEncoding(encoding);
+            deserializer >> fromNew >> trailer;
+            CPPUNIT_ASSERT(deserializer.atEnd());
+            CPPUNIT_ASSERT_EQUAL(120, fromNew.width);
+            CPPUNIT_ASSERT(fromNew.name == "new");
+            CPPUNIT_ASSERT(fromNew.removed.isEmpty());
+            CPPUNIT_ASSERT_EQUAL(5678, trailer);
+        }
+        fclose(f);
+
+        // cut off before the terminator and inside the last field
+        String settingsOut, terminator;
+        {
+            Serializer serializer(settingsOut);
+            serializer.setEncoding(encoding);
+            serializer << newSettings;
+        }
+        {
+            Serializer serializer(terminator);
+            serializer.setEncoding(encoding);
+            serializer << static_cast<uint32_t>(0);
+        }
+        for (size_t cut : { terminator.size(), terminator.size() + 1 }) {
+            const String truncated = settingsOut.left(settingsOut.size() - cut);
+            f = tmpfile();
+            fwrite(truncated.constData(), 1, truncated.size(), f);
+            for (int file = 0; file < 2; ++file) {
+                OldSettings fromTruncated;
+                rewind(f);
+                Deserializer deserializer = file ? Deserializer(f, "", 4) : Deserializer(truncated);
+                deserializer.setEncoding(encoding);
+                deserializer >> fromTruncated;
+                CPPUNIT_ASSERT(deserializer.hasError());
+            }
+            fclose(f);
+        }
+    }
+
+    // messages from other versions
+    Message::registerMessage<SettingsMessage>();
+    SettingsMessage message;
+    message.settings = newSettings;
+    String frame;
+    {
+        Serializer serializer(frame);
+        serializer << 3 << message.messageId() << message.flags();
+        message.encode(serializer);
+    }
+    Message::MessageError error;
+    CPPUNIT_ASSERT(!Message::create(2, frame.constData(), frame.size(), &error));
+    CPPUNIT_ASSERT_EQUAL(Message::Message_VersionError, error.type);
+    std::shared_ptr<Message> decoded = Message::create(1, 3, frame.constData(), frame.size(), &error);
+    CPPUNIT_ASSERT(decoded);
+    CPPUNIT_ASSERT(std::static_pointer_cast<SettingsMessage>(decoded)->settings.name == "new");
+    CPPUNIT_ASSERT_EQUAL(message.encodedSize(), frame.size() - Serializer::encodedSize(3, message.messageId(), message.flags()));
+
+    // without the terminator
+    const String truncated = frame.left(frame.size() - Serializer::encodedSize(static_cast<uint32_t>(0)));
+    CPPUNIT_ASSERT(!Message::create(3, truncated.constData(), truncated.size(), &error));
+    CPPUNIT_ASSERT_EQUAL(Message::Message_CreateError, error.type);
+}
+
+void SerializerTestSuite::checksums()
+{
+    CPPUNIT_ASSERT_EQUAL(0u, Rct::crc32c("", 0));
+    CPPUNIT_ASSERT_EQUAL(0xe3069283u, Rct::crc32c("123456789", 9));
+    CPPUNIT_ASSERT_EQUAL(0xe3069283u, Rct::crc32c("6789", 4, Rct::crc32c("12345", 5)));
+
+    // long enough for the wide loops, from every alignment
+    String data;
+    for (int i = 0; i < 1000; ++i)
+        data.append(static_cast<char>(i * 7));
+    const uint32_t whole = Rct::crc32c(data.constData(), data.size());
+    for (size_t split = 0; split < 16; ++split)
+        CPPUNIT_ASSERT_EQUAL(whole, Rct::crc32c(data.constData() + split, data.size() - split, Rct::crc32c(data.constData(), split)));
+
+    Map<String, List<int>> contents;
+    contents["one"] << 1 << 2 << 3;
+    contents["two"] << -1;
+    for (Serializer::Encoding encoding : { Serializer::Native, Serializer::Compact }) {
+        String out;
+        uint32_t written;
+        size_t start;
+        {
+            Serializer serializer(out);
+            serializer.setEncoding(encoding);
+            serializer << 1234;
+            start = serializer.pos();
+            serializer.setChecksumming(true);
+            serializer << contents << String("tail");
+            written = serializer.checksum();
+        }
+        CPPUNIT_ASSERT_EQUAL(Rct::crc32c(out.constData() + start, out.size() - start), written);
+
+        FILE *f = tmpfile();
+        fwrite(out.constData(), 1, out.size(), f);
+        for (int file = 0; file < 2; ++file) {
+            rewind(f);
+            Deserializer deserializer = file ? Deserializer(f, "", 4) : Deserializer(out);
+            deserializer.setEncoding(encoding);
+            int head;
+            deserializer >> head;
+            deserializer.setChecksumming(true);
+            Map<String, List<int>> decoded;
+            deserializer >> decoded;
+            CPPUNIT_ASSERT(deserializer.skip(4 + (encoding == Serializer::Compact ? 1 : 4)));
+            CPPUNIT_ASSERT(deserializer.atEnd());
+            CPPUNIT_ASSERT_EQUAL(written, deserializer.checksum());
+        }
+        fclose(f);
+    }
+
+    // Message::Checksummed frames, as Connection::setChecksums() sends them
+    QuitMessage message(12);
+    String frame;
+    {
+        Serializer serializer(frame);
+        serializer << 1 << message.messageId() << static_cast<uint8_t>(Message::Checksummed);
+        const size_t start = frame.size();
+        message.encode(serializer);
+        const uint32_t crc = Rct::crc32c(frame.constData() + start, frame.size() - start);
+        serializer.write(&crc, sizeof(crc));
+    }
+    Message::MessageError error;
+    std::shared_ptr<Message> decoded = Message::create(1, frame.constData(), frame.size(), &error);
+    CPPUNIT_ASSERT(decoded);
+    CPPUNIT_ASSERT_EQUAL(12, std::static_pointer_cast<QuitMessage>(decoded)->exitCode());
+    frame[frame.size() - 5] ^= 0x10;
+    CPPUNIT_ASSERT(!Message::create(1, frame.constData(), frame.size(), &error));
+    CPPUNIT_ASSERT_EQUAL(Message::Message_ChecksumError, error.type);
+
+    // a damaged length never reaches decode()
+    ResponseMessage response("response");
+    frame.clear();
+    {
+        Serializer serializer(frame);
+        serializer << 1 << response.messageId() << static_cast<uint8_t>(Message::Checksummed);
+        const size_t start = frame.size();
+        response.encode(serializer);
+        const uint32_t crc = Rct::crc32c(frame.constData() + start, frame.size() - start);
+        serializer.write(&crc, sizeof(crc));
+        frame[start + 3] = 0x7f;
+    }
+    CPPUNIT_ASSERT(!Message::create(1, frame.constData(), frame.size(), &error));
+    CPPUNIT_ASSERT_EQUAL(Message::Message_ChecksumError, error.type);
+}
+
+static String messageFrame(const Message &message)
+{
+    String frame;
+    Serializer serializer(frame);
+    serializer << 1 << message.messageId() << message.flags();
+    message.encode(serializer);
+    return frame;
+}
+
+void SerializerTestSuite::pooledMessages()
+{
+    Message::registerPooledMessage<PooledMessage>(1);
+    // too late, the first registration's limit stays
+    Message::registerPooledMessage<PooledMessage>(0);
+
+    PooledMessage first, second;
+    first.name = "first";
+    first.values << "a" << "b";
+    second.name = "a longer name than the first one";
+    second.values << "c";
+    const String firstFrame = messageFrame(first), secondFrame = messageFrame(second);
+
+    std::shared_ptr<Message> decoded = Message::create(1, firstFrame.constData(), firstFrame.size());
+    CPPUNIT_ASSERT(decoded);
+    const Message *block = decoded.get();
+    decoded.reset();
+    // would get the block if it had gone back to operator delete
+    const std::shared_ptr<PooledMessage> unpooled = std::make_shared<PooledMessage>();
+    CPPUNIT_ASSERT(unpooled.get() != block);
+
+    decoded = Message::create(1, secondFrame.constData(), secondFrame.size());
+    CPPUNIT_ASSERT(decoded);
+    CPPUNIT_ASSERT(decoded.get() == block);
+    const std::shared_ptr<PooledMessage> recycled = std::static_pointer_cast<PooledMessage>(decoded);
+    CPPUNIT_ASSERT(recycled->name == second.name);
+    CPPUNIT_ASSERT(recycled->values == second.values);
+}
+
+void SerializerTestSuite::messageCleanup()
+{
+    Message::registerMessage<SettingsMessage>();
+    const String settingsFrame = messageFrame(SettingsMessage());
+    const String quitFrame = messageFrame(QuitMessage(3));
+    CPPUNIT_ASSERT(Message::create(1, settingsFrame.constData(), settingsFrame.size()));
+
+    // only what was registered by hand goes away
+    Message::cleanup();
+    Message::MessageError error;
+    CPPUNIT_ASSERT(!Message::create(1, settingsFrame.constData(), settingsFrame.size(), &error));
+    CPPUNIT_ASSERT_EQUAL(Message::Message_IdError, error.type);
+    std::shared_ptr<Message> decoded = Message::create(1, quitFrame.constData(), quitFrame.size(), &error);
+    CPPUNIT_ASSERT(decoded);
+    CPPUNIT_ASSERT_EQUAL(3, std::static_pointer_cast<QuitMessage>(decoded)->exitCode());
+
+    Message::registerMessage<SettingsMessage>();
+    CPPUNIT_ASSERT(Message::create(1, settingsFrame.constData(), settingsFrame.size()));
+}
@@ -0,0 +1,38 @@
+#ifndef SERIALIZERTESTSUITE_H
+#define SERIALIZERTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class SerializerTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(SerializerTestSuite);
+    CPPUNIT_TEST(encodedSize);
+    CPPUNIT_TEST(stringSerializer);
+    CPPUNIT_TEST(bulkLists);
+    CPPUNIT_TEST(compactEncoding);
+    CPPUNIT_TEST(stringViews);
+    CPPUNIT_TEST(fileSources);
+    CPPUNIT_TEST(serializedFields);
+    CPPUNIT_TEST(taggedFields);
+    CPPUNIT_TEST(checksums);
+    CPPUNIT_TEST(pooledMessages);
+    CPPUNIT_TEST(messageCleanup);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void encodedSize();
+    void stringSerializer();
+    void bulkLists();
+    void compactEncoding();
+    void stringViews();
+    void fileSources();
+    void serializedFields();
+    void taggedFields();
+    void checksums();
+    void pooledMessages();
+    void messageCleanup();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SerializerTestSuite);
+
+#endif
@@ -0,0 +1,455 @@
+#include "SocketClientTestSuite.h"
+
+#include <algorithm>
+#include <atomic>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <rct/EventLoop.h>
+#include <rct/SocketClient.h>
+#include <rct/Timer.h>
+#include <rct/SocketServer.h>
+
+void SocketClientTestSuite::writeWatermarksSlowReader()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    int fds[2];
+    CPPUNIT_ASSERT(!::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    const int bufferSize = 16 * 1024;
+    ::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    ::setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    enum {
+        Chunk = 16 * 1024,
+        Total = 4 * 1024 * 1024,
+        Low = 64 * 1024,
+        High = 256 * 1024
+    };
+
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], SocketClient::Unix));
+    client->setWriteWatermarks(Low, High);
+
+    const String chunk(Chunk, 'x');
+    size_t written = 0, maxPending = 0;
+    int blocked = 0, unblocked = 0;
+    std::function<void()> produce = [&]() {
+        while (!client->isWriteBlocked() && written < Total) {
+            CPPUNIT_ASSERT(client->write(chunk));
+            written += Chunk;
+            maxPending = std::max(maxPending, client->pendingWrite());
+        }
+    };
+    client->writeBlocked().connect([&](const std::shared_ptr<SocketClient> &) { ++blocked; });
+    client->writeUnblocked().connect([&](const std::shared_ptr<SocketClient> &) {
+        ++unblocked;
+        loop->callLater([&]() { produce(); });
+    });
+
+    std::atomic<size_t> received(0);
+    std::atomic<bool> corrupted(false);
+    std::thread reader([&]() {
+        char buf[8192];
+        while (received < Total) {
+            const ssize_t r = ::read(fds[1], buf, sizeof(buf));
+            if (r <= 0)
+                break;
+            if (std::count(buf, buf + r, 'x') != r)
+                corrupted = true;
+            received += r;
+            usleep(500);
+        }
+        loop->quit();
+    });
+
+    produce();
+    loop->exec(30000);
+    reader.join();
+    ::close(fds[1]);
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(Total), written);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(Total), received.load());
+    CPPUNIT_ASSERT(!corrupted);
+    CPPUNIT_ASSERT(blocked > 0);
+    CPPUNIT_ASSERT_EQUAL(blocked, unblocked);
+    // the producer never runs more than one chunk past the high watermark
+    CPPUNIT_ASSERT(maxPending < static_cast<size_t>(High + Chunk));
+}
+
+void SocketClientTestSuite::sharedWritesKeepOrder()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    int fds[2];
+    CPPUNIT_ASSERT(!::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    const int bufferSize = 16 * 1024;
+    ::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    ::setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], SocketClient::Unix));
+
+    // the same shared buffer is queued over and over with copied writes in
+    // between, all of it has to come out in the order it was written
+    const std::shared_ptr<const String> shared = std::make_shared<const String>(40000, 's');
+    String expected;
+    for (int i = 0; i < 50; ++i) {
+        const String plain(1000 + i, static_cast<char>('a' + i % 26));
+        CPPUNIT_ASSERT(client->write(plain));
+        CPPUNIT_ASSERT(client->write(shared));
+        expected += plain;
+        expected += *shared;
+    }
+    CPPUNIT_ASSERT(client->pendingWrite() > 0);
+
+    String received;
+    std::thread reader([&]() {
+        char buf[8192];
+        while (received.size() < expected.size()) {
+            const ssize_t r = ::read(fds[1], buf, sizeof(buf));
+            if (r <= 0)
+                break;
+            received.append(buf, r);
+        }
+        loop->quit();
+    });
+
+    loop->exec(30000);
+    reader.join();
+    ::close(fds[1]);
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), client->pendingWrite());
+    CPPUNIT_ASSERT(received == expected);
+    // nothing but the test holds on to the shared buffer anymore
+    CPPUNIT_ASSERT_EQUAL(1l, shared.use_count());
+}
+
+void SocketClientTestSuite::batchedDatagrams()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    enum {
+        Count = 200,
+        MaxSize = 512
+    };
+
+    std::shared_ptr<SocketClient> receiver(new SocketClient(SocketClient::Udp));
+    uint16_t port = 0;
+    for (uint16_t p = 30000 + getpid() % 20000; !port && p < 60000; p += 7) {
+        if (receiver->bind(p))
+            port = p;
+    }
+    CPPUNIT_ASSERT(port);
+    receiver->setDatagramBatching(16, MaxSize);
+
+    List<String> sent;
+    for (int i = 0; i < Count; ++i)
+        sent.append(String(1 + i % 100, static_cast<char>('a' + i % 26)));
+    // gets cut off at MaxSize
+    sent.append(String(MaxSize * 2, 'z'));
+
+    List<String> received;
+    int batches = 0, truncated = 0;
+    bool fromLoopback = true;
+    receiver->readyReadDatagrams().connect([&](const std::shared_ptr<SocketClient> &, const List<SocketClient::Datagram> &datagrams) {
+        ++batches;
+        for (const SocketClient::Datagram &datagram : datagrams) {
+            received.append(String(reinterpret_cast<const char *>(datagram.data), datagram.size));
+            truncated += datagram.truncated;
+            fromLoopback = fromLoopback && datagram.address == "127.0.0.1" && datagram.port;
+        }
+        if (received.size() == sent.size())
+            loop->quit();
+    });
+
+    std::shared_ptr<SocketClient> sender(new SocketClient(SocketClient::Udp));
+    CPPUNIT_ASSERT(sender->bind(0));
+    CPPUNIT_ASSERT(sender->writeTo("127.0.0.1", port, sent));
+    loop->exec(10000);
+
+    CPPUNIT_ASSERT_EQUAL(sent.size(), received.size());
+    for (int i = 0; i < Count; ++i)
+        CPPUNIT_ASSERT(received.at(i) == sent.at(i));
+    CPPUNIT_ASSERT(received.last() == String(MaxSize, 'z'));
+    CPPUNIT_ASSERT_EQUAL(1, truncated);
+    CPPUNIT_ASSERT(fromLoopback);
+    CPPUNIT_ASSERT(batches < Count);
+}
+
+static int socketOption(int fd, int level, int name)
+{
+    int value     = 0;
+    socklen_t len = sizeof(value);
+    return ::getsockopt(fd, level, name, &value, &len) ? -1 : value;
+}
+
+void SocketClientTestSuite::socketOptions()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    // accepted clients inherit the server's options
+    SocketServer server;
+    server.setSocketOptions(SocketOptions().setNoDelay().setKeepAlive(true, 30, 5, 3));
+    uint16_t port = 0;
+    for (uint16_t p = 30000 + getpid() % 20000; !port && p < 60000; p += 7) {
+        if (server.listen(p))
+            port = p;
+    }
+    CPPUNIT_ASSERT(port);
+
+    std::shared_ptr<SocketClient> accepted;
+    server.newConnection().connect([&](SocketServer *) {
+        accepted = server.nextConnection();
+        loop->quit();
+    });
+
+    // set before the socket exists, applied when connect() creates it
+    std::shared_ptr<SocketClient> client(new SocketClient);
+    CPPUNIT_ASSERT(client->setSocketOptions(SocketOptions().setNoDelay().setReceiveBufferSize(64 * 1024)));
+    CPPUNIT_ASSERT(client->connect("127.0.0.1", port));
+    CPPUNIT_ASSERT_EQUAL(1, socketOption(client->socket(), IPPROTO_TCP, TCP_NODELAY) ? 1 : 0);
+    // the kernel doubles it for bookkeeping
+    CPPUNIT_ASSERT(socketOption(client->socket(), SOL_SOCKET, SO_RCVBUF) >= 64 * 1024);
+    CPPUNIT_ASSERT_EQUAL(0, socketOption(client->socket(), SOL_SOCKET, SO_KEEPALIVE));
+    loop->exec(10000);
+
+    CPPUNIT_ASSERT(accepted);
+    CPPUNIT_ASSERT_EQUAL(1, socketOption(accepted->socket(), IPPROTO_TCP, TCP_NODELAY) ? 1 : 0);
+    CPPUNIT_ASSERT_EQUAL(1, socketOption(accepted->socket(), SOL_SOCKET, SO_KEEPALIVE) ? 1 : 0);
+#ifdef TCP_KEEPIDLE
+    CPPUNIT_ASSERT_EQUAL(30, socketOption(accepted->socket(), IPPROTO_TCP, TCP_KEEPIDLE));
+#endif
+    CPPUNIT_ASSERT_EQUAL(5, socketOption(accepted->socket(), IPPROTO_TCP, TCP_KEEPINTVL));
+    CPPUNIT_ASSERT_EQUAL(3, socketOption(accepted->socket(), IPPROTO_TCP, TCP_KEEPCNT));
+
+    // and can be changed on a connected socket
+    CPPUNIT_ASSERT(accepted->setSocketOptions(SocketOptions().setNoDelay(false)));
+    CPPUNIT_ASSERT_EQUAL(0, socketOption(accepted->socket(), IPPROTO_TCP, TCP_NODELAY));
+    CPPUNIT_ASSERT(!accepted->socketOptions().noDelay());
+    CPPUNIT_ASSERT(accepted->socketOptions().keepAlive());
+}
+
+void SocketClientTestSuite::sendFile()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    int fds[2];
+    CPPUNIT_ASSERT(!::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], SocketClient::Unix));
+    size_t written = 0;
+    client->bytesWritten().connect([&](const std::shared_ptr<SocketClient> &, int bytes) { written += bytes; });
+
+    const Path file = String::format<64>("/tmp/rct-sendfile-test-%d", getpid());
+    String contents;
+    for (int i = 0; contents.size() < 2 * 1024 * 1024; ++i)
+        contents += String::format<32>("%d,", i);
+    CPPUNIT_ASSERT(Path::write(file, contents));
+
+    int pipeFds[2];
+    CPPUNIT_ASSERT(!::pipe(pipeFds));
+    const String piped(1000, 'p');
+    CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(piped.size()), ::write(pipeFds[1], piped.constData(), piped.size()));
+
+    // file regions keep their place between regular writes
+    CPPUNIT_ASSERT(client->write(String("head")));
+    CPPUNIT_ASSERT(client->sendFile(file));
+    CPPUNIT_ASSERT(client->write(String("middle")));
+    CPPUNIT_ASSERT(client->sendFile(file, 10, 100000));
+    CPPUNIT_ASSERT(client->sendFile(pipeFds[0], 0, piped.size()));
+    // half of it is there, the rest comes while the loop keeps running
+    int latePipeFds[2];
+    CPPUNIT_ASSERT(!::pipe(latePipeFds));
+    const String late(2000, 'l');
+    CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(1000), ::write(latePipeFds[1], late.constData(), 1000));
+    CPPUNIT_ASSERT(client->sendFile(latePipeFds[0], 0, late.size()));
+    CPPUNIT_ASSERT(client->write(String("tail")));
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+    ::close(latePipeFds[0]);
+    // the file was opened already
+    unlink(file.constData());
+    loop->registerTimer([&](int) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(1000), ::write(latePipeFds[1], late.constData() + 1000, 1000));
+        ::close(latePipeFds[1]);
+    }, 50, Timer::SingleShot);
+
+    const String expected = "head" + contents + "middle" + contents.mid(10, 100000) + piped + late + "tail";
+    String received;
+    std::thread reader([&]() {
+        char buf[65536];
+        while (received.size() < expected.size()) {
+            const ssize_t r = ::read(fds[1], buf, sizeof(buf));
+            if (r <= 0)
+                break;
+            received.append(buf, r);
+        }
+        loop->quit();
+    });
+    loop->exec(30000);
+    reader.join();
+    ::close(fds[1]);
+
+    CPPUNIT_ASSERT(received == expected);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), written);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), client->pendingWrite());
+}
+
+void SocketClientTestSuite::zeroCopy()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    SocketServer server;
+    uint16_t port = 0;
+    for (uint16_t p = 30000 + getpid() % 20000; !port && p < 60000; p += 11) {
+        if (server.listen(p))
+            port = p;
+    }
+    CPPUNIT_ASSERT(port);
+
+    String received;
+    std::shared_ptr<SocketClient> accepted;
+    server.newConnection().connect([&](SocketServer *) {
+        accepted = server.nextConnection();
+        accepted->readyRead().connect([&](const std::shared_ptr<SocketClient> &, Buffer &&buffer) {
+            const Buffer data = std::move(buffer);
+            received.append(reinterpret_cast<const char *>(data.data()), data.size());
+        });
+    });
+
+    std::shared_ptr<SocketClient> client(new SocketClient);
+    if (!client->setZeroCopy(true) || !client->connect("127.0.0.1", port) || !client->isZeroCopy()) {
+        // not supported by this kernel
+        return;
+    }
+
+    String payload;
+    for (int i = 0; payload.size() < 4 * 1024 * 1024; ++i)
+        payload += String::format<32>("%d,", i);
+    std::shared_ptr<const String> data = std::make_shared<const String>(payload);
+    // small writes are copied and keep their place
+    CPPUNIT_ASSERT(client->write(String("head")));
+    CPPUNIT_ASSERT(client->write(data));
+    CPPUNIT_ASSERT(client->write(String("tail")));
+    // held by the write queue or until the kernel is done with it
+    CPPUNIT_ASSERT(data.use_count() > 1);
+
+    const String expected = "head" + payload + "tail";
+    loop->registerTimer([&](int) {
+        if (received.size() >= expected.size() && !client->pendingZeroCopy())
+            loop->quit();
+    }, 10);
+    loop->exec(30000);
+    CPPUNIT_ASSERT(received == expected);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), client->pendingWrite());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), client->pendingZeroCopy());
+    CPPUNIT_ASSERT_EQUAL(1L, data.use_count());
+}
+
+void SocketClientTestSuite::zeroCopyClose()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    SocketServer server;
+    uint16_t port = 0;
+    for (uint16_t p = 30000 + getpid() % 20000 + 5; !port && p < 60000; p += 11) {
+        if (server.listen(p))
+            port = p;
+    }
+    CPPUNIT_ASSERT(port);
+
+    String received;
+    bool closed = false;
+    std::shared_ptr<SocketClient> accepted;
+    server.newConnection().connect([&](SocketServer *) {
+        accepted = server.nextConnection();
+        accepted->readyRead().connect([&](const std::shared_ptr<SocketClient> &, Buffer &&buffer) {
+            const Buffer data = std::move(buffer);
+            received.append(reinterpret_cast<const char *>(data.data()), data.size());
+        });
+        accepted->disconnected().connect([&](const std::shared_ptr<SocketClient> &) { closed = true; });
+        loop->quit();
+    });
+
+    std::shared_ptr<SocketClient> client(new SocketClient);
+    if (!client->setZeroCopy(true) || !client->connect("127.0.0.1", port) || !client->isZeroCopy()) {
+        // not supported by this kernel
+        return;
+    }
+    loop->exec(10000);
+    CPPUNIT_ASSERT(accepted);
+
+    String payload;
+    for (int i = 0; payload.size() < 4 * 1024 * 1024; ++i)
+        payload += String::format<32>("%d,", i);
+    std::shared_ptr<const String> data = std::make_shared<const String>(payload);
+    CPPUNIT_ASSERT(client->write(data));
+    const bool inFlight = client->pendingZeroCopy();
+    client->close();
+    client.reset();
+    // the kernel may still be reading it
+    if (inFlight)
+        CPPUNIT_ASSERT(data.use_count() > 1);
+
+    loop->registerTimer([&](int) {
+        if (closed && data.use_count() == 1)
+            loop->quit();
+    }, 10);
+    loop->exec(30000);
+    CPPUNIT_ASSERT(closed);
+    CPPUNIT_ASSERT_EQUAL(1L, data.use_count());
+    // whatever made it out is intact
+    CPPUNIT_ASSERT(!received.isEmpty());
+    CPPUNIT_ASSERT(received == payload.left(received.size()));
+}
+
+void SocketClientTestSuite::adaptiveReadSize()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    int fds[2];
+    CPPUNIT_ASSERT(!::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::shared_ptr<SocketClient> client(new SocketClient(fds[0], SocketClient::Unix));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(SocketClient::MinReadSize), client->readSize());
+
+    size_t received = 0, expected = 0;
+    client->readyRead().connect([&](const std::shared_ptr<SocketClient> &, Buffer &&buffer) {
+        const Buffer data = std::move(buffer);
+        CPPUNIT_ASSERT(data.isPooled());
+        received += data.size();
+        if (received == expected)
+            loop->quit();
+    });
+
+    // large reads grow it
+    const String chunk(64 * 1024, 'x');
+    for (int i = 0; i < 4; ++i) {
+        expected += chunk.size();
+        std::thread writer([&]() { CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(chunk.size()), ::write(fds[1], chunk.constData(), chunk.size())); });
+        loop->exec(10000);
+        writer.join();
+    }
+    CPPUNIT_ASSERT_EQUAL(expected, received);
+    const size_t grown = client->readSize();
+    CPPUNIT_ASSERT(grown > SocketClient::MinReadSize);
+    CPPUNIT_ASSERT(grown <= SocketClient::MaxReadSize);
+
+    // and small ones shrink it again
+    for (int i = 0; i < 16; ++i) {
+        expected += 10;
+        CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(10), ::write(fds[1], "0123456789", 10));
+        loop->exec(10000);
+    }
+    CPPUNIT_ASSERT_EQUAL(expected, received);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(SocketClient::MinReadSize), client->readSize());
+    ::close(fds[1]);
+}
@@ -0,0 +1,32 @@
+#ifndef SOCKETCLIENTTESTSUITE_H
+#define SOCKETCLIENTTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class SocketClientTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(SocketClientTestSuite);
+    CPPUNIT_TEST(writeWatermarksSlowReader);
+    CPPUNIT_TEST(sharedWritesKeepOrder);
+    CPPUNIT_TEST(batchedDatagrams);
+    CPPUNIT_TEST(socketOptions);
+    CPPUNIT_TEST(sendFile);
+    CPPUNIT_TEST(zeroCopy);
+    CPPUNIT_TEST(zeroCopyClose);
+    CPPUNIT_TEST(adaptiveReadSize);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void writeWatermarksSlowReader();
+    void sharedWritesKeepOrder();
+    void batchedDatagrams();
+    void socketOptions();
+    void sendFile();
+    void zeroCopy();
+    void zeroCopyClose();
+    void adaptiveReadSize();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SocketClientTestSuite);
+
+#endif
@@ -0,0 +1,133 @@
+#include "SocketServerTestSuite.h"
+
+#include <condition_variable>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include <rct/EventLoop.h>
+#include <rct/Map.h>
+#include <rct/SocketClient.h>
+#include <rct/SocketServer.h>
+
+static int connectUnix(const Path &path)
+{
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.constData(), sizeof(addr.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void SocketServerTestSuite::acceptBatches()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    const Path path = String::format<64>("/tmp/rct-socketserver-test-%d", getpid());
+    SocketServer server;
+    server.setMaxAcceptsPerWakeup(4);
+    CPPUNIT_ASSERT(server.listen(path));
+
+    enum { Count = 50 };
+    List<int> fds;
+    for (int i = 0; i < Count; ++i) {
+        const int fd = connectUnix(path);
+        CPPUNIT_ASSERT(fd != -1);
+        fds.append(fd);
+    }
+
+    // everything past the first batch is only seen if the listener is
+    // reported again
+    List<std::shared_ptr<SocketClient>> clients;
+    server.newConnection().connect([&](SocketServer *) {
+        std::shared_ptr<SocketClient> client = server.nextConnection();
+        CPPUNIT_ASSERT(client);
+        CPPUNIT_ASSERT(::fcntl(client->socket(), F_GETFL) & O_NONBLOCK);
+        CPPUNIT_ASSERT(::fcntl(client->socket(), F_GETFD) & FD_CLOEXEC);
+        clients.append(client);
+        if (clients.size() == Count)
+            loop->quit();
+    });
+    loop->exec(10000);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(Count), clients.size());
+
+    for (int fd : fds)
+        ::close(fd);
+}
+
+void SocketServerTestSuite::eventLoops()
+{
+    std::shared_ptr<EventLoop> loop(new EventLoop);
+    loop->init(EventLoop::MainEventLoop);
+
+    enum { Workers = 2, Count = 20 };
+    std::mutex mutex;
+    std::condition_variable cond;
+    List<std::shared_ptr<EventLoop>> workers;
+    List<std::thread::id> workerThreads;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < Workers; ++i) {
+        threads.push_back(std::thread([&]() {
+            std::shared_ptr<EventLoop> worker(new EventLoop);
+            worker->init();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                workers.append(worker);
+                workerThreads.append(std::this_thread::get_id());
+            }
+            cond.notify_one();
+            worker->exec();
+        }));
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (workers.size() < Workers)
+            cond.wait(lock);
+    }
+
+    const Path path = String::format<64>("/tmp/rct-socketserver-test-%d", getpid());
+    SocketServer server;
+    CPPUNIT_ASSERT(server.listen(path));
+
+    int emitted = 0, handled = 0;
+    Map<std::thread::id, int> perThread;
+    server.newConnection().connect([&](SocketServer *) { ++emitted; });
+    server.setEventLoops(workers, [&](const std::shared_ptr<SocketClient> &client) {
+        CPPUNIT_ASSERT(client->isConnected());
+        std::lock_guard<std::mutex> lock(mutex);
+        ++perThread[std::this_thread::get_id()];
+        if (++handled == Count)
+            loop->callLater([loop]() { loop->quit(); });
+    });
+
+    List<int> fds;
+    for (int i = 0; i < Count; ++i) {
+        const int fd = connectUnix(path);
+        CPPUNIT_ASSERT(fd != -1);
+        fds.append(fd);
+    }
+    loop->exec(10000);
+
+    for (const std::shared_ptr<EventLoop> &worker : workers)
+        worker->callLater([worker]() { worker->quit(); });
+    for (std::thread &thread : threads)
+        thread.join();
+    for (int fd : fds)
+        ::close(fd);
+
+    CPPUNIT_ASSERT_EQUAL(0, emitted);
+    CPPUNIT_ASSERT_EQUAL(static_cast<int>(Count), handled);
+    // round robin
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(Workers), perThread.size());
+    for (const std::thread::id &id : workerThreads)
+        CPPUNIT_ASSERT_EQUAL(Count / Workers, perThread.value(id));
+}
@@ -0,0 +1,20 @@
+#ifndef SOCKETSERVERTESTSUITE_H
+#define SOCKETSERVERTESTSUITE_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class SocketServerTestSuite : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(SocketServerTestSuite);
+    CPPUNIT_TEST(acceptBatches);
+    CPPUNIT_TEST(eventLoops);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void acceptBatches();
+    void eventLoops();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SocketServerTestSuite);
+
+#endif